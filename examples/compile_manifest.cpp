@@ -0,0 +1,28 @@
+// Copyright 2014 Ruimao Zhang
+//
+// Compiles an image list ("<class>_<id>.<ext>" per line) into the binary
+// manifest read by the data layer and test_net_triplet_MAP when the data
+// layer sets 'manifest' (see caffe/util/dataset_manifest.hpp).
+// Usage:
+//    compile_manifest img_files manifest.bin
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/dataset_manifest.hpp"
+
+using namespace caffe;
+using namespace std;
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		LOG(ERROR) << "compile_manifest img_files manifest.bin";
+		return 0;
+	}
+	const int count = CompileDatasetManifest(argv[1], argv[2]);
+	DatasetManifest manifest(argv[2]);
+	LOG(INFO) << "Compiled " << count << " images of "
+			<< manifest.num_classes() << " classes into " << argv[2];
+	return 0;
+}
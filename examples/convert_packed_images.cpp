@@ -0,0 +1,64 @@
+// Copyright 2014 Ruimao Zhang
+//
+// Packs the images of an image list ("<class>_<id>.<ext>" per line) into one
+// memory-mapped file of raw pixels, read by the data layer when it sets
+// 'packed_source' (see caffe/util/packed_images.hpp). All images must have
+// the size of the first one; they are stored as loaded by the data layer,
+// i.e. 3-channel BGR.
+// Usage:
+//    convert_packed_images root_folder img_files packed.bin
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/highgui/highgui_c.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/dataset_manifest.hpp"
+#include "caffe/util/packed_images.hpp"
+
+using namespace caffe;
+using namespace std;
+
+int main(int argc, char** argv) {
+	if (argc < 4) {
+		LOG(ERROR) << "convert_packed_images root_folder img_files packed.bin";
+		return 0;
+	}
+	const string root_folder(argv[1]);
+	std::ifstream list(argv[2]);
+	CHECK(list) << "Failed to open " << argv[2];
+	PackedImageWriter writer;
+	string line, class_name;
+	int image_id;
+	int height = 0, width = 0;
+	while (list >> line) {
+		cv::Mat img = cv::imread(root_folder + "/" + line, CV_LOAD_IMAGE_COLOR);
+		CHECK(img.data) << "Could not open or find file " << root_folder << "/"
+				<< line;
+		if (writer.count() == 0) {
+			writer.Open(argv[3], img.rows, img.cols, img.channels());
+			height = img.rows;
+			width = img.cols;
+			LOG(INFO) << "Packing " << img.rows << "x" << img.cols << "x"
+					<< img.channels() << " images into " << argv[3];
+		}
+		CHECK(img.rows == height && img.cols == width) << line << " is "
+				<< img.rows << "x" << img.cols << ", not " << height << "x"
+				<< width;
+		CHECK(img.isContinuous());
+		ParseImageName(line, &class_name, &image_id);
+		writer.Append(class_name, image_id, img.data);
+		if (writer.count() % 1000 == 0) {
+			LOG(INFO) << "Packed " << writer.count() << " images";
+		}
+	}
+	CHECK_GT(writer.count(), 0) << "No images in " << argv[2];
+	const uint64_t count = writer.count();
+	writer.Close();
+	LOG(INFO) << "Packed " << count << " images into " << argv[3];
+	return 0;
+}
@@ -0,0 +1,409 @@
+// Copyright 2014 Ruimao Zhang
+//
+// Long-running retrieval service: loads the hashing net and a database of
+// codes once, then answers queries over a local Unix domain socket.
+// Usage:
+//    retrieval_server net_proto snapshot database_codes.bin socket_path
+//        CPU/GPU [--batch_wait_ms=2] [--layout=planes]
+// net_proto is the query net used by test_net_triplet_MAP; its data layer is
+// replaced by an input blob of the same batchsize and crop, and its loss is
+// dropped. database_codes.bin is a packed code file written by that tool.
+// Every request is one line and gets one line back:
+//    image <k> <path>          the k nearest database images of an image
+//    code <k> <word> ...       ... of a code given as hex uint64 words
+//    -> ok <n> <name> <distance> ...   or   error <message>
+// Image requests that arrive within batch_wait_ms of each other share one
+// forward pass of up to batchsize images. With --layout=planes the database
+// is searched in bit-plane layout, most important bits first, instead of
+// through the multi-index hash.
+
+#include <cuda_runtime.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/bit_plane.hpp"
+#include "caffe/util/code_file.hpp"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/mih_index.hpp"
+#include "caffe/util/unix_socket.hpp"
+
+using namespace caffe;
+using namespace std;
+
+// Returns the value of an optional trailing "--name=value" argument, or NULL.
+const char* FindFlag(int argc, char** argv, const char* name) {
+	const size_t len = strlen(name);
+	for (int i = 6; i < argc; i++) {
+		if (strncmp(argv[i], "--", 2) == 0
+				&& strncmp(argv[i] + 2, name, len) == 0
+				&& argv[i][len + 2] == '=') {
+			return argv[i] + len + 3;
+		}
+	}
+	return NULL;
+}
+
+// The query net with its data layer replaced by an input blob and without
+// the layers that consume the triplet matrix (the loss).
+NetParameter DeployNet(const NetParameter& param, LayerParameter* data_param) {
+	CHECK_GT(param.layers_size(), 0);
+	const LayerConnection& data_layer = param.layers(0);
+	CHECK_EQ(data_layer.layer().type(), "data");
+	CHECK_EQ(data_layer.top_size(), 2);
+	*data_param = data_layer.layer();
+	CHECK_GT(data_param->cropsize(), 0)
+			<< "The server needs a fixed cropsize to size its input blob.";
+
+	NetParameter deploy;
+	deploy.set_name(param.name());
+	deploy.add_input(data_layer.top(0));
+	deploy.add_input_dim(data_param->batchsize());
+	deploy.add_input_dim(3);
+	deploy.add_input_dim(
+			data_param->has_cropsize_h() ?
+					data_param->cropsize_h() : data_param->cropsize());
+	deploy.add_input_dim(
+			data_param->has_cropsize_w() ?
+					data_param->cropsize_w() : data_param->cropsize());
+	for (int i = 1; i < param.layers_size(); i++) {
+		bool uses_matrix = false;
+		for (int j = 0; j < param.layers(i).bottom_size(); j++) {
+			uses_matrix |= param.layers(i).bottom(j) == data_layer.top(1);
+		}
+		if (!uses_matrix) {
+			*deploy.add_layers() = param.layers(i);
+		}
+	}
+	return deploy;
+}
+
+struct Request {
+	string image;
+	int k;
+	timeval arrival;
+	bool done;
+	string response;
+};
+
+class RetrievalServer {
+public:
+	RetrievalServer(Net<float>* net, const LayerParameter& data_param,
+			const CodeFile& database, const int batch_wait_ms,
+			const bool bit_planes);
+	// Accepts connections forever, one thread each.
+	void Serve(const string& socket_path);
+
+protected:
+	static void* ConnectionEntry(void* arg);
+	static void* BatchEntry(void* arg);
+	void ServeConnection(const int fd);
+	void BatchLoop();
+	string Answer(const uint64_t* code, const int k) const;
+	bool LoadImage(const string& filename, float* data) const;
+
+	Net<float>* net_;
+	const CodeFile& database_;
+	HashCodeStore database_codes_;
+	MultiIndexHash index_;
+	// Used instead of index_ if use_planes_.
+	BitPlaneStore planes_;
+	bool use_planes_;
+	// The hashing features are the input of the ElementWiseProductLayer.
+	Blob<float>* features_;
+	int batchsize_;
+	int crop_h_, crop_w_;
+	float scale_;
+	Blob<float> mean_;
+	int batch_wait_ms_;
+
+	pthread_mutex_t mutex_;
+	pthread_cond_t queued_;
+	pthread_cond_t answered_;
+	deque<Request*> queue_;
+	// Batches run and images they carried, for the fill-rate log.
+	long batches_;
+	long batched_images_;
+};
+
+RetrievalServer::RetrievalServer(Net<float>* net,
+		const LayerParameter& data_param, const CodeFile& database,
+		const int batch_wait_ms, const bool bit_planes) :
+		net_(net), database_(database), use_planes_(bit_planes),
+		features_(NULL), batch_wait_ms_(batch_wait_ms), batches_(0),
+		batched_images_(0) {
+	for (int i = 0; i < net_->layers().size(); i++) {
+		if (dynamic_cast<ElementWiseProductLayer<float>*>(net_->layers()[i].get())) {
+			features_ = net_->bottom_vecs()[i][0];
+		}
+	}
+	CHECK(features_) << "The net has no ElementWiseProductLayer.";
+	CHECK_EQ(database_.type(), CODE_FILE_PACKED_BITS);
+	CHECK_EQ(features_->count() / features_->num(), database_.code_bits())
+			<< "The database codes do not match the net.";
+	database_codes_.Attach(database_.codes(), database_.count(),
+			database_.code_bits());
+	if (use_planes_) {
+		planes_.Build(database_codes_);
+		LOG(INFO) << "Transposed " << database_codes_.num() << " codes of "
+				<< database_codes_.nbits() << " bits into bit planes, "
+				<< planes_.memory_size() << " bytes";
+	} else {
+		index_.Build(database_codes_);
+		LOG(INFO) << "Indexed " << database_codes_.num() << " codes of "
+				<< database_codes_.nbits() << " bits in "
+				<< index_.num_substrings() << " tables";
+	}
+
+	Blob<float>* input = net_->input_blobs()[0];
+	batchsize_ = input->num();
+	crop_h_ = input->height();
+	crop_w_ = input->width();
+	scale_ = data_param.scale();
+	if (data_param.has_meanfile()) {
+		BlobProto blob_proto;
+		ReadProtoFromBinaryFile(data_param.meanfile().c_str(), &blob_proto);
+		mean_.FromProto(blob_proto);
+		CHECK_EQ(mean_.channels(), 3);
+	}
+
+	pthread_mutex_init(&mutex_, NULL);
+	pthread_cond_init(&queued_, NULL);
+	pthread_cond_init(&answered_, NULL);
+}
+
+// Crops the centre of an image and normalizes it like the test phase of
+// the DataLayer does.
+bool RetrievalServer::LoadImage(const string& filename, float* data) const {
+	cv::Mat img = cv::imread(filename, CV_LOAD_IMAGE_COLOR);
+	if (!img.data || img.rows < crop_h_ || img.cols < crop_w_) {
+		return false;
+	}
+	if (mean_.count()
+			&& (img.rows != mean_.height() || img.cols != mean_.width())) {
+		return false;
+	}
+	const int h_off = (img.rows - crop_h_) / 2;
+	const int w_off = (img.cols - crop_w_) / 2;
+	const float* mean = mean_.count() ? mean_.cpu_data() : NULL;
+	for (int c = 0; c < 3; ++c) {
+		for (int h = 0; h < crop_h_; ++h) {
+			for (int w = 0; w < crop_w_; ++w) {
+				const float pixel = img.at<cv::Vec3b>(h + h_off, w + w_off)[c];
+				const float m = mean ?
+						mean[(c * img.rows + h + h_off) * img.cols + w + w_off] : 0;
+				data[(c * crop_h_ + h) * crop_w_ + w] = 128 * scale_
+						- (pixel - m) * scale_;
+			}
+		}
+	}
+	return true;
+}
+
+string RetrievalServer::Answer(const uint64_t* code, const int k) const {
+	vector<int> ids, distances;
+	if (use_planes_) {
+		planes_.KnnSearch(code, k, &ids, &distances);
+	} else {
+		index_.KnnSearch(code, k, &ids, &distances);
+	}
+	std::ostringstream response;
+	response << "ok " << ids.size();
+	for (int i = 0; i < ids.size(); i++) {
+		response << " " << database_.name(ids[i]) << " " << distances[i];
+	}
+	return response.str();
+}
+
+void* RetrievalServer::BatchEntry(void* arg) {
+	reinterpret_cast<RetrievalServer*>(arg)->BatchLoop();
+	return NULL;
+}
+
+void RetrievalServer::BatchLoop() {
+	const int code_bits = database_codes_.nbits();
+	vector<uint64_t> code(database_codes_.words());
+	Blob<float>* input = net_->input_blobs()[0];
+	const int image_size = input->count() / input->num();
+	vector<Request*> batch;
+	while (true) {
+		// Wait for a first request, then give later ones batch_wait_ms to
+		// join it unless the batch fills up first.
+		pthread_mutex_lock(&mutex_);
+		while (queue_.empty()) {
+			pthread_cond_wait(&queued_, &mutex_);
+		}
+		timeval first = queue_.front()->arrival;
+		timespec deadline;
+		const long usec = first.tv_usec + batch_wait_ms_ * 1000L;
+		deadline.tv_sec = first.tv_sec + usec / 1000000;
+		deadline.tv_nsec = (usec % 1000000) * 1000;
+		while (queue_.size() < batchsize_) {
+			if (pthread_cond_timedwait(&queued_, &mutex_, &deadline)
+					== ETIMEDOUT) {
+				break;
+			}
+		}
+		batch.clear();
+		while (!queue_.empty() && batch.size() < batchsize_) {
+			batch.push_back(queue_.front());
+			queue_.pop_front();
+		}
+		pthread_mutex_unlock(&mutex_);
+
+		float* data = input->mutable_cpu_data();
+		memset(data, 0, sizeof(float) * input->count());
+		vector<bool> loaded(batch.size());
+		for (int i = 0; i < batch.size(); i++) {
+			loaded[i] = LoadImage(batch[i]->image, data + i * image_size);
+		}
+		net_->ForwardPrefilled();
+		const float* features = features_->cpu_data();
+		for (int i = 0; i < batch.size(); i++) {
+			if (loaded[i]) {
+				// Same bit order as the database codes were written in.
+				BinarizeCode(features + i * code_bits, code_bits,
+						database_.bit_order(), &code[0]);
+				batch[i]->response = Answer(&code[0], batch[i]->k);
+			} else {
+				batch[i]->response = "error cannot load " + batch[i]->image;
+			}
+		}
+
+		pthread_mutex_lock(&mutex_);
+		for (int i = 0; i < batch.size(); i++) {
+			batch[i]->done = true;
+		}
+		pthread_cond_broadcast(&answered_);
+		++batches_;
+		batched_images_ += batch.size();
+		if (batches_ % 100 == 0) {
+			LOG(INFO) << batches_ << " batches, mean fill "
+					<< float(batched_images_) / batches_ << " / " << batchsize_;
+		}
+		pthread_mutex_unlock(&mutex_);
+	}
+}
+
+struct Connection {
+	RetrievalServer* server;
+	int fd;
+};
+
+void* RetrievalServer::ConnectionEntry(void* arg) {
+	Connection* connection = reinterpret_cast<Connection*>(arg);
+	connection->server->ServeConnection(connection->fd);
+	close(connection->fd);
+	delete connection;
+	return NULL;
+}
+
+void RetrievalServer::ServeConnection(const int fd) {
+	LineReader reader(fd);
+	string line;
+	vector<uint64_t> code(database_codes_.words());
+	while (reader.ReadLine(&line)) {
+		std::istringstream request(line);
+		string kind;
+		int k = 0;
+		request >> kind >> k;
+		string response;
+		if (!request || k <= 0) {
+			response = "error expected: image|code <k> ...";
+		} else if (kind == "code") {
+			int words = 0;
+			while (words < code.size() && request >> std::hex >> code[words]) {
+				++words;
+			}
+			response = words == code.size() ?
+					Answer(&code[0], k) : "error wrong code length";
+		} else if (kind == "image") {
+			Request image_request;
+			std::getline(request >> std::ws, image_request.image);
+			image_request.k = k;
+			image_request.done = false;
+			gettimeofday(&image_request.arrival, NULL);
+			pthread_mutex_lock(&mutex_);
+			queue_.push_back(&image_request);
+			pthread_cond_signal(&queued_);
+			while (!image_request.done) {
+				pthread_cond_wait(&answered_, &mutex_);
+			}
+			pthread_mutex_unlock(&mutex_);
+			response = image_request.response;
+		} else {
+			response = "error unknown request " + kind;
+		}
+		if (!WriteAll(fd, response + "\n")) {
+			break;
+		}
+	}
+}
+
+void RetrievalServer::Serve(const string& socket_path) {
+	pthread_t batch_thread;
+	CHECK(!pthread_create(&batch_thread, NULL, BatchEntry, this))
+			<< "Pthread execution failed.";
+	const int listen_fd = ListenUnixSocket(socket_path);
+	LOG(INFO) << "Serving on " << socket_path << ", batchsize " << batchsize_
+			<< ", batch wait " << batch_wait_ms_ << " ms";
+	while (true) {
+		const int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			CHECK_EQ(errno, EINTR) << "accept failed: " << strerror(errno);
+			continue;
+		}
+		Connection* connection = new Connection();
+		connection->server = this;
+		connection->fd = fd;
+		pthread_t thread;
+		CHECK(!pthread_create(&thread, NULL, ConnectionEntry, connection))
+				<< "Pthread execution failed.";
+		pthread_detach(thread);
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 5) {
+		LOG(ERROR) << "retrieval_server net_proto snapshot database_codes.bin "
+				<< "socket_path [CPU/GPU] [--batch_wait_ms=2] [--layout=planes]";
+		return 0;
+	}
+
+	cudaSetDevice(0);
+	Caffe::set_phase(Caffe::TEST);
+	if (argc >= 6 && strcmp(argv[5], "CPU") == 0) {
+		LOG(INFO) << "Using CPU";
+		Caffe::set_mode(Caffe::CPU);
+	} else {
+		LOG(INFO) << "Using GPU";
+		Caffe::set_mode(Caffe::GPU);
+	}
+
+	NetParameter net_param;
+	ReadProtoFromTextFile(argv[1], &net_param);
+	LayerParameter data_param;
+	Net<float> net(DeployNet(net_param, &data_param));
+	NetParameter trained_net_param;
+	ReadProtoFromBinaryFile(argv[2], &trained_net_param);
+	net.CopyTrainedLayersFrom(trained_net_param);
+
+	CodeFile database(argv[3]);
+	const char* wait_flag = FindFlag(argc, argv, "batch_wait_ms");
+	const char* layout_flag = FindFlag(argc, argv, "layout");
+	RetrievalServer server(&net, data_param, database,
+			wait_flag ? atoi(wait_flag) : 2,
+			layout_flag && strcmp(layout_flag, "planes") == 0);
+	server.Serve(argv[4]);
+	return 0;
+}
@@ -0,0 +1,137 @@
+// Copyright 2014 Ruimao Zhang
+//
+// Coordinator of a sharded Hamming index: scatters every query code to the
+// shard_server processes, merges their top-k lists into the global ranking
+// and writes it out.
+// Usage:
+//    shard_coordinator query_codes.bin k results.txt socket_path ...
+//        [--threads=N] [--verify=database_codes.bin]
+// Every line of results.txt is a query name followed by its k nearest items
+// as <global id>:<distance>, nearest first, ties by ascending id. With
+// --verify the merged lists are checked against a single index over the
+// whole database.
+
+#include <sys/time.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/code_file.hpp"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/mih_index.hpp"
+#include "caffe/util/parallel.hpp"
+#include "caffe/util/shard_search.hpp"
+
+using namespace caffe;
+using namespace std;
+
+// Returns the value of an optional trailing "--name=value" argument, or NULL.
+const char* FindFlag(int argc, char** argv, const char* name) {
+	const size_t len = strlen(name);
+	for (int i = 4; i < argc; i++) {
+		if (strncmp(argv[i], "--", 2) == 0
+				&& strncmp(argv[i] + 2, name, len) == 0
+				&& argv[i][len + 2] == '=') {
+			return argv[i] + len + 3;
+		}
+	}
+	return NULL;
+}
+
+struct SearchTask {
+	const vector<string>* socket_paths;
+	const CodeFile* queries;
+	int k;
+	vector<vector<int> >* ids;
+	vector<vector<int> >* distances;
+};
+
+// Every thread has its own connections to the shards.
+void SearchWorker(WorkQueue* queue, void* task_pointer) {
+	SearchTask* task = reinterpret_cast<SearchTask*>(task_pointer);
+	const int words = HashCodeWords(task->queries->code_bits());
+	ShardedIndex index(*task->socket_paths, task->queries->code_bits());
+	int begin, end;
+	while (queue->Next(&begin, &end)) {
+		for (int i = begin; i < end; ++i) {
+			index.KnnSearch(
+					task->queries->codes() + static_cast<size_t>(i) * words, task->k,
+					&(*task->ids)[i], &(*task->distances)[i]);
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 5) {
+		LOG(ERROR) << "shard_coordinator query_codes.bin k results.txt "
+				<< "socket_path ... [--threads=N] [--verify=database_codes.bin]";
+		return 0;
+	}
+	CodeFile queries(argv[1]);
+	CHECK_EQ(queries.type(), CODE_FILE_PACKED_BITS);
+	const int k = atoi(argv[2]);
+	CHECK_GT(k, 0);
+	vector<string> socket_paths;
+	for (int i = 4; i < argc; i++) {
+		if (strncmp(argv[i], "--", 2) != 0) {
+			socket_paths.push_back(argv[i]);
+		}
+	}
+	const char* threads_flag = FindFlag(argc, argv, "threads");
+	const int num_threads =
+			threads_flag ? atoi(threads_flag) : DefaultEvalThreads();
+
+	vector<vector<int> > ids(queries.count()), distances(queries.count());
+	SearchTask task;
+	task.socket_paths = &socket_paths;
+	task.queries = &queries;
+	task.k = k;
+	task.ids = &ids;
+	task.distances = &distances;
+	struct timeval start, finish;
+	gettimeofday(&start, NULL);
+	ParallelFor(queries.count(), 1, num_threads, SearchWorker, &task);
+	gettimeofday(&finish, NULL);
+	const double seconds = (finish.tv_sec - start.tv_sec)
+			+ (finish.tv_usec - start.tv_usec) / 1e6;
+	LOG(INFO) << queries.count() << " queries on " << socket_paths.size()
+			<< " shards in " << seconds << " s ("
+			<< queries.count() / seconds << " queries/s)";
+
+	ofstream results(argv[3]);
+	for (int i = 0; i < queries.count(); i++) {
+		results << queries.name(i);
+		for (int j = 0; j < ids[i].size(); j++) {
+			results << ' ' << ids[i][j] << ':' << distances[i][j];
+		}
+		results << '\n';
+	}
+	results.close();
+
+	const char* verify_flag = FindFlag(argc, argv, "verify");
+	if (verify_flag) {
+		CodeFile database(verify_flag);
+		CHECK_EQ(database.code_bits(), queries.code_bits());
+		HashCodeStore codes;
+		codes.Attach(database.codes(), database.count(), database.code_bits());
+		MultiIndexHash index;
+		index.Build(codes);
+		const int words = HashCodeWords(queries.code_bits());
+		vector<int> expected_ids, expected_distances;
+		int mismatches = 0;
+		for (int i = 0; i < queries.count(); i++) {
+			index.KnnSearch(queries.codes() + static_cast<size_t>(i) * words, k,
+					&expected_ids, &expected_distances);
+			mismatches += expected_ids != ids[i]
+					|| expected_distances != distances[i];
+		}
+		LOG(INFO) << "Verified against a single index: " << mismatches
+				<< " of " << queries.count() << " queries differ";
+		CHECK_EQ(mismatches, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,87 @@
+// Copyright 2014 Ruimao Zhang
+//
+// One shard of a sharded Hamming index: indexes a contiguous slice of a
+// packed code file and answers knn requests from shard_coordinator over a
+// local Unix domain socket.
+// Usage:
+//    shard_server database_codes.bin shard num_shards socket_path
+// Shard s of n owns items [s * N / n, (s + 1) * N / n) of the N codes and
+// reports them by their global ids (see caffe/util/shard_search.hpp).
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/code_file.hpp"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/mih_index.hpp"
+#include "caffe/util/shard_search.hpp"
+#include "caffe/util/unix_socket.hpp"
+
+using namespace caffe;
+using namespace std;
+
+struct Connection {
+	const MultiIndexHash* index;
+	int id_offset;
+	int fd;
+};
+
+void* ServeConnection(void* arg) {
+	Connection* connection = reinterpret_cast<Connection*>(arg);
+	ServeShardConnection(*connection->index, connection->id_offset,
+			connection->fd);
+	close(connection->fd);
+	delete connection;
+	return NULL;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 5) {
+		LOG(ERROR) << "shard_server database_codes.bin shard num_shards "
+				<< "socket_path";
+		return 0;
+	}
+	CodeFile database(argv[1]);
+	CHECK_EQ(database.type(), CODE_FILE_PACKED_BITS);
+	const int shard = atoi(argv[2]);
+	const int num_shards = atoi(argv[3]);
+	CHECK_GE(shard, 0);
+	CHECK_LT(shard, num_shards);
+	const int begin = ShardBegin(database.count(), shard, num_shards);
+	const int end = ShardBegin(database.count(), shard + 1, num_shards);
+
+	HashCodeStore codes;
+	codes.Attach(database.codes()
+			+ static_cast<size_t>(begin) * HashCodeWords(database.code_bits()),
+			end - begin, database.code_bits());
+	MultiIndexHash index;
+	index.Build(codes);
+
+	const int listen_fd = ListenUnixSocket(argv[4]);
+	LOG(INFO) << "Shard " << shard << "/" << num_shards << ": items [" << begin
+			<< ", " << end << ") of " << database.count() << ", "
+			<< index.num_substrings() << " substrings, serving on " << argv[4];
+	while (true) {
+		const int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			CHECK_EQ(errno, EINTR) << "accept failed: " << strerror(errno);
+			continue;
+		}
+		Connection* connection = new Connection();
+		connection->index = &index;
+		connection->id_offset = begin;
+		connection->fd = fd;
+		pthread_t thread;
+		CHECK(!pthread_create(&thread, NULL, ServeConnection, connection))
+				<< "Pthread execution failed.";
+		pthread_detach(thread);
+	}
+	return 0;
+}
@@ -4,27 +4,297 @@
 // structure is specified by text format protocol buffers, and whose parameter
 // are loaded from a pre-trained network.
 // Usage:
-//    test_net net_proto pretrained_net_proto iterations [CPU/GPU]
+//    test_net_triplet_MAP query_net_proto database_net_proto snapshot
+//        output_feature_path CPU/GPU nbits [tag] [--threads=N]
+//        [--lengths=8,16,...] [--weighted=levels] [--cache=dir]
+//        [--precision_at=10,50,100] [--radius=2] [--cmc=1,5,10]
+//        [--report=metrics.json] [--asymmetric=1] [--rerank=R] [--float=1]
+//        [--blas_threads=query,database]
+// The query (and, with nbits given, database) features and codes are written
+// to output_feature_path as {query,database}_{features,codes}.bin code files,
+// and mAP, precision@k, precision/recall within the radius and CMC of every
+// code length to a JSON report (output_feature_path/metrics.json by default).
+// With --rerank=R every query takes the R nearest codes in Hamming distance
+// and re-ranks them with the float features, which are read from the
+// database feature file (or cache entry); the latency of both stages is
+// reported too. With --float the L most important feature dimensions are
+// compared by squared L2 distance instead of hashing them.
 
 #include <cuda_runtime.h>
 
+#include <algorithm>
+#include <climits>
 #include <cstring>
 #include <cstdlib>
 #include <string>
 #include <iostream>
+#include <sstream>
 #include <vector>
 #include <map>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <termios.h>
 #include <unistd.h>
 
 #include "caffe/caffe.hpp"
+#include "caffe/util/asymmetric_distance.hpp"
+#include "caffe/util/code_file.hpp"
+#include "caffe/util/dataset_manifest.hpp"
+#include "caffe/util/feature_cache.hpp"
+#include "caffe/util/float_distance.hpp"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/hash_eval.hpp"
+#include "caffe/util/mih_index.hpp"
+#include "caffe/util/retrieval_metrics.hpp"
+#include "caffe/util/two_stage_search.hpp"
 
 using namespace caffe;
 using namespace std;
 
-void InsertSort(float *arr, int *ind, int n);
+// Returns the value of an optional trailing "--name=value" argument, or NULL.
+const char* FindFlag(int argc, char** argv, const char* name) {
+	const size_t len = strlen(name);
+	for (int i = 7; i < argc; i++) {
+		if (strncmp(argv[i], "--", 2) == 0
+				&& strncmp(argv[i] + 2, name, len) == 0
+				&& argv[i][len + 2] == '=') {
+			return argv[i] + len + 3;
+		}
+	}
+	return NULL;
+}
+
+// Parses a comma separated list of integers such as "8,16,32".
+void ParseIntList(const char* list, vector<int>* values) {
+	std::stringstream stream(list);
+	string value;
+	while (std::getline(stream, value, ',')) {
+		values->push_back(atoi(value.c_str()));
+	}
+}
+
+// Assigns class ids from the "<class>_<index>" filenames, in order of first
+// appearance, and counts the images of every class.
+void AssignClasses(const vector<string>& filenames, vector<int>* class_ids,
+		map<string, int>* class2id, vector<int>* count_per_class) {
+	class_ids->resize(filenames.size(), 0);
+	for (int i = 0; i < filenames.size(); i++) {
+		string prefix = filenames[i].substr(0, filenames[i].find_last_of('_'));
+		map<string, int>::iterator iter = class2id->find(prefix);
+		if (iter != class2id->end()) {
+			(*class_ids)[i] = iter->second;
+			(*count_per_class)[iter->second]++;
+		} else {
+			(*class_ids)[i] = class2id->size();
+			class2id->insert(iter, make_pair(prefix, class2id->size()));
+			count_per_class->push_back(1);
+		}
+	}
+}
+
+// Assigns the classes of the images of a data layer that reads a compiled
+// manifest: the layer kept the records within its id bounds, in file order,
+// so the class ids come straight from the manifest.
+void AssignManifestClasses(const LayerParameter& layer,
+		const vector<string>& filenames, vector<int>* class_ids,
+		vector<int>* count_per_class) {
+	DatasetManifest manifest(layer.manifest());
+	vector<int> records;
+	manifest.Select(layer.has_id_lower_bound() ? layer.id_lower_bound() : INT_MIN,
+			layer.has_id_upper_bound() ? layer.id_upper_bound() : INT_MAX,
+			&records);
+	CHECK_EQ(records.size(), filenames.size()) << layer.manifest()
+			<< " does not match the images the net read.";
+	manifest.AssignClasses(records, class_ids, count_per_class);
+}
+
+// The file a data layer reads its image names from.
+string ImageListFile(const LayerParameter& layer) {
+	return layer.has_manifest() ? layer.manifest() : layer.img_files();
+}
+
+// Copies the first nbits bits of every code of full into prefix.
+void PrefixCodes(const HashCodeStore& full, const int nbits,
+		HashCodeStore* prefix) {
+	prefix->Reset(nbits);
+	prefix->Reserve(full.num());
+	vector<uint64_t> code(HashCodeWords(nbits));
+	const int rest = nbits % 64;
+	for (int i = 0; i < full.num(); i++) {
+		std::copy(full.code(i), full.code(i) + code.size(), code.begin());
+		if (rest) {
+			code.back() &= (uint64_t(1) << rest) - 1;
+		}
+		prefix->AppendCode(&code[0]);
+	}
+}
+
+// Mean and 99th percentile of the stage latencies, in microseconds.
+void SummarizeTimings(const vector<TwoStageTiming>& timings,
+		double summary[4]) {
+	vector<double> shortlist(timings.size()), rerank(timings.size());
+	for (int i = 0; i < timings.size(); i++) {
+		shortlist[i] = timings[i].shortlist_us;
+		rerank[i] = timings[i].rerank_us;
+	}
+	vector<double>* stages[2] = { &shortlist, &rerank };
+	for (int s = 0; s < 2; s++) {
+		vector<double>& t = *stages[s];
+		summary[2 * s] = summary[2 * s + 1] = 0;
+		if (t.empty()) {
+			continue;
+		}
+		for (int i = 0; i < t.size(); i++) {
+			summary[2 * s] += t[i] / t.size();
+		}
+		const int p99 = (t.size() - 1) * 99 / 100;
+		std::nth_element(t.begin(), t.begin() + p99, t.end());
+		summary[2 * s + 1] = t[p99];
+	}
+}
+
+// The learned per-bit weights of the ElementWiseProductLayer.
+const Blob<float>* BitWeights(Net<float>* net) {
+	ElementWiseProductLayer<float> *elewiselayer =
+			dynamic_cast<ElementWiseProductLayer<float>*>(net->layers()[13].get());
+	CHECK(elewiselayer);
+	return elewiselayer->blobs()[0].get();
+}
+
+// Forwards the whole data set of net and binarizes the hashing features (the
+// input of layer 13) into codes. Every feature also goes to the non-NULL
+// writers: float features to feature_files, packed codes to code_file; and
+// is kept in all_features unless that is NULL.
+void ExtractCodes(Net<float>* net, const string& tag,
+		const vector<int>& bit_order, HashCodeStore* codes,
+		vector<string>* filenames, const vector<CodeFileWriter*>& feature_files,
+		CodeFileWriter* code_file, vector<float>* all_features) {
+	DataLayer<float> *datalayer =
+			dynamic_cast<DataLayer<float>*>(net->layers()[0].get());
+	CHECK(datalayer);
+	*filenames = datalayer->getFilenames();
+	const int data_counts = datalayer->getDataCount();
+	filenames->resize(data_counts);
+
+	const int FEA_SIZE = (*(net->bottom_vecs().rbegin()))[0]->channels()
+			* (*(net->bottom_vecs().rbegin()))[0]->width()
+			* (*(net->bottom_vecs().rbegin()))[0]->height();
+	LOG(INFO) << "FEA_SIZE: " << FEA_SIZE;
+	CHECK_EQ(FEA_SIZE, codes->nbits());
+
+	vector<Blob<float>*> dummy_blob_input_vec;
+	codes->Reserve(data_counts);
+	const int batchsize = datalayer->layer_param().batchsize();
+	const int batchCount = (data_counts + batchsize - 1) / batchsize;
+	for (int batch_id = 0, file_id = 0;
+			batch_id < batchCount && file_id < data_counts; ++batch_id) {
+		LOG(INFO) << "Total batchs (" << tag << "): " << batchCount
+				<< ", Processing batch (" << tag << "): " << (batch_id + 1);
+		net->Forward(dummy_blob_input_vec);
+
+		Blob<float>* features = (*(net->bottom_vecs().begin() + 13))[0];
+		for (int k = 0; file_id < data_counts && k < batchsize;
+				file_id++, k++) {
+			const float* feas = features->cpu_data() + k * FEA_SIZE;
+			codes->Append(feas, &bit_order[0]);
+			if (all_features) {
+				all_features->insert(all_features->end(), feas, feas + FEA_SIZE);
+			}
+			for (int i = 0; i < feature_files.size(); i++) {
+				feature_files[i]->Append(feas, (*filenames)[file_id]);
+			}
+			if (code_file) {
+				code_file->Append(codes->code(file_id), (*filenames)[file_id]);
+			}
+		}
+	}
+}
+
+// The extraction of one data set (query or database) and its outputs.
+struct ExtractionJob {
+	ExtractionJob() :
+			net(NULL), codes(NULL), filenames(NULL), all_features(NULL),
+			blas_threads(0), write_codes(false), write_cache(false) {
+	}
+	Net<float>* net;
+	string tag;
+	vector<int> bit_order;
+	HashCodeStore* codes;
+	vector<string>* filenames;
+	vector<float>* all_features;
+	// Threads of the BLAS calls made by this job, 0 for the library default.
+	int blas_threads;
+	CodeFileWriter feature_file, code_file, cache_file;
+	vector<CodeFileWriter*> feature_files;
+	bool write_codes;
+	bool write_cache;
+};
+
+// Opens <prefix>features.bin and <prefix>codes.bin unless prefix is empty,
+// and the cache entry unless cache_path is empty.
+void OpenOutputs(const string& prefix, const string& cache_path,
+		const vector<int>& bit_order, const vector<float>& bit_weights,
+		ExtractionJob* job) {
+	const int code_bits = bit_order.size();
+	job->bit_order = bit_order;
+	if (!prefix.empty()) {
+		LOG(INFO) << "feature file:" << prefix << "features.bin";
+		job->feature_file.Open(prefix + "features.bin", CODE_FILE_FLOAT,
+				code_bits, code_bits, &bit_order[0], &bit_weights[0]);
+		job->code_file.Open(prefix + "codes.bin", CODE_FILE_PACKED_BITS,
+				code_bits, code_bits, &bit_order[0], &bit_weights[0]);
+		job->feature_files.push_back(&job->feature_file);
+		job->write_codes = true;
+	}
+	if (!cache_path.empty()) {
+		job->cache_file.Open(cache_path, CODE_FILE_FLOAT, code_bits, code_bits,
+				&bit_order[0], &bit_weights[0]);
+		job->feature_files.push_back(&job->cache_file);
+		job->write_cache = true;
+	}
+}
+
+void CloseOutputs(ExtractionJob* job) {
+	if (job->write_codes) {
+		job->feature_file.Close();
+		job->code_file.Close();
+	}
+	if (job->write_cache) {
+		job->cache_file.Close();
+	}
+}
+
+void* ExtractionThread(void* job_pointer) {
+	ExtractionJob* job = reinterpret_cast<ExtractionJob*>(job_pointer);
+	if (job->blas_threads > 0) {
+		mkl_set_num_threads_local(job->blas_threads);
+	}
+	ExtractCodes(job->net, job->tag, job->bit_order, job->codes,
+			job->filenames, job->feature_files,
+			job->write_codes ? &job->code_file : NULL, job->all_features);
+	return (void*) NULL;
+}
+
+// Runs every job on its own thread, the last one on the calling thread.
+void RunExtractions(const vector<ExtractionJob*>& jobs) {
+	if (jobs.empty()) {
+		return;
+	}
+	vector<pthread_t> threads(jobs.size() - 1);
+	for (int i = 0; i < threads.size(); i++) {
+		CHECK(!pthread_create(&threads[i], NULL, ExtractionThread,
+				reinterpret_cast<void*>(jobs[i]))) << "Pthread execution failed.";
+	}
+	ExtractionThread(jobs.back());
+	for (int i = 0; i < threads.size(); i++) {
+		CHECK(!pthread_join(threads[i], NULL)) << "Pthread joining failed.";
+	}
+	// The last job's budget is per thread; give this one back its default.
+	if (jobs.back()->blas_threads > 0) {
+		mkl_set_num_threads_local(0);
+	}
+}
 
 int main(int argc, char** argv) {
 	if (argc < 3) {
@@ -48,327 +318,379 @@ int main(int argc, char** argv) {
 		LOG(INFO) << "Using " << argv[6] << " bits hashing code.";
 	}
 
-	vector < shared_ptr<Blob<float> > > query_feature_map;
-	vector < shared_ptr<Blob<float> > > database_feature_map;
 	vector<int> query_img_count_per_class;
 	vector<int> database_img_count_per_class;
 
 	vector<int> query_class_ids;
 	vector<int> database_class_ids;
-	map<string, int> query_class2id;
-	map<string, int> database_class2id;
-	int query_data_counts = 0;
-	int database_data_counts = 0;
-	int FEA_SIZE = 0;
 	NetParameter test_net_param_query;
 	ReadProtoFromTextFile(argv[1], &test_net_param_query);
-	Net<float> caffe_test_net_query(test_net_param_query);
 	NetParameter test_net_param_database;
 	ReadProtoFromTextFile(argv[2], &test_net_param_database);
-	Net<float> caffe_test_net_database(test_net_param_database);
-	NetParameter trained_net_param;
-	ReadProtoFromBinaryFile(argv[3], &trained_net_param);
-	caffe_test_net_query.CopyTrainedLayersFrom(trained_net_param);
-	caffe_test_net_database.CopyTrainedLayersFrom(trained_net_param);
 
-	//***************************** query ****************************
-	vector < shared_ptr<Layer<float> > > layers = caffe_test_net_query.layers();
+	// Extracted features are cached under the content of the snapshot, the
+	// net prototxt and its image list, so evaluating a snapshot again (e.g.
+	// for another code length) skips both nets.
+	const char* cache_flag = FindFlag(argc, argv, "cache");
+	FeatureCache cache(cache_flag ? cache_flag : "");
+	string query_key, database_key;
+	CodeFile query_cached, database_cached;
+	bool query_hit = false, database_hit = false;
+	if (cache_flag) {
+		CreateDir(cache_flag);
+		vector<string> key_files;
+		key_files.push_back(argv[3]);
+		key_files.push_back(argv[1]);
+		key_files.push_back(ImageListFile(test_net_param_query.layers(0).layer()));
+		query_key = FeatureCache::Key(key_files);
+		key_files[1] = argv[2];
+		key_files[2] = ImageListFile(test_net_param_database.layers(0).layer());
+		database_key = FeatureCache::Key(key_files);
+		query_hit = cache.Lookup(query_key, &query_cached);
+		database_hit = cache.Lookup(database_key, &database_cached);
+		LOG(INFO) << "Feature cache " << cache_flag << ": query " << query_key
+				<< (query_hit ? " hit" : " miss") << ", database "
+				<< database_key << (database_hit ? " hit" : " miss");
+	}
 
-	//*********************** achieve weight ****************************
-	ElementWiseProductLayer<float> *elewiselayer =
-			dynamic_cast<ElementWiseProductLayer<float>*>(layers[13].get());
-	CHECK(elewiselayer);
+	shared_ptr<Net<float> > caffe_test_net_query;
+	shared_ptr<Net<float> > caffe_test_net_database;
+	if (!query_hit || !database_hit) {
+		NetParameter trained_net_param;
+		ReadProtoFromBinaryFile(argv[3], &trained_net_param);
+		if (!query_hit) {
+			caffe_test_net_query.reset(new Net<float>(test_net_param_query));
+			caffe_test_net_query->CopyTrainedLayersFrom(trained_net_param);
+		}
+		if (!database_hit) {
+			caffe_test_net_database.reset(
+					new Net<float>(test_net_param_database));
+			caffe_test_net_database->CopyTrainedLayersFrom(trained_net_param);
+		}
+	}
 
-	vector < shared_ptr<Blob<float> > > &myblobs = elewiselayer->blobs();
-	Blob<float> ori_weight(1, myblobs[0]->count(), 1, 1);
-	memset(ori_weight.mutable_cpu_data(), 0,
-			sizeof(float) * myblobs[0]->count());
-	caffe_copy(myblobs[0]->count(), myblobs[0]->cpu_data(),
-			ori_weight.mutable_cpu_data());
-	float* weight = myblobs[0]->mutable_cpu_data();
-
-	int nbits = atoi(argv[6]);
-	if (myblobs[0]->count() < nbits) {
-		LOG(ERROR) << "The number of bits set in test phrase (" << nbits
-				<< ") is larger than in training phrase ("
-				<< myblobs[0]->count() << ").";
+	//*********************** achieve weight ****************************
+	vector<float> bit_weights;
+	if (caffe_test_net_query || caffe_test_net_database) {
+		const Blob<float>* weight_blob = BitWeights(
+				caffe_test_net_query ?
+						caffe_test_net_query.get() :
+						caffe_test_net_database.get());
+		bit_weights.assign(weight_blob->cpu_data(),
+				weight_blob->cpu_data() + weight_blob->count());
+	} else {
+		CHECK(query_cached.weights()) << "Cached features lack bit weights.";
+		bit_weights.assign(query_cached.weights(),
+				query_cached.weights() + query_cached.dim());
+	}
+	const int code_bits = bit_weights.size();
+
+	// Code lengths to evaluate: --lengths=8,16,24 or the single nbits.
+	vector<int> lengths;
+	const char* lengths_flag = FindFlag(argc, argv, "lengths");
+	ParseIntList(lengths_flag ? lengths_flag : argv[6], &lengths);
+	std::sort(lengths.begin(), lengths.end());
+	lengths.erase(std::unique(lengths.begin(), lengths.end()), lengths.end());
+	if (lengths.empty() || lengths[0] <= 0 || code_bits < lengths.back()) {
+		LOG(ERROR) << "The number of bits set in test phrase ("
+				<< (lengths.empty() ? 0 : lengths.back())
+				<< ") must be in [1, " << code_bits
+				<< "], the number of bits in training phrase.";
 		return 0;
 	}
 
-	int* index = new int[myblobs[0]->count()];
-	for (int i = 0; i < myblobs[0]->count(); i++) {
-		weight[i] = abs(weight[i]);
-		index[i] = i;
+	// Bits are stored in decreasing |weight| order, so the first L bits of
+	// every code are the L-bit code and all lengths share one store.
+	vector<int> bit_order;
+	RankBitsByWeight(&bit_weights[0], code_bits, &bit_order);
+	for (int i = 0; i < code_bits; i++)
+		LOG(INFO) << "bit " << i << ": dim " << bit_order[i] << ", weight "
+				<< bit_weights[bit_order[i]];
+	HashCodeStore query_codes(code_bits);
+	HashCodeStore database_codes(code_bits);
+
+	//*************************** extraction ***************************
+	// The query and database nets run concurrently, each on its own thread
+	// with its own BLAS thread budget (--blas_threads=query,database, half
+	// the cores each by default). RunExtractions() joins both, so ranking
+	// starts once the slower of the two nets is done; it does not overlap
+	// extraction.
+	vector<string> filenames, filenames_database;
+	// The real-valued query features, for asymmetric scoring.
+	vector<float> query_features;
+	ExtractionJob query_job, database_job;
+	// Each extraction writes its own pending cache file, even when the query
+	// and database keys are equal.
+	string query_pending, database_pending;
+	vector<ExtractionJob*> jobs;
+	if (query_hit) {
+		CHECK_EQ(query_cached.dim(), code_bits);
+		query_cached.names(&filenames);
+		query_features.assign(query_cached.features(),
+				query_cached.features() + query_cached.count() * code_bits);
+		query_codes.AppendBatch(query_cached.features(), query_cached.count(),
+				code_bits, &bit_order[0]);
+	} else {
+		// Features and packed codes are written as mmap-able code files, with
+		// the learned weights and the bit order needed to rebuild the codes.
+		query_job.net = caffe_test_net_query.get();
+		query_job.tag = "query";
+		query_job.codes = &query_codes;
+		query_job.filenames = &filenames;
+		query_job.all_features = &query_features;
+		if (cache_flag) {
+			query_pending = cache.PendingPath(query_key);
+		}
+		OpenOutputs(argc > 4 ? string(argv[4]) + "/query_" : "", query_pending,
+				bit_order, bit_weights, &query_job);
+		jobs.push_back(&query_job);
 	}
-
-	for (int i = 0; i < myblobs[0]->count(); i++)
-		LOG(INFO) << ori_weight.mutable_cpu_data()[i] << " " << weight[i]
-				<< "  " << index[i];
-	InsertSort(weight, index, myblobs[0]->count());
-
-	const DataLayer<float> *datalayer =
-			dynamic_cast<const DataLayer<float>*>(layers[0].get());
-	const vector<string>& filenames = datalayer->getFilenames();
-	{
-		CHECK(datalayer);
-
-		FEA_SIZE =
-				(*(caffe_test_net_query.bottom_vecs().rbegin()))[0]->channels()
-						* (*(caffe_test_net_query.bottom_vecs().rbegin()))[0]->width()
-						* (*(caffe_test_net_query.bottom_vecs().rbegin()))[0]->height();
-		LOG(INFO) << "FEA_SIZE: " << FEA_SIZE;
-
-		query_data_counts = datalayer->getDataCount();
-
-		vector<Blob<float>*> dummy_blob_input_vec;
-
-		query_class_ids.resize(query_data_counts, 0);
-		for (int i = 0; i < query_data_counts; i++) {
-			string prefix = filenames[i].substr(0,
-					filenames[i].find_last_of('_'));
-			map<string, int>::iterator iter = query_class2id.find(prefix);
-			if (iter != query_class2id.end()) {
-				query_class_ids[i] = iter->second;
-				query_img_count_per_class[iter->second]++;
-			} else {
-				query_class_ids[i] = query_class2id.size();
-				query_class2id.insert(iter,
-						make_pair(prefix, query_class2id.size()));
-				query_img_count_per_class.push_back(1);
-			}
+	if (database_hit) {
+		CHECK_EQ(database_cached.dim(), code_bits);
+		database_cached.names(&filenames_database);
+		database_codes.AppendBatch(database_cached.features(),
+				database_cached.count(), code_bits, &bit_order[0]);
+	} else {
+		database_job.net = caffe_test_net_database.get();
+		database_job.tag = "database";
+		database_job.codes = &database_codes;
+		database_job.filenames = &filenames_database;
+		if (cache_flag) {
+			database_pending = cache.PendingPath(database_key);
 		}
-
-		for (int i = 0; i < query_data_counts; i++) {
-			query_feature_map.push_back(
-					shared_ptr < Blob<float>
-							> (new Blob<float>(1, FEA_SIZE, 1, 1)));
+		OpenOutputs(argc > 5 ? string(argv[4]) + "/database_" : "",
+				database_pending, bit_order, bit_weights, &database_job);
+		jobs.push_back(&database_job);
+	}
+	if (jobs.size() == 2) {
+		vector<int> blas_threads;
+		const char* blas_flag = FindFlag(argc, argv, "blas_threads");
+		if (blas_flag) {
+			ParseIntList(blas_flag, &blas_threads);
+			CHECK_EQ(blas_threads.size(), 2)
+					<< "--blas_threads takes the query and database budgets.";
+		} else {
+			blas_threads.resize(2, std::max(DefaultEvalThreads() / 2, 1));
 		}
-
-		int batchCount =
-				std::ceil(
-						query_data_counts
-								/ (floor)(
-										test_net_param_query.layers(0).layer().batchsize()));
-		int batchsize = test_net_param_query.layers(0).layer().batchsize();
-		for (int batch_id = 0, file_id = 0;
-				batch_id < batchCount && file_id < query_data_counts;
-				++batch_id) {
-			LOG(INFO) << "Total batchs (query): " << batchCount
-					<< ", Processing batch (query): " << (batch_id + 1);
-			const vector<Blob<float>*>& result = caffe_test_net_query.Forward(
-					dummy_blob_input_vec);
-
-			Blob<float>* features;
-			features = (*(caffe_test_net_query.bottom_vecs().begin() + 13))[0];
-
-			for (int k = 0; file_id < query_data_counts && k < batchsize;
-					file_id++, k++) {
-				memcpy(query_feature_map[file_id]->mutable_cpu_data(),
-						features->cpu_data() + k * FEA_SIZE,
-						sizeof(float) * FEA_SIZE);
-			}
+		query_job.blas_threads = blas_threads[0];
+		database_job.blas_threads = blas_threads[1];
+	}
+	RunExtractions(jobs);
+	if (!query_hit) {
+		CloseOutputs(&query_job);
+		if (cache_flag) {
+			cache.Commit(query_pending, query_key);
 		}
-		if (argc > 4) {
-			printf("\nbegin to write feature:%s,%s",
-					(string(argv[4]) + "/query_filenames.txt").c_str(),
-					(string(argv[4]) + "/query_features.txt").c_str());
-			LOG(INFO) << "feature file:"
-					<< (string(argv[4]) + "/query_filenames.txt").c_str();
-			ofstream fNameFile(
-					(string(argv[4]) + "/query_filenames.txt").c_str());
-			ofstream feaFile((string(argv[4]) + "/query_features.txt").c_str());
-			for (int file_id = 0; file_id < filenames.size(); file_id++) {
-				fNameFile << filenames[file_id] << "\n";
-				const float* feas = query_feature_map[file_id]->cpu_data();
-				for (int fea_i = 0; fea_i < FEA_SIZE; fea_i++) {
-					feaFile << feas[fea_i] << " ";
-				}
-				feaFile << "\n";
-			}
-			fNameFile.close();
-			feaFile.close();
+	}
+	if (!database_hit) {
+		CloseOutputs(&database_job);
+		if (cache_flag) {
+			cache.Commit(database_pending, database_key);
 		}
 	}
-
-	//***************************** database ****************************
-	vector < shared_ptr<Layer<float> > > layers_database =
-			caffe_test_net_database.layers();
-	const DataLayer<float> *datalayer_database = dynamic_cast<const DataLayer<
-			float>*>(layers_database[0].get());
-	const vector<string>& filenames_database =
-			datalayer_database->getFilenames();
-	{
-		CHECK(datalayer_database);
-
-		FEA_SIZE =
-				(*(caffe_test_net_database.bottom_vecs().rbegin()))[0]->channels()
-						* (*(caffe_test_net_database.bottom_vecs().rbegin()))[0]->width()
-						* (*(caffe_test_net_database.bottom_vecs().rbegin()))[0]->height();
-		LOG(INFO) << "FEA_SIZE: " << FEA_SIZE;
-
-		database_data_counts = datalayer_database->getDataCount();
-
-		vector<Blob<float>*> dummy_blob_input_vec;
-
-		database_class_ids.resize(database_data_counts, 0);
-		database_img_count_per_class.clear();
-		database_class2id.clear();
-		for (int i = 0; i < database_data_counts; i++) {
-			string prefix = filenames_database[i].substr(0,
-					filenames_database[i].find_last_of('_'));
-			map<string, int>::iterator iter = database_class2id.find(prefix);
-			if (iter != database_class2id.end()) {
-				database_class_ids[i] = iter->second;
-				database_img_count_per_class[iter->second]++;
-			} else {
-				database_class_ids[i] = database_class2id.size();
-				database_class2id.insert(iter,
-						make_pair(prefix, database_class2id.size()));
-				database_img_count_per_class.push_back(1);
-			}
+	const LayerParameter& query_layer = test_net_param_query.layers(0).layer();
+	if (query_layer.has_manifest()) {
+		AssignManifestClasses(query_layer, filenames, &query_class_ids,
+				&query_img_count_per_class);
+	} else {
+		map<string, int> query_class2id;
+		AssignClasses(filenames, &query_class_ids, &query_class2id,
+				&query_img_count_per_class);
+	}
+	const int query_data_counts = query_codes.num();
+	const LayerParameter& database_layer =
+			test_net_param_database.layers(0).layer();
+	if (database_layer.has_manifest()) {
+		AssignManifestClasses(database_layer, filenames_database,
+				&database_class_ids, &database_img_count_per_class);
+	} else {
+		map<string, int> database_class2id;
+		AssignClasses(filenames_database, &database_class_ids,
+				&database_class2id, &database_img_count_per_class);
+	}
+	LOG(INFO) << "Hash codes: " << database_codes.num() << " x " << code_bits
+			<< " bits, " << database_codes.memory_size() << " bytes";
+	// The float database features stay on disk; re-ranking only pages in the
+	// rows of shortlisted items.
+	const char* rerank_flag = FindFlag(argc, argv, "rerank");
+	const bool float_distance = FindFlag(argc, argv, "float") != NULL;
+	CodeFile database_features;
+	if (rerank_flag || float_distance) {
+		if (cache_flag) {
+			database_features.Open(cache.EntryPath(database_key));
+		} else {
+			CHECK_GT(argc, 5) << "--rerank and --float need the database "
+					"features, written with nbits given or kept with --cache.";
+			database_features.Open(string(argv[4]) + "/database_features.bin");
 		}
-
-		for (int i = 0; i < database_data_counts; i++) {
-			database_feature_map.push_back(
-					shared_ptr < Blob<float>
-							> (new Blob<float>(1, FEA_SIZE, 1, 1)));
+		if (rerank_flag) {
+			database_features.AdviseRandomAccess();
 		}
+	}
 
-		int batchCount =
-				std::ceil(
-						database_data_counts
-								/ (floor)(
-										test_net_param_database.layers(0).layer().batchsize()));
-		int batchsize = test_net_param_database.layers(0).layer().batchsize();
-		for (int batch_id = 0, file_id = 0;
-				batch_id < batchCount && file_id < database_data_counts;
-				++batch_id) {
-			LOG(INFO) << "Total batchs (database): " << batchCount
-					<< ", Processing batch (database): " << (batch_id + 1);
-			const vector<Blob<float>*>& result =
-					caffe_test_net_database.Forward(dummy_blob_input_vec);
-
-			Blob<float>* features;
-			features =
-					(*(caffe_test_net_database.bottom_vecs().begin() + 13))[0];
-
-			for (int k = 0; file_id < database_data_counts && k < batchsize;
-					file_id++, k++) {
-				memcpy(database_feature_map[file_id]->mutable_cpu_data(),
-						features->cpu_data() + k * FEA_SIZE,
-						sizeof(float) * FEA_SIZE);
-			}
+	// Every query is ranked independently; the per-class reduction is done
+	// in query order afterwards so the result is the same for any number of
+	// threads. All code lengths are evaluated in the same sweep.
+	const char* threads_flag = FindFlag(argc, argv, "threads");
+	const int num_threads = threads_flag ? atoi(threads_flag) : 0;
+	LOG(INFO) << "Evaluating " << query_data_counts << " queries at "
+			<< lengths.size() << " code lengths on "
+			<< (num_threads > 0 ? num_threads : DefaultEvalThreads())
+			<< " threads";
+	// All metrics come from the same ranking of each query.
+	vector<int> precision_ks, cmc_ranks;
+	const char* precision_flag = FindFlag(argc, argv, "precision_at");
+	ParseIntList(precision_flag ? precision_flag : "10,50,100", &precision_ks);
+	const char* radius_flag = FindFlag(argc, argv, "radius");
+	const char* cmc_flag = FindFlag(argc, argv, "cmc");
+	ParseIntList(cmc_flag ? cmc_flag : "1,5,10", &cmc_ranks);
+	const bool asymmetric = FindFlag(argc, argv, "asymmetric") != NULL;
+	// Asymmetric, re-ranked and float distances are not integers, so there
+	// is no radius there.
+	RetrievalMetrics metrics(precision_ks,
+			(asymmetric || rerank_flag || float_distance) ?
+					-1 : (radius_flag ? atoi(radius_flag) : 2), cmc_ranks);
+	vector<vector<double> > values;
+	// Mean and p99 latency of the shortlist and re-rank stages per length.
+	vector<vector<double> > latencies;
+	const char* weighted_flag = FindFlag(argc, argv, "weighted");
+	vector<float> code_weights(code_bits);
+	for (int b = 0; b < code_bits; b++) {
+		code_weights[b] = bit_weights[bit_order[b]];
+	}
+	if (asymmetric) {
+		// Real-valued queries against the binary database, weighted by the
+		// learned bit weights.
+		values.resize(lengths.size());
+		for (int l = 0; l < lengths.size(); l++) {
+			AsymmetricDistance distance(&code_weights[0], lengths[l]);
+			EvaluateAsymmetric(distance, &query_features[0], query_data_counts,
+					code_bits, &bit_order[0], &query_class_ids[0], database_codes,
+					&database_class_ids[0], &database_img_count_per_class[0],
+					metrics, num_threads, &values[l]);
 		}
-		if (argc > 5) {
-			printf("\nbegin to write feature:%s,%s",
-					(string(argv[4]) + "/database_filenames.txt").c_str(),
-					(string(argv[4]) + "/database_features.txt").c_str());
-			LOG(INFO) << "feature file:"
-					<< (string(argv[4]) + "/database_filenames.txt").c_str();
-			ofstream fNameFile(
-					(string(argv[4]) + "/database_filenames.txt").c_str());
-			ofstream feaFile(
-					(string(argv[4]) + "/database_features.txt").c_str());
-			for (int file_id = 0; file_id < filenames_database.size();
-					file_id++) {
-				fNameFile << filenames_database[file_id] << "\n";
-				const float* feas = database_feature_map[file_id]->cpu_data();
-				for (int fea_i = 0; fea_i < FEA_SIZE; fea_i++) {
-					feaFile << feas[fea_i] << " ";
-				}
-				feaFile << "\n";
-			}
-			fNameFile.close();
-			feaFile.close();
+	} else if (float_distance) {
+		// The selected dimensions are gathered into contiguous matrices once
+		// per length, then every tile of queries is scored against the whole
+		// database with a single GEMM.
+		values.resize(lengths.size());
+		const int database_num = database_features.count();
+		for (int l = 0; l < lengths.size(); l++) {
+			vector<float> gathered_queries(query_data_counts * lengths[l]);
+			vector<float> gathered_database(
+					static_cast<size_t>(database_num) * lengths[l]);
+			GatherDimensions(&query_features[0], query_data_counts, code_bits,
+					&bit_order[0], lengths[l], &gathered_queries[0]);
+			GatherDimensions(database_features.features(), database_num,
+					code_bits, &bit_order[0], lengths[l], &gathered_database[0]);
+			EvaluateFloat(&gathered_queries[0], query_data_counts,
+					&gathered_database[0], database_num, lengths[l],
+					&query_class_ids[0], &database_class_ids[0],
+					&database_img_count_per_class[0], metrics, num_threads,
+					&values[l]);
 		}
-	}
-
-	streambuf* buf = cout.rdbuf();
-	ostream out(buf);
-
-	float accs[query_data_counts][30];
-	float acc_per_class[query_class2id.size()][30];
-
-	float ap[query_data_counts];
-	float ave_pre[query_class2id.size()];
-	float mean_ave_pre = 0;
-
-	memset(ap, 0, sizeof(ap));
-	memset(ave_pre, 0, sizeof(ave_pre));
-
-	{
-		Blob<float> intermediate_result(1, FEA_SIZE, 1, 1);
-
-		for (int i = 0; i < query_data_counts; i++) {
-			int i_class = query_class_ids[i];
-			multimap<float, int> loss2id;
-			float loss;
-			for (int j = 0; j < database_data_counts; j++) {
-				caffe_sub(FEA_SIZE, query_feature_map[i]->cpu_data(),
-						database_feature_map[j]->cpu_data(),
-						intermediate_result.mutable_cpu_data());
-				/*loss = caffe_cpu_dot(FEA_SIZE, intermediate_result.cpu_data(),
-				 intermediate_result.cpu_data());*/
-
-				//******* ranking loss: -z_i*z_j
-				/*caffe_mul(FEA_SIZE, query_feature_map[i]->cpu_data(),
-				 database_feature_map[j]->cpu_data(),
-				 intermediate_result.mutable_cpu_data());*/
-
-				loss = 0;
-				for (int w = 1; w <= nbits; w++) {
-					int imp_w = FEA_SIZE - w;
-					loss +=
-							intermediate_result.mutable_cpu_data()[index[imp_w]]
-									* intermediate_result.mutable_cpu_data()[index[imp_w]];
-
-				}
-				loss2id.insert(make_pair(loss, j));
-			}
-			multimap<float, int>::iterator iter = loss2id.begin();
-
-			LOG(INFO) << "query: " << filenames[i];
-			int right = 0;
-			float ap_temp = 0;
-			for (int k = 1; iter != loss2id.end(); k++, iter++) {
-				if (i_class == database_class_ids[iter->second]) {
-					right++;
-					ap_temp = right * 1.0 / k;
-					ap[i] = ap[i] + ap_temp;
-				}
-			}
-			ave_pre[i_class] = ave_pre[i_class]
-					+ ap[i] / database_img_count_per_class[i_class];
+	} else if (rerank_flag) {
+		// Hamming shortlist of R items, re-ranked with the float features.
+		values.resize(lengths.size());
+		latencies.resize(lengths.size(), vector<double>(4));
+		for (int l = 0; l < lengths.size(); l++) {
+			HashCodeStore query_prefix, database_prefix;
+			PrefixCodes(query_codes, lengths[l], &query_prefix);
+			PrefixCodes(database_codes, lengths[l], &database_prefix);
+			// The tables are sized from the final database, so the index is
+			// built here, after extraction, rather than batch by batch.
+			MultiIndexHash index;
+			index.Build(database_prefix);
+			TwoStageSearcher searcher(index, database_features,
+					atoi(rerank_flag));
+			vector<TwoStageTiming> timings;
+			EvaluateTwoStage(searcher, query_prefix, &query_features[0],
+					&query_class_ids[0], &database_class_ids[0],
+					&database_img_count_per_class[0], metrics, num_threads,
+					&values[l], &timings);
+			SummarizeTimings(timings, &latencies[l][0]);
 		}
+	} else if (weighted_flag) {
+		// Weighted Hamming with the learned bit weights, quantized to the
+		// given number of levels. The radius is in weighted distance too.
+		values.resize(lengths.size());
+		for (int l = 0; l < lengths.size(); l++) {
+			WeightedHammingMetric metric(&code_weights[0], lengths[l],
+					atoi(weighted_flag));
+			EvaluateQueries(metric, query_codes, &query_class_ids[0],
+					database_codes, &database_class_ids[0],
+					&database_img_count_per_class[0], metrics, num_threads,
+					&values[l]);
+		}
+	} else {
+		EvaluatePrefixLengths(query_codes, &query_class_ids[0],
+				database_codes, &database_class_ids[0],
+				&database_img_count_per_class[0], lengths, metrics, num_threads,
+				&values);
 	}
 
-	cout << endl << query_class2id.size() << endl;
-	for (int i = 0; i < query_class2id.size(); i++) {
-		cout << i << "\t" << ave_pre[i] / query_img_count_per_class[i] << endl;
-		mean_ave_pre = mean_ave_pre + ave_pre[i];
+	// Machine-readable report of every metric at every code length.
+	const char* report_flag = FindFlag(argc, argv, "report");
+	const string report_file =
+			report_flag ? report_flag : string(argv[4]) + "/metrics.json";
+	ofstream report(report_file.c_str());
+	report << "{\n  \"queries\": " << query_data_counts
+			<< ",\n  \"database\": " << database_codes.num()
+			<< ",\n  \"distance\": \""
+			<< (asymmetric ? "asymmetric" : float_distance ? "float" :
+					rerank_flag ? "rerank" :
+					weighted_flag ? "weighted" : "hamming") << "\",";
+	if (rerank_flag) {
+		report << "\n  \"shortlist\": " << atoi(rerank_flag) << ",";
 	}
+	report << "\n  \"lengths\": [";
+	for (int l = 0; l < lengths.size(); l++) {
+		vector<double> ap(query_data_counts);
+		for (int i = 0; i < query_data_counts; i++) {
+			ap[i] = values[l][i * metrics.size()];
+		}
+		vector<double> ave_pre;
+		ReduceByClass(ap, &query_class_ids[0], query_img_count_per_class.size(),
+				&ave_pre);
+		double mean_ave_pre = 0;
+
+		cout << endl << "bits: " << lengths[l] << endl;
+		cout << query_img_count_per_class.size() << endl;
+		for (int i = 0; i < query_img_count_per_class.size(); i++) {
+			cout << i << "\t" << ave_pre[i] / query_img_count_per_class[i]
+					<< endl;
+			mean_ave_pre = mean_ave_pre + ave_pre[i];
+		}
 
-	cout << "mean_ave_pre : " << (mean_ave_pre / query_data_counts) << " "
-			<< mean_ave_pre << endl;
-	return 0;
-}
+		cout << "mean_ave_pre : " << (mean_ave_pre / query_data_counts) << " "
+				<< mean_ave_pre << endl;
 
-void InsertSort(float *arr, int *ind, int n) {
-	for (int i = 1; i < n; i++) {
-		if (arr[i] < arr[i - 1]) {
-			int j = i - 1;
-			float x = arr[i];
-			int y = ind[i];
-			arr[i] = arr[i - 1];
-			ind[i] = ind[i - 1];
-			while (x < arr[j]) {
-				arr[j + 1] = arr[j];
-				ind[j + 1] = ind[j];
-				j--;
-			}
-			arr[j + 1] = x;
-			ind[j + 1] = y;
+		vector<double> mean;
+		metrics.Mean(values[l], &mean);
+		report << (l ? "," : "") << "\n    {\"bits\": " << lengths[l];
+		for (int m = 0; m < metrics.size(); m++) {
+			cout << metrics.name(m) << " : " << mean[m] << endl;
+			report << ", \"" << metrics.name(m) << "\": " << mean[m];
+		}
+		if (rerank_flag) {
+			const vector<double>& t = latencies[l];
+			cout << "shortlist latency (us) : mean " << t[0] << " p99 " << t[1]
+					<< endl << "rerank latency (us) : mean " << t[2] << " p99 "
+					<< t[3] << endl;
+			report << ",\n     \"shortlist_us\": " << t[0]
+					<< ", \"shortlist_p99_us\": " << t[1]
+					<< ", \"rerank_us\": " << t[2] << ", \"rerank_p99_us\": "
+					<< t[3];
 		}
+		report << ",\n     \"class_mAP\": [";
+		for (int i = 0; i < query_img_count_per_class.size(); i++) {
+			report << (i ? ", " : "")
+					<< ave_pre[i] / query_img_count_per_class[i];
+		}
+		report << "]}";
 	}
-
+	report << "\n  ]\n}\n";
+	report.close();
+	LOG(INFO) << "Metrics written to " << report_file;
+	return 0;
 }
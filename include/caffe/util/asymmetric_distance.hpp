@@ -0,0 +1,81 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_ASYMMETRIC_DISTANCE_HPP_
+#define CAFFE_UTIL_ASYMMETRIC_DISTANCE_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/retrieval_metrics.hpp"
+
+namespace caffe {
+
+// Asymmetric distance between a real-valued query (the sigmoid output in
+// [-1, 1] before binarization) and packed binary database codes:
+//   sum_b w_b (q_b - s_b)^2,  s_b = +1 if bit b is set, -1 otherwise,
+// where w_b is the |weight| of code bit b in the ElementWiseProductLayer.
+// The query keeps its magnitude information while the database stays
+// binary. SetQuery() folds the query into one table of 256 partial sums per
+// code byte, so scoring a code costs a table lookup per byte, like
+// WeightedHammingMetric.
+class AsymmetricDistance {
+public:
+	// weights[b] is the weight of code bit b, or NULL for all ones; only the
+	// first nbits bits of the codes are scored.
+	template<typename Dtype>
+	AsymmetricDistance(const Dtype* weights, const int nbits);
+
+	// Prepares the tables for a query; code bit b is scored against
+	// feature[bit_order[b]] (feature[b] if bit_order is NULL).
+	template<typename Dtype>
+	void SetQuery(const Dtype* feature, const int* bit_order);
+
+	inline float operator()(const uint64_t* code) const {
+		float dist = 0;
+		const float* table = &table_[0];
+		for (int w = 0; w < words_; ++w) {
+			const uint64_t x = code[w];
+			for (int k = 0; k < 8; ++k, table += 256) {
+				dist += table[(x >> (8 * k)) & 0xff];
+			}
+		}
+		return dist;
+	}
+
+	// Reorders candidate ids of database by ascending asymmetric distance to
+	// the current query, ties by ascending id, and keeps the first k (all
+	// if k < 0). distances gets the scores of the kept ids.
+	void Rerank(const HashCodeStore& database, const int k,
+			std::vector<int>* ids, std::vector<float>* distances) const;
+
+	inline int nbits() const {
+		return nbits_;
+	}
+
+protected:
+	int nbits_;
+	int words_;
+	std::vector<float> weights_;
+	// words_ * 8 tables of 256 entries.
+	std::vector<float> table_;
+};
+
+// Per-query metrics of a query set scored asymmetrically: queries are
+// num_queries real-valued features of dim floats, database holds the packed
+// codes. The whole database is sorted per query and items with equal
+// distance form a tie group, so metrics (which must not ask for radius
+// metrics, the distances are not integers) are tie-aware as in
+// EvaluateQueries. Threading and the values layout are the same as there.
+void EvaluateAsymmetric(const AsymmetricDistance& distance,
+		const float* queries, const int num_queries, const int dim,
+		const int* bit_order, const int* query_classes,
+		const HashCodeStore& database, const int* database_classes,
+		const int* relevant_per_class, const RetrievalMetrics& metrics,
+		const int num_threads, std::vector<double>* values);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_ASYMMETRIC_DISTANCE_HPP_
@@ -0,0 +1,81 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_BIT_PLANE_HPP_
+#define CAFFE_UTIL_BIT_PLANE_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/hash_code.hpp"
+
+namespace caffe {
+
+// Columnar (bit-plane) layout of a set of codes: plane b holds bit b of every
+// item, 64 items per word. Codes binarized with RankBitsByWeight store their
+// bits in decreasing importance, so the planes are in importance order too.
+//
+// KnnSearch scores the planes most important first. Partial distances are
+// kept as bit-sliced counters, one uint64_t per counter bit for every 64
+// items, so adding a plane costs a few word operations per 64 items. Every
+// kCheckInterval planes the k-th smallest upper bound (partial distance plus
+// the weight of the planes left) is taken as a threshold. Items whose partial
+// distance already exceeds it are dropped, and 64-item blocks with no item
+// left skip the remaining planes. When the survivors get sparse, their
+// remaining bits are read one item at a time instead.
+class BitPlaneStore {
+public:
+	BitPlaneStore() :
+			nbits_(0), num_(0), blocks_(0), slices_(0) {
+	}
+	// Transposes codes into planes. weights[b] >= 0 is the integer weight
+	// of bit b (e.g. WeightedHammingMetric::bit_weight), NULL for plain
+	// Hamming distance.
+	void Build(const HashCodeStore& codes, const int* weights = NULL);
+
+	// Exact k nearest items in (weighted) Hamming distance, sorted by
+	// distance with ties broken by ascending id, like
+	// MultiIndexHash::KnnSearch. If scanned is not NULL it gets the fraction
+	// of (plane, block) pairs that were read.
+	void KnnSearch(const uint64_t* query, const int k, std::vector<int>* ids,
+			std::vector<int>* distances, float* scanned = NULL) const;
+
+	inline int num() const {
+		return num_;
+	}
+	inline int nbits() const {
+		return nbits_;
+	}
+	// Words per plane.
+	inline int blocks() const {
+		return blocks_;
+	}
+	inline const uint64_t* plane(const int b) const {
+		return &planes_[static_cast<size_t>(b) * blocks_];
+	}
+	inline size_t memory_size() const {
+		return planes_.size() * sizeof(uint64_t);
+	}
+
+	// Planes scored between two pruning passes.
+	static const int kCheckInterval = 8;
+	// The search turns to reading single bits of the survivors once fewer
+	// than one item in kSparseRatio of the live blocks is left.
+	static const int kSparseRatio = 8;
+
+protected:
+	int nbits_;
+	int num_;
+	int blocks_;
+	// Bits of the counters, enough for the largest distance.
+	int slices_;
+	std::vector<int> weights_;
+	// remaining_[b]: total weight of planes b .. nbits_ - 1.
+	std::vector<int> remaining_;
+	std::vector<uint64_t> planes_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BIT_PLANE_HPP_
@@ -0,0 +1,152 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_CODE_FILE_HPP_
+#define CAFFE_UTIL_CODE_FILE_HPP_
+
+#include <stdint.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Binary container for extracted features or hash codes, replacing the text
+// dumps of the MAP tool. Layout (all sections 8-byte aligned):
+//   CodeFileHeader
+//   int32  bit_order[dim]    code bit b is feature dimension bit_order[b]
+//   float  weights[dim]      optional per-dimension bit weights
+//   rows   count * row_bytes packed uint64_t codes or float features
+//   uint64 name_offsets[count + 1] into the name table
+//   char   names[]           concatenated filenames, not terminated
+// Readers mmap the file and use the sections in place, nothing is parsed.
+enum CodeFileType {
+	CODE_FILE_PACKED_BITS = 0, CODE_FILE_FLOAT = 1
+};
+
+struct CodeFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t type;
+	uint64_t count;
+	// Floats per row, or bits per code for packed files.
+	uint32_t dim;
+	// Bits a packed code holds; for float files the code length the
+	// features are meant to be binarized to.
+	uint32_t code_bits;
+	uint64_t row_bytes;
+	uint64_t bit_order_offset;
+	uint64_t weights_offset;  // 0 if the file has no weights
+	uint64_t data_offset;
+	uint64_t names_offset;
+	uint64_t file_size;
+	uint64_t reserved[4];
+};
+
+// Writes a code file row by row, so extraction never has to keep all the
+// features in memory. The header is completed by Close().
+class CodeFileWriter {
+public:
+	CodeFileWriter() :
+			row_bytes_(0), count_(0) {
+	}
+	~CodeFileWriter();
+	// bit_order has dim entries (NULL for the identity); weights may be NULL.
+	void Open(const std::string& filename, const CodeFileType type,
+			const int dim, const int code_bits, const int* bit_order,
+			const float* weights);
+	// row is dim floats or code_bits packed bits depending on the type.
+	void Append(const void* row, const std::string& name);
+	void Close();
+	inline uint64_t count() const {
+		return count_;
+	}
+
+protected:
+	std::string filename_;
+	std::ofstream file_;
+	CodeFileHeader header_;
+	uint64_t row_bytes_;
+	uint64_t count_;
+	std::vector<uint64_t> name_offsets_;
+	std::string names_;
+
+DISABLE_COPY_AND_ASSIGN(CodeFileWriter);
+};
+
+// Read-only memory-mapped view of a code file.
+class CodeFile {
+public:
+	CodeFile() :
+			data_(NULL), size_(0), header_(NULL) {
+	}
+	explicit CodeFile(const std::string& filename) :
+			data_(NULL), size_(0), header_(NULL) {
+		Open(filename);
+	}
+	~CodeFile() {
+		Close();
+	}
+	void Open(const std::string& filename);
+	void Close();
+
+	inline bool is_open() const {
+		return header_ != NULL;
+	}
+	inline int count() const {
+		return header_->count;
+	}
+	inline int dim() const {
+		return header_->dim;
+	}
+	inline int code_bits() const {
+		return header_->code_bits;
+	}
+	inline CodeFileType type() const {
+		return static_cast<CodeFileType>(header_->type);
+	}
+	inline const int* bit_order() const {
+		return reinterpret_cast<const int*>(data_ + header_->bit_order_offset);
+	}
+	inline const float* weights() const {
+		return header_->weights_offset ?
+				reinterpret_cast<const float*>(data_ + header_->weights_offset) :
+				NULL;
+	}
+	inline const void* row(const int i) const {
+		return data_ + header_->data_offset + i * header_->row_bytes;
+	}
+	// The packed codes of a CODE_FILE_PACKED_BITS file.
+	inline const uint64_t* codes() const {
+		return reinterpret_cast<const uint64_t*>(data_ + header_->data_offset);
+	}
+	// The features of a CODE_FILE_FLOAT file, dim floats per row.
+	inline const float* features() const {
+		return reinterpret_cast<const float*>(data_ + header_->data_offset);
+	}
+	inline std::string name(const int i) const {
+		const uint64_t* offsets = reinterpret_cast<const uint64_t*>(data_
+				+ header_->names_offset);
+		const char* names = reinterpret_cast<const char*>(offsets
+				+ header_->count + 1);
+		return std::string(names + offsets[i], offsets[i + 1] - offsets[i]);
+	}
+	// Copies all names, e.g. to replace a list read from text.
+	void names(std::vector<std::string>* names) const;
+	// Tells the kernel the rows will be read in random order (e.g. only the
+	// rows of a shortlist), so a row read does not page in its neighbours.
+	void AdviseRandomAccess() const;
+
+protected:
+	const char* data_;
+	size_t size_;
+	const CodeFileHeader* header_;
+
+DISABLE_COPY_AND_ASSIGN(CodeFile);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_CODE_FILE_HPP_
@@ -0,0 +1,118 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_DATASET_MANIFEST_HPP_
+#define CAFFE_UTIL_DATASET_MANIFEST_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Compiled form of an image list ("<class>_<id>.<ext>" per line), so the data
+// layer and the evaluator do not split every filename and look its class up
+// in a map on every start. Layout (all sections 8-byte aligned):
+//   DatasetManifestHeader
+//   int32  class_ids[count]        dense, in order of first appearance
+//   int32  image_ids[count]        the <id> of every filename
+//   int32  class_counts[num_classes]
+//   uint64 name_offsets[count + 1], then the concatenated filenames
+//   uint64 class_name_offsets[num_classes + 1], then the class names
+// Readers mmap the file and read every record in O(1).
+struct DatasetManifestHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_classes;
+	uint64_t count;
+	uint64_t class_ids_offset;
+	uint64_t image_ids_offset;
+	uint64_t class_counts_offset;
+	uint64_t names_offset;
+	uint64_t class_names_offset;
+	uint64_t file_size;
+	uint64_t reserved[4];
+};
+
+// Splits "<class>_<id>.<ext>" into class name and image id the way the text
+// image lists have always been read.
+void ParseImageName(const std::string& filename, std::string* class_name,
+		int* image_id);
+
+// Reads the whitespace separated filenames of list_file and writes them as
+// a manifest. Returns the number of records.
+int CompileDatasetManifest(const std::string& list_file,
+		const std::string& manifest_file);
+
+// Read-only memory-mapped view of a manifest.
+class DatasetManifest {
+public:
+	DatasetManifest() :
+			data_(NULL), size_(0), header_(NULL) {
+	}
+	explicit DatasetManifest(const std::string& filename) :
+			data_(NULL), size_(0), header_(NULL) {
+		Open(filename);
+	}
+	~DatasetManifest() {
+		Close();
+	}
+	void Open(const std::string& filename);
+	void Close();
+
+	inline int count() const {
+		return header_->count;
+	}
+	inline int num_classes() const {
+		return header_->num_classes;
+	}
+	inline int class_id(const int i) const {
+		return Section<int32_t>(header_->class_ids_offset)[i];
+	}
+	inline int image_id(const int i) const {
+		return Section<int32_t>(header_->image_ids_offset)[i];
+	}
+	inline int class_count(const int c) const {
+		return Section<int32_t>(header_->class_counts_offset)[c];
+	}
+	inline std::string name(const int i) const {
+		return String(header_->names_offset, header_->count, i);
+	}
+	inline std::string class_name(const int c) const {
+		return String(header_->class_names_offset, header_->num_classes, c);
+	}
+
+	// The records whose image id is in [lower, upper], in file order.
+	void Select(const int lower, const int upper,
+			std::vector<int>* records) const;
+	// Class ids of records renumbered densely in order of first appearance,
+	// as when classes are assigned from the filenames, and the number of
+	// records of every class.
+	void AssignClasses(const std::vector<int>& records,
+			std::vector<int>* class_ids,
+			std::vector<int>* count_per_class) const;
+
+protected:
+	template<typename T>
+	inline const T* Section(const uint64_t offset) const {
+		return reinterpret_cast<const T*>(data_ + offset);
+	}
+	inline std::string String(const uint64_t offset, const uint64_t num,
+			const int i) const {
+		const uint64_t* offsets = Section<uint64_t>(offset);
+		const char* chars = reinterpret_cast<const char*>(offsets + num + 1);
+		return std::string(chars + offsets[i], offsets[i + 1] - offsets[i]);
+	}
+
+	const char* data_;
+	size_t size_;
+	const DatasetManifestHeader* header_;
+
+DISABLE_COPY_AND_ASSIGN(DatasetManifest);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DATASET_MANIFEST_HPP_
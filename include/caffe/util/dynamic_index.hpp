@@ -0,0 +1,117 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_DYNAMIC_INDEX_HPP_
+#define CAFFE_UTIL_DYNAMIC_INDEX_HPP_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/mih_index.hpp"
+
+namespace caffe {
+
+// A Hamming k-NN index that takes insertions and deletions while it serves.
+// Items are addressed by caller-chosen integer keys. The bulk of the items
+// lives in an immutable base segment indexed by a MultiIndexHash; new items
+// go to a small delta that is scanned linearly, and deleted base items are
+// only marked with a tombstone. Compaction folds the delta and tombstones
+// into a new base, either on demand or from a background thread.
+//
+// Every update publishes a new immutable snapshot. A search only holds a
+// lock long enough to copy the snapshot pointer, so reads never wait for
+// updates or compaction; updates wait for each other but not for a running
+// compaction, whose missed updates are replayed onto the new base.
+class DynamicHashIndex {
+public:
+	explicit DynamicHashIndex(const int nbits);
+	~DynamicHashIndex();
+
+	// Adds an item, replacing the live item with the same key if any.
+	void Insert(const int key, const uint64_t* code);
+	// Returns false if there is no live item with this key.
+	bool Remove(const int key);
+	// Exact k nearest live items, sorted by distance then key.
+	void KnnSearch(const uint64_t* query, const int k, std::vector<int>* keys,
+			std::vector<int>* distances) const;
+
+	// Number of live items.
+	int size() const;
+	inline int nbits() const {
+		return nbits_;
+	}
+	// Items in the delta plus tombstones in the base, the work that is
+	// waiting for the next compaction.
+	int pending() const;
+
+	// Rebuilds the base from all live items.
+	void Compact();
+	// Compacts in the background whenever pending() exceeds
+	// max(min_pending, base size / 8).
+	void StartCompactionThread(const int min_pending);
+	void StopCompactionThread();
+
+protected:
+	// An immutable, MIH-indexed set of items.
+	struct Segment {
+		HashCodeStore codes;
+		std::vector<int> keys;
+		MultiIndexHash index;
+	};
+	struct Snapshot {
+		shared_ptr<const Segment> base;
+		// Dead base slots.
+		shared_ptr<const std::set<int> > dead;
+		std::vector<uint64_t> delta_codes;
+		std::vector<int> delta_keys;
+		int live;
+	};
+	// An update made while a compaction was running.
+	struct Update {
+		bool insert;
+		int key;
+		std::vector<uint64_t> code;
+	};
+	// Location of a live key: its base slot, or -1 for the delta.
+	typedef std::map<int, int> LocationMap;
+
+	shared_ptr<const Snapshot> snapshot() const;
+	void Publish(const Snapshot& snapshot);
+	void ApplyInsert(const int key, const uint64_t* code, Snapshot* snapshot);
+	bool ApplyRemove(const int key, Snapshot* snapshot);
+	bool NeedsCompaction(const Snapshot& snapshot) const;
+	static void* CompactionEntry(void* arg);
+	void CompactionLoop();
+
+	int nbits_;
+	int words_;
+
+	// Guards current_ only; held just to copy or swap the pointer.
+	mutable pthread_mutex_t snapshot_mutex_;
+	shared_ptr<const Snapshot> current_;
+
+	// Serializes updates; guards everything below.
+	pthread_mutex_t update_mutex_;
+	LocationMap locations_;
+	bool compacting_;
+	std::vector<Update> missed_updates_;
+	// Background compaction.
+	pthread_cond_t compaction_cond_;
+	pthread_t compaction_thread_;
+	bool compaction_running_;
+	bool stop_compaction_;
+	int min_pending_;
+	// Only one compaction at a time.
+	pthread_mutex_t compaction_mutex_;
+
+DISABLE_COPY_AND_ASSIGN(DynamicHashIndex);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DYNAMIC_INDEX_HPP_
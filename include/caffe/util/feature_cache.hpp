@@ -0,0 +1,52 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_FEATURE_CACHE_HPP_
+#define CAFFE_UTIL_FEATURE_CACHE_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/code_file.hpp"
+
+namespace caffe {
+
+// 64-bit FNV-1a of a file's content, chained from seed so several files
+// can be folded into one fingerprint.
+const uint64_t kFingerprintSeed = 14695981039346656037ULL;
+uint64_t FingerprintFile(const std::string& filename, const uint64_t seed);
+
+// Directory of extracted feature files keyed by what produced them, e.g.
+// the snapshot, the net prototxt and the image list it reads. Evaluating
+// the same snapshot again (for another code length, say) then maps the
+// cached features instead of running the net over the whole set.
+class FeatureCache {
+public:
+	explicit FeatureCache(const std::string& directory) :
+			directory_(directory) {
+	}
+	// Hex fingerprint of the content of all the files, in order. Paths are
+	// not part of the key, so a moved snapshot still hits.
+	static std::string Key(const std::vector<std::string>& files);
+	// Opens the cached entry into file and returns true on a hit.
+	bool Lookup(const std::string& key, CodeFile* file) const;
+	// A new entry is written to a PendingPath() and published by Commit(),
+	// so a crashed or concurrent run never leaves a partial entry behind.
+	// Every call creates a distinct empty file, so two writers of the same
+	// key (query and database of an all-vs-all run, say) never share one;
+	// the later Commit() replaces the earlier entry.
+	std::string PendingPath(const std::string& key) const;
+	void Commit(const std::string& pending_path, const std::string& key) const;
+	inline std::string EntryPath(const std::string& key) const {
+		return directory_ + "/" + key + ".bin";
+	}
+
+protected:
+	std::string directory_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FEATURE_CACHE_HPP_
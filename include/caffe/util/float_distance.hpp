@@ -0,0 +1,50 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_FLOAT_DISTANCE_HPP_
+#define CAFFE_UTIL_FLOAT_DISTANCE_HPP_
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/retrieval_metrics.hpp"
+
+namespace caffe {
+
+// Copies dimensions dims[0 .. ndims) of num features with stride dim into a
+// contiguous num x ndims matrix (the first ndims dimensions if dims is NULL),
+// e.g. the L most important bits of the hashing features.
+template<typename Dtype>
+void GatherDimensions(const Dtype* features, const int num, const int dim,
+		const int* dims, const int ndims, Dtype* gathered);
+
+// The squared L2 norm of every row of a num x dim matrix.
+template<typename Dtype>
+void SquaredNorms(const Dtype* x, const int num, const int dim, Dtype* norms);
+
+// All squared L2 distances between the rows of queries (num_queries x dim)
+// and database (num_database x dim) as ||q||^2 + ||d||^2 - 2 Q D^T, with one
+// caffe_cpu_gemm. distances is num_queries x num_database; rounding can make
+// the expansion slightly negative, so it is clamped at 0.
+template<typename Dtype>
+void SquaredL2Distances(const Dtype* queries, const Dtype* query_norms,
+		const int num_queries, const Dtype* database,
+		const Dtype* database_norms, const int num_database, const int dim,
+		Dtype* distances);
+
+// Per-query metrics of float retrieval by squared L2 distance between the
+// gathered query and database features. Workers take tiles of
+// kFloatEvalTile queries and compute each tile against the whole database
+// with SquaredL2Distances; items at equal distance form a tie group. metrics
+// must not ask for radius metrics. Threading and the values layout are those
+// of EvaluateQueries.
+void EvaluateFloat(const float* queries, const int num_queries,
+		const float* database, const int num_database, const int dim,
+		const int* query_classes, const int* database_classes,
+		const int* relevant_per_class, const RetrievalMetrics& metrics,
+		const int num_threads, std::vector<double>* values);
+
+const int kFloatEvalTile = 64;
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FLOAT_DISTANCE_HPP_
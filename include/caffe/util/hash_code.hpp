@@ -0,0 +1,147 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_HASH_CODE_HPP_
+#define CAFFE_UTIL_HASH_CODE_HPP_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Number of 64-bit words needed to hold a code of nbits bits.
+inline int HashCodeWords(const int nbits) {
+	return (nbits + 63) / 64;
+}
+
+// Hamming distance between two packed codes of the given number of words.
+inline int HammingDistance(const uint64_t* a, const uint64_t* b,
+		const int words) {
+	int dist = 0;
+	for (int i = 0; i < words; ++i) {
+		dist += __builtin_popcountll(a[i] ^ b[i]);
+	}
+	return dist;
+}
+
+// Hamming distance between the first nbits bits of two packed codes.
+inline int PrefixHammingDistance(const uint64_t* a, const uint64_t* b,
+		const int nbits) {
+	const int full = nbits / 64;
+	int dist = HammingDistance(a, b, full);
+	const int rest = nbits % 64;
+	if (rest) {
+		dist += __builtin_popcountll(
+				(a[full] ^ b[full]) & ((uint64_t(1) << rest) - 1));
+	}
+	return dist;
+}
+
+// Hamming distance restricted to bits [begin, end) of two packed codes.
+inline int RangeHammingDistance(const uint64_t* a, const uint64_t* b,
+		const int begin, const int end) {
+	int dist = 0;
+	for (int bit = begin; bit < end;) {
+		const int w = bit / 64;
+		const int lo = bit % 64;
+		const int hi = std::min(end - w * 64, 64);
+		uint64_t mask = ~uint64_t(0) << lo;
+		if (hi < 64) {
+			mask &= (uint64_t(1) << hi) - 1;
+		}
+		dist += __builtin_popcountll((a[w] ^ b[w]) & mask);
+		bit = w * 64 + hi;
+	}
+	return dist;
+}
+
+// Orders the code dimensions by decreasing |weight|, where weight is the
+// per-bit weight of the ElementWiseProductLayer. Codes binarized with this
+// order are bit-scalable: the first L bits of a code are the L-bit code
+// made of the L most important bits. Ties put the higher dimension first.
+template<typename Dtype>
+void RankBitsByWeight(const Dtype* weight, const int dim,
+		std::vector<int>* order);
+
+// Binarizes a real-valued hashing feature (the sigmoid output in [-1, 1])
+// into a packed code: bit b of the code is set iff
+// feature[bit_order[b]] > 0. If bit_order is NULL, bit b is taken from
+// feature[b]. Bit b lives in word b / 64 at position b % 64; the unused high
+// bits of the last word are always zero.
+template<typename Dtype>
+void BinarizeCode(const Dtype* feature, const int nbits, const int* bit_order,
+		uint64_t* code);
+
+// HashCodeStore keeps a set of binary codes packed into uint64_t words, one
+// fixed-size row per item, so that the hashing features produced by the
+// net can be ranked with hardware popcount instead of float arithmetic.
+class HashCodeStore {
+public:
+	HashCodeStore() :
+			nbits_(0), words_(0), num_(0), attached_(false), data_(NULL) {
+	}
+	explicit HashCodeStore(const int nbits) :
+			nbits_(0), words_(0), num_(0), attached_(false), data_(NULL) {
+		Reset(nbits);
+	}
+	// Copies own their copy of the codes; copies of an attached store use
+	// the same external codes.
+	HashCodeStore(const HashCodeStore& other);
+	HashCodeStore& operator=(const HashCodeStore& other);
+	// Drops all codes and sets the code length.
+	void Reset(const int nbits);
+	void Reserve(const int num);
+	// Uses num packed codes owned by the caller (e.g. a memory-mapped
+	// CodeFile) without copying them. The store is read-only afterwards
+	// until the next Reset().
+	void Attach(const uint64_t* codes, const int num, const int nbits);
+
+	// Binarizes one feature and appends it as a new item.
+	template<typename Dtype>
+	void Append(const Dtype* feature, const int* bit_order);
+	// Binarizes num features stored contiguously with stride dim.
+	template<typename Dtype>
+	void AppendBatch(const Dtype* features, const int num, const int dim,
+			const int* bit_order);
+	// Appends an already packed code of words() words.
+	void AppendCode(const uint64_t* code);
+
+	inline int num() const {
+		return num_;
+	}
+	inline int nbits() const {
+		return nbits_;
+	}
+	inline int words() const {
+		return words_;
+	}
+	inline const uint64_t* cpu_data() const {
+		return data_;
+	}
+	inline const uint64_t* code(const int i) const {
+		return data_ + static_cast<size_t>(i) * words_;
+	}
+	inline int Distance(const int i, const uint64_t* query) const {
+		return HammingDistance(code(i), query, words_);
+	}
+	// Bytes used by the packed codes.
+	inline size_t memory_size() const {
+		return static_cast<size_t>(num_) * words_ * sizeof(uint64_t);
+	}
+
+protected:
+	int nbits_;
+	int words_;
+	int num_;
+	bool attached_;
+	// Either &codes_[0] or the attached external codes.
+	const uint64_t* data_;
+	std::vector<uint64_t> codes_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HASH_CODE_HPP_
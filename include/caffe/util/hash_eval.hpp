@@ -0,0 +1,204 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_HASH_EVAL_HPP_
+#define CAFFE_UTIL_HASH_EVAL_HPP_
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/parallel.hpp"
+#include "caffe/util/retrieval_metrics.hpp"
+
+namespace caffe {
+
+// Hamming distance over the first nbits bits of packed codes, so the same
+// bit-scalable store can be evaluated at any code length. A metric for the
+// evaluation engine only has to return integer distances in
+// [0, max_distance()].
+class HammingMetric {
+public:
+	explicit HammingMetric(const int nbits) :
+			nbits_(nbits) {
+	}
+	inline int max_distance() const {
+		return nbits_;
+	}
+	inline int operator()(const uint64_t* a, const uint64_t* b) const {
+		return PrefixHammingDistance(a, b, nbits_);
+	}
+
+protected:
+	int nbits_;
+};
+
+// Weighted Hamming distance: the sum of the weights of the differing bits,
+// where the weight of a bit is its learned |weight| in the
+// ElementWiseProductLayer. Weights are quantized to integers in [0, levels]
+// relative to the largest one, so distances stay small integers and the
+// bucketed evaluation below still applies. The distance is computed with one
+// 256-entry table per byte position holding the weight sum of every byte
+// value, i.e. eight lookups per 64-bit word instead of a popcount.
+class WeightedHammingMetric {
+public:
+	// weights[b] is the weight of code bit b; only the first nbits bits of
+	// the codes are compared.
+	template<typename Dtype>
+	WeightedHammingMetric(const Dtype* weights, const int nbits,
+			const int levels = 16);
+	inline int max_distance() const {
+		return max_distance_;
+	}
+	inline int operator()(const uint64_t* a, const uint64_t* b) const {
+		int dist = 0;
+		const uint16_t* table = &table_[0];
+		for (int w = 0; w < words_; ++w, table += 8 * 256) {
+			uint64_t x = a[w] ^ b[w];
+			for (int k = 0; x; ++k, x >>= 8) {
+				dist += table[k * 256 + (x & 0xff)];
+			}
+		}
+		return dist;
+	}
+	// Quantized weight of code bit b.
+	inline int bit_weight(const int b) const {
+		return bit_weights_[b];
+	}
+
+protected:
+	int words_;
+	int max_distance_;
+	std::vector<int> bit_weights_;
+	std::vector<uint16_t> table_;
+};
+
+// Ranks the whole database against one query without sorting: since
+// distances are small integers, the ranking is fully described by how many
+// items (total) and how many items of the query's class (relevant) fall at
+// each distance. Both arrays must hold metric.max_distance() + 1 entries.
+template<typename Metric>
+void RankByDistance(const Metric& metric, const uint64_t* query,
+		const int query_class, const HashCodeStore& database,
+		const int* database_classes, int* total, int* relevant) {
+	const int buckets = metric.max_distance() + 1;
+	memset(total, 0, sizeof(int) * buckets);
+	memset(relevant, 0, sizeof(int) * buckets);
+	const int num = database.num();
+	for (int j = 0; j < num; ++j) {
+		const int d = metric(query, database.code(j));
+		total[d]++;
+		relevant[d] += (database_classes[j] == query_class);
+	}
+}
+
+// Per-query AP of a whole query set, computed by num_threads pthreads (0 means
+// one per online core). Workers pull small chunks of queries from a shared
+// counter and own their ranking buffers; every AP is written to its own slot
+// so the result does not depend on the thread count or scheduling.
+// relevant_per_class[c] is the number of database items of class c.
+template<typename Metric>
+void EvaluateQueries(const Metric& metric, const HashCodeStore& queries,
+		const int* query_classes, const HashCodeStore& database,
+		const int* database_classes, const int* relevant_per_class,
+		const int num_threads, std::vector<double>* ap);
+// Same, but computes all the given metrics from each query's single ranking:
+// (*values)[i * metrics.size() + m] is metric m of query i.
+template<typename Metric>
+void EvaluateQueries(const Metric& metric, const HashCodeStore& queries,
+		const int* query_classes, const HashCodeStore& database,
+		const int* database_classes, const int* relevant_per_class,
+		const RetrievalMetrics& metrics, const int num_threads,
+		std::vector<double>* values);
+
+// Sums per-query APs into per-class totals in query order, so the floating
+// point reduction is the same for any number of evaluation threads.
+void ReduceByClass(const std::vector<double>& ap, const int* query_classes,
+		const int num_classes, std::vector<double>* class_sum);
+
+// Evaluates several code lengths of bit-scalable codes in a single sweep:
+// lengths must be ascending and at most the stored code length, and the
+// distance at each length is the distance at the previous one plus the
+// popcount of the bits in between. (*ap)[l][i] is the AP of query i using
+// the first lengths[l] bits. Threading is the same as in EvaluateQueries.
+void EvaluatePrefixLengths(const HashCodeStore& queries,
+		const int* query_classes, const HashCodeStore& database,
+		const int* database_classes, const int* relevant_per_class,
+		const std::vector<int>& lengths, const int num_threads,
+		std::vector<std::vector<double> >* ap);
+// Same with all the given metrics; (*values)[l] is laid out as in
+// EvaluateQueries.
+void EvaluatePrefixLengths(const HashCodeStore& queries,
+		const int* query_classes, const HashCodeStore& database,
+		const int* database_classes, const int* relevant_per_class,
+		const std::vector<int>& lengths, const RetrievalMetrics& metrics,
+		const int num_threads, std::vector<std::vector<double> >* values);
+
+template<typename Metric>
+struct EvalTask {
+	const Metric* metric;
+	const HashCodeStore* queries;
+	const int* query_classes;
+	const HashCodeStore* database;
+	const int* database_classes;
+	const int* relevant_per_class;
+	const RetrievalMetrics* metrics;
+	double* values;
+};
+
+template<typename Metric>
+void EvalWorker(WorkQueue* queue, void* task_pointer) {
+	EvalTask<Metric>* task = reinterpret_cast<EvalTask<Metric>*>(task_pointer);
+	std::vector<int> total(task->metric->max_distance() + 1);
+	std::vector<int> relevant(task->metric->max_distance() + 1);
+	int begin, end;
+	while (queue->Next(&begin, &end)) {
+		for (int i = begin; i < end; ++i) {
+			const int query_class = task->query_classes[i];
+			RankByDistance(*task->metric, task->queries->code(i), query_class,
+					*task->database, task->database_classes, &total[0],
+					&relevant[0]);
+			task->metrics->Compute(&total[0], &relevant[0], total.size(),
+					task->relevant_per_class[query_class],
+					task->values + i * task->metrics->size());
+		}
+	}
+}
+
+template<typename Metric>
+void EvaluateQueries(const Metric& metric, const HashCodeStore& queries,
+		const int* query_classes, const HashCodeStore& database,
+		const int* database_classes, const int* relevant_per_class,
+		const int num_threads, std::vector<double>* ap) {
+	// Average precision is the only metric, so values are the APs.
+	EvaluateQueries(metric, queries, query_classes, database, database_classes,
+			relevant_per_class, RetrievalMetrics(), num_threads, ap);
+}
+
+template<typename Metric>
+void EvaluateQueries(const Metric& metric, const HashCodeStore& queries,
+		const int* query_classes, const HashCodeStore& database,
+		const int* database_classes, const int* relevant_per_class,
+		const RetrievalMetrics& metrics, const int num_threads,
+		std::vector<double>* values) {
+	values->assign(queries.num() * metrics.size(), 0.);
+	if (queries.num() == 0) {
+		return;
+	}
+	EvalTask<Metric> task;
+	task.metric = &metric;
+	task.queries = &queries;
+	task.query_classes = query_classes;
+	task.database = &database;
+	task.database_classes = database_classes;
+	task.relevant_per_class = relevant_per_class;
+	task.metrics = &metrics;
+	task.values = &(*values)[0];
+	ParallelFor(queries.num(), 16, num_threads, EvalWorker<Metric>, &task);
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HASH_EVAL_HPP_
@@ -0,0 +1,77 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_IMAGE_CACHE_HPP_
+#define CAFFE_UTIL_IMAGE_CACHE_HPP_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// An 8-bit image as decoded by OpenCV: interleaved channels, row by row.
+struct DecodedImage {
+	int height;
+	int width;
+	int channels;
+	std::vector<uint8_t> pixels;
+
+	inline const uint8_t* pixel(const int h, const int w) const {
+		return &pixels[(static_cast<size_t>(h) * width + w) * channels];
+	}
+};
+
+// Decoded images kept in memory under a byte budget, so images that are
+// drawn again (every triplet batch, every test pass) skip the PNG decode.
+// The least recently used images are evicted once the budget is exceeded.
+// Images are handed out as shared pointers, so an image evicted while a
+// caller still reads it stays valid. All methods are thread-safe.
+class ImageCache {
+public:
+	explicit ImageCache(const size_t capacity_bytes);
+	~ImageCache();
+
+	// The image cached under key, or NULL. Counts a hit or a miss, and a
+	// hit makes the image the most recently used.
+	shared_ptr<const DecodedImage> Lookup(const std::string& key);
+	// Caches image under key (replacing any image already there) and evicts
+	// until the cache fits its budget. Images larger than the whole budget
+	// are not cached.
+	void Insert(const std::string& key,
+			const shared_ptr<const DecodedImage>& image);
+
+	inline size_t capacity_bytes() const {
+		return capacity_bytes_;
+	}
+	size_t size_bytes() const;
+	int count() const;
+	long long hits() const;
+	long long misses() const;
+
+protected:
+	typedef std::pair<std::string, shared_ptr<const DecodedImage> > Entry;
+	typedef std::list<Entry> EntryList;
+
+	size_t capacity_bytes_;
+	// Guards everything below.
+	mutable pthread_mutex_t mutex_;
+	// Most recently used first.
+	EntryList entries_;
+	std::map<std::string, EntryList::iterator> index_;
+	size_t size_bytes_;
+	long long hits_;
+	long long misses_;
+
+DISABLE_COPY_AND_ASSIGN(ImageCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_IMAGE_CACHE_HPP_
@@ -0,0 +1,29 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_IMAGE_TRANSFORM_HPP_
+#define CAFFE_UTIL_IMAGE_TRANSFORM_HPP_
+
+#include <stdint.h>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Crops an interleaved (HWC) 8-bit image into a planar (CHW) blob slice and
+// normalizes it as the data layer does: for the crop_h x crop_w window at
+// (h_off, w_off),
+//   dst[(c * crop_h + h) * crop_w + w] =
+//       128 * scale - (src(h + h_off, w + w_off)[c] - mean) * scale
+// where mean is the CHW mean image, height x width like src. With mirror the
+// columns of every output row are reversed. The image is walked with row
+// pointers, one pass over each source row; 1 and 3 channels have
+// unit-stride inner loops of their own, so the compiler can vectorize them.
+template<typename Dtype>
+void CropNormalizeHWC(const uint8_t* src, const int height, const int width,
+		const int channels, const int h_off, const int w_off, const int crop_h,
+		const int crop_w, const bool mirror, const Dtype* mean,
+		const Dtype scale, Dtype* dst);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_IMAGE_TRANSFORM_HPP_
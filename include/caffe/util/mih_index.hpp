@@ -0,0 +1,81 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_MIH_INDEX_HPP_
+#define CAFFE_UTIL_MIH_INDEX_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/hash_code.hpp"
+
+namespace caffe {
+
+// Multi-index hashing (Norouzi et al., CVPR 2012) over the codes of a
+// HashCodeStore. Each code is cut into m disjoint substrings and every
+// substring gets its own direct-addressed hash table. If two codes are within
+// Hamming distance r, at least one of their substrings differs in at most
+// floor(r / m) bits, so a query only has to probe the tables at small
+// substring radii instead of scanning the whole database.
+class MultiIndexHash {
+public:
+	MultiIndexHash() :
+			store_(NULL), num_substrings_(0) {
+	}
+	// Indexes all codes of store, which must outlive the index. If
+	// num_substrings is 0 it is chosen from the code length and database size.
+	void Build(const HashCodeStore& store, const int num_substrings = 0);
+
+	// Exact k nearest neighbours in Hamming distance. Results are sorted by
+	// distance and ties are broken by ascending item id.
+	void KnnSearch(const uint64_t* query, const int k, std::vector<int>* ids,
+			std::vector<int>* distances) const;
+	// All items within Hamming distance radius, sorted like KnnSearch.
+	void RadiusSearch(const uint64_t* query, const int radius,
+			std::vector<int>* ids, std::vector<int>* distances) const;
+	// All items within Hamming distance radius grouped by distance: the items
+	// at distance d are ids[offsets[d] .. offsets[d + 1]) in ascending order,
+	// for d in [0, radius]. Small radii probe the tables with bit-flipped
+	// substrings; once that would touch more buckets and candidates than
+	// there are codes, the whole store is scanned instead.
+	void GroupedRadiusSearch(const uint64_t* query, const int radius,
+			std::vector<int>* ids, std::vector<int>* offsets) const;
+	// Whether GroupedRadiusSearch scans rather than probes at this radius.
+	bool PrefersLinearScan(const int radius) const;
+
+	inline int num_substrings() const {
+		return num_substrings_;
+	}
+	inline const HashCodeStore* store() const {
+		return store_;
+	}
+
+	// Picks m so that every substring has about log2(num) bits, which keeps
+	// the tables roughly one item per bucket.
+	static int DefaultSubstrings(const int nbits, const int num);
+
+	// The longest substring a direct-addressed table is built for.
+	static const int kMaxSubstringBits = 24;
+
+protected:
+	uint32_t Substring(const uint64_t* code, const int j) const;
+	// Probes every table at substring distance exactly t. New candidates are
+	// appended to (ids, distances); an item is only reported by the first
+	// (t, table) pair that can reach it so there are no duplicates.
+	void Probe(const uint64_t* query, const int t, std::vector<int>* ids,
+			std::vector<int>* distances) const;
+
+	const HashCodeStore* store_;
+	int num_substrings_;
+	std::vector<int> sub_begin_;
+	std::vector<int> sub_len_;
+	// For table j, the items whose substring equals v are
+	// table_ids_[j][table_offsets_[j][v] .. table_offsets_[j][v + 1]).
+	std::vector<std::vector<int> > table_offsets_;
+	std::vector<std::vector<int> > table_ids_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MIH_INDEX_HPP_
@@ -0,0 +1,141 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_PACKED_IMAGES_HPP_
+#define CAFFE_UTIL_PACKED_IMAGES_HPP_
+
+#include <stdint.h>
+
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// A training set packed into one file of raw images, so the data layer
+// reads pixels straight from a mapping instead of opening and decoding one
+// PNG per image. All images have the same size. Layout:
+//   PackedImageHeader, padded to kPackedImageAlignment
+//   uint8  images[count][height * width * channels]   interleaved (HWC),
+//          in the order they were appended, each starting on an 8-byte
+//          boundary
+//   uint64 class_name_offsets[num_classes + 1], then the class names
+//   int32  class_begin[num_classes + 1]
+//   int32  image_ids[count]    sorted by class, then by image id
+//   int32  records[count]      the image of every (class, image id) above
+// Images are found by (class, id) with a binary search in their class.
+struct PackedImageHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t height;
+	uint32_t width;
+	uint32_t channels;
+	uint64_t count;
+	uint64_t num_classes;
+	// Bytes from one image to the next.
+	uint64_t image_stride;
+	uint64_t images_offset;
+	uint64_t class_names_offset;
+	uint64_t class_begin_offset;
+	uint64_t image_ids_offset;
+	uint64_t records_offset;
+	uint64_t file_size;
+	uint64_t reserved[4];
+};
+
+// The images start on a page boundary.
+const int kPackedImageAlignment = 4096;
+
+// Writes a packed file image by image; the index is written by Close().
+class PackedImageWriter {
+public:
+	PackedImageWriter() :
+			image_bytes_(0) {
+	}
+	~PackedImageWriter();
+	void Open(const std::string& filename, const int height, const int width,
+			const int channels);
+	// pixels holds height * width * channels bytes in HWC order. Every
+	// (class_name, image_id) may only be appended once.
+	void Append(const std::string& class_name, const int image_id,
+			const uint8_t* pixels);
+	void Close();
+	inline uint64_t count() const {
+		return image_ids_.size();
+	}
+
+protected:
+	std::string filename_;
+	std::ofstream file_;
+	PackedImageHeader header_;
+	uint64_t image_bytes_;
+	std::map<std::string, int> class2id_;
+	std::vector<std::string> class_names_;
+	std::vector<int> class_ids_;
+	std::vector<int> image_ids_;
+
+DISABLE_COPY_AND_ASSIGN(PackedImageWriter);
+};
+
+// Read-only memory-mapped view of a packed file.
+class PackedImageFile {
+public:
+	PackedImageFile() :
+			data_(NULL), size_(0), header_(NULL) {
+	}
+	explicit PackedImageFile(const std::string& filename) :
+			data_(NULL), size_(0), header_(NULL) {
+		Open(filename);
+	}
+	~PackedImageFile() {
+		Close();
+	}
+	void Open(const std::string& filename);
+	void Close();
+
+	// The image of class_name with the given id, or -1.
+	int Find(const std::string& class_name, const int image_id) const;
+	// The image of a "<class>_<id>[.<ext>]" filename, or -1.
+	int Find(const std::string& filename) const;
+
+	inline int count() const {
+		return header_->count;
+	}
+	inline int height() const {
+		return header_->height;
+	}
+	inline int width() const {
+		return header_->width;
+	}
+	inline int channels() const {
+		return header_->channels;
+	}
+	inline int num_classes() const {
+		return header_->num_classes;
+	}
+	std::string class_name(const int c) const;
+	// height() * width() * channels() bytes, HWC.
+	inline const uint8_t* image(const int i) const {
+		return reinterpret_cast<const uint8_t*>(data_ + header_->images_offset
+				+ static_cast<uint64_t>(i) * header_->image_stride);
+	}
+
+protected:
+	template<typename T>
+	inline const T* Section(const uint64_t offset) const {
+		return reinterpret_cast<const T*>(data_ + offset);
+	}
+
+	const char* data_;
+	size_t size_;
+	const PackedImageHeader* header_;
+	std::map<std::string, int> class2id_;
+
+DISABLE_COPY_AND_ASSIGN(PackedImageFile);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PACKED_IMAGES_HPP_
@@ -0,0 +1,96 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_PARALLEL_HPP_
+#define CAFFE_UTIL_PARALLEL_HPP_
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Hands the items [0, num) out in chunks from a shared counter, so the
+// threads of a ParallelFor balance themselves.
+class WorkQueue {
+public:
+	WorkQueue(const int num, const int chunk) :
+			num_(num), chunk_(chunk), next_(0) {
+		CHECK_GT(chunk, 0);
+	}
+	// Takes the next chunk [*begin, *end); false once all are taken.
+	inline bool Next(int* begin, int* end) {
+		const int first = __sync_fetch_and_add(&next_, chunk_);
+		if (first >= num_) {
+			return false;
+		}
+		*begin = first;
+		*end = std::min(first + chunk_, num_);
+		return true;
+	}
+	inline int num() const {
+		return num_;
+	}
+
+protected:
+	const int num_;
+	const int chunk_;
+	volatile int next_;
+
+DISABLE_COPY_AND_ASSIGN(WorkQueue);
+};
+
+// A worker of a ParallelFor: sets up its own buffers, then takes chunks
+// from queue until it is empty.
+typedef void (*ParallelWorker)(WorkQueue* queue, void* arg);
+
+// Runs worker(queue, arg) on num_threads pthreads (0 means one per online
+// core) over a queue of [0, num) in chunks of chunk, and returns once all
+// items are done. The calling thread is one of the workers.
+void ParallelFor(const int num, const int chunk, const int num_threads,
+		ParallelWorker worker, void* arg);
+
+// A fixed set of threads that run ParallelFor-style loops, for loops run
+// again and again (once per batch, say) that should not create and join
+// their threads every time.
+class WorkerPool {
+public:
+	// num_threads threads in all (0 means one per online core), counting
+	// the thread that calls Run(), which works on each loop too.
+	explicit WorkerPool(const int num_threads);
+	~WorkerPool();
+	// Runs worker(queue, arg) over [0, num) like ParallelFor and returns
+	// once all items are done. Only one Run() may be in flight at a time.
+	void Run(const int num, const int chunk, ParallelWorker worker, void* arg);
+	inline int num_threads() const {
+		return threads_.size() + 1;
+	}
+
+protected:
+	static void* Entry(void* pool_pointer);
+	void Loop();
+
+	std::vector<pthread_t> threads_;
+	pthread_mutex_t mutex_;
+	pthread_cond_t loop_ready_;
+	pthread_cond_t loop_done_;
+	// The loop being run; generation_ counts the Run() calls.
+	WorkQueue* queue_;
+	ParallelWorker worker_;
+	void* arg_;
+	int generation_;
+	// Pool threads still working on the current loop.
+	int running_;
+	bool stop_;
+
+DISABLE_COPY_AND_ASSIGN(WorkerPool);
+};
+
+// Number of threads to use when 0 is requested.
+int DefaultEvalThreads();
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PARALLEL_HPP_
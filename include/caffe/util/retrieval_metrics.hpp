@@ -0,0 +1,66 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_RETRIEVAL_METRICS_HPP_
+#define CAFFE_UTIL_RETRIEVAL_METRICS_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Average precision of a ranking given as per-distance counts, normalized by
+// num_relevant. Items at the same distance are tied and their relative order
+// is undefined, so the expected AP over all orderings of each tie group is
+// returned (McSherry & Najork, ECIR 2008). Runs in O(N) with no allocation.
+double AveragePrecision(const int* total, const int* relevant,
+		const int buckets, const int num_relevant);
+
+// The set of retrieval metrics reported for every query, all derived from the
+// query's distance histogram (see RankByDistance), so the database is ranked
+// once no matter how many metrics are asked for. Like AveragePrecision, every
+// metric is the expectation over the orderings of tied items.
+// The values of one query are, in order:
+//   mAP                  average precision
+//   P@k                  precision of the top k, for each precision k
+//   P@r<radius> R@r<radius>  precision and recall of the items within the
+//                        Hamming radius (precision is 0 if there are none)
+//   CMC@k                whether a relevant item is in the top k, for each
+//                        CMC rank
+class RetrievalMetrics {
+public:
+	// Average precision only.
+	RetrievalMetrics();
+	// radius < 0 leaves out the radius metrics.
+	RetrievalMetrics(const std::vector<int>& precision_ks, const int radius,
+			const std::vector<int>& cmc_ranks);
+
+	inline int size() const {
+		return names_.size();
+	}
+	inline const std::string& name(const int i) const {
+		return names_[i];
+	}
+	inline int radius() const {
+		return radius_;
+	}
+	// Writes size() values for one query.
+	void Compute(const int* total, const int* relevant, const int buckets,
+			const int num_relevant, double* values) const;
+	// Per-metric means of num_queries x size() values, summed in query order.
+	void Mean(const std::vector<double>& values,
+			std::vector<double>* mean) const;
+
+protected:
+	void Init();
+
+	std::vector<int> precision_ks_;
+	int radius_;
+	std::vector<int> cmc_ranks_;
+	std::vector<std::string> names_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_RETRIEVAL_METRICS_HPP_
@@ -0,0 +1,81 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_SHARD_SEARCH_HPP_
+#define CAFFE_UTIL_SHARD_SEARCH_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/mih_index.hpp"
+#include "caffe/util/unix_socket.hpp"
+
+namespace caffe {
+
+// Sharded Hamming k-NN: every shard process indexes a contiguous slice of the
+// database codes and a coordinator scatters each query to all shards and
+// merges their top-k lists. Shards report global ids, and every list is
+// ordered by (distance, id), so the merge gives exactly the ranking of a
+// single MultiIndexHash over the whole database, ties included.
+//
+// Line protocol between coordinator and shards, over Unix domain sockets:
+//    knn <k> <word> ...        k nearest items of a code given as hex words
+//    -> ok <n> <id> <distance> ...   or   error <message>
+
+// First item of shard `shard` when num items are split into num_shards
+// contiguous slices of nearly equal size.
+inline int ShardBegin(const int num, const int shard, const int num_shards) {
+	return static_cast<int64_t>(num) * shard / num_shards;
+}
+
+std::string FormatKnnRequest(const uint64_t* code, const int words,
+		const int k);
+// Parses a knn request for a code of code->size() words.
+bool ParseKnnRequest(const std::string& line, int* k,
+		std::vector<uint64_t>* code);
+std::string FormatKnnResponse(const std::vector<int>& ids,
+		const std::vector<int>& distances);
+bool ParseKnnResponse(const std::string& line, std::vector<int>* ids,
+		std::vector<int>* distances);
+
+// Merges per-shard lists, each sorted by (distance, id), into the k best
+// items by (distance, id).
+void MergeShardResults(const std::vector<std::vector<int> >& ids,
+		const std::vector<std::vector<int> >& distances, const int k,
+		std::vector<int>* merged_ids, std::vector<int>* merged_distances);
+
+// Answers knn requests on fd from index until the peer closes it. Local ids
+// of index are reported as id_offset + id.
+void ServeShardConnection(const MultiIndexHash& index, const int id_offset,
+		const int fd);
+
+// Coordinator side: one connection per shard socket. A query is written to
+// every shard before any reply is read, so the shards search in parallel.
+// Not thread-safe; use one ShardedIndex per thread.
+class ShardedIndex {
+public:
+	ShardedIndex(const std::vector<std::string>& socket_paths, const int nbits);
+	~ShardedIndex();
+
+	void KnnSearch(const uint64_t* query, const int k, std::vector<int>* ids,
+			std::vector<int>* distances);
+
+	inline int num_shards() const {
+		return fds_.size();
+	}
+
+protected:
+	int words_;
+	std::vector<int> fds_;
+	std::vector<LineReader> readers_;
+	std::vector<std::vector<int> > shard_ids_;
+	std::vector<std::vector<int> > shard_distances_;
+
+DISABLE_COPY_AND_ASSIGN(ShardedIndex);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SHARD_SEARCH_HPP_
@@ -0,0 +1,58 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_TOPK_SEARCH_HPP_
+#define CAFFE_UTIL_TOPK_SEARCH_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/hash_eval.hpp"
+
+namespace caffe {
+
+// Exact top-k search of a batch of queries by linear scan, for callers that
+// only need the first k matches instead of the whole ranking. Every query
+// keeps one bucket of ids per distance, each capped at k, and the largest
+// distance that can still make the top k. That limit shrinks as the buckets
+// below it fill, so most items are rejected after their distance is computed,
+// and a query stops scanning once it holds k exact matches. The database is
+// scanned in tiles of about kTileBytes of codes, and every tile is run
+// against a chunk of kQueryChunk queries while it is still in cache.
+// Metric is HammingMetric or WeightedHammingMetric.
+template<typename Metric>
+class TopKSearcher {
+public:
+	// metric and database must outlive the searcher.
+	TopKSearcher(const Metric& metric, const HashCodeStore& database) :
+			metric_(&metric), database_(&database) {
+	}
+
+	// The n = min(k, database.num()) nearest items of every query, sorted by
+	// distance with ties broken by ascending id like
+	// MultiIndexHash::KnnSearch: (*ids)[i * n + r] is the r-th match of query
+	// i and (*distances)[i * n + r] its distance. Queries are split among
+	// num_threads pthreads (0 means one per online core).
+	void Search(const HashCodeStore& query_codes, const int k,
+			std::vector<int>* ids, std::vector<int>* distances,
+			const int num_threads = 1) const;
+
+	inline const HashCodeStore& database() const {
+		return *database_;
+	}
+
+	// Queries scanned together against each database tile.
+	static const int kQueryChunk = 16;
+	// Approximate size of a database tile.
+	static const int kTileBytes = 32768;
+
+protected:
+	const Metric* metric_;
+	const HashCodeStore* database_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_TOPK_SEARCH_HPP_
@@ -0,0 +1,82 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_TWO_STAGE_SEARCH_HPP_
+#define CAFFE_UTIL_TWO_STAGE_SEARCH_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/code_file.hpp"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/mih_index.hpp"
+#include "caffe/util/retrieval_metrics.hpp"
+
+namespace caffe {
+
+// Wall-clock time of the two stages of one query, in microseconds.
+struct TwoStageTiming {
+	double shortlist_us;
+	double rerank_us;
+};
+
+// Two-stage retrieval: the shortlist() nearest codes in Hamming distance
+// come from a multi-index hash over the packed codes, then only those items
+// are re-ranked by squared Euclidean distance between the full-precision
+// features. The features stay in a memory-mapped CODE_FILE_FLOAT file and
+// only the rows of shortlisted items are read, so the shortlist length trades
+// speed for float accuracy.
+class TwoStageSearcher {
+public:
+	// index is built over the database codes and features has one row per
+	// indexed code, in the same order. Both must outlive the searcher.
+	TwoStageSearcher(const MultiIndexHash& index, const CodeFile& features,
+			const int shortlist);
+
+	// query_code has the index's code length and query_feature features.dim()
+	// floats. ids and distances get the first k re-ranked items (the whole
+	// shortlist if k < 0) by ascending float distance, ties by ascending id.
+	// timing may be NULL.
+	void Search(const uint64_t* query_code, const float* query_feature,
+			const int k, std::vector<int>* ids, std::vector<float>* distances,
+			TwoStageTiming* timing) const;
+
+	inline int shortlist() const {
+		return shortlist_;
+	}
+	inline void set_shortlist(const int shortlist) {
+		CHECK_GT(shortlist, 0);
+		shortlist_ = shortlist;
+	}
+	// Floats per feature.
+	inline int dim() const {
+		return features_->dim();
+	}
+	inline const MultiIndexHash& index() const {
+		return *index_;
+	}
+
+protected:
+	const MultiIndexHash* index_;
+	const CodeFile* features_;
+	int shortlist_;
+};
+
+// Per-query metrics of two-stage retrieval. The ranking of a query is its
+// re-ranked shortlist, items with equal float distance tied, followed by the
+// rest of the database as a single tie group, so items the shortlist misses
+// count as found at a random position after it. metrics must not ask for
+// radius metrics. queries holds the query codes and query_features their
+// features; threading and the values layout are those of EvaluateQueries,
+// and timings gets the latency of every query.
+void EvaluateTwoStage(const TwoStageSearcher& searcher,
+		const HashCodeStore& queries, const float* query_features,
+		const int* query_classes, const int* database_classes,
+		const int* relevant_per_class, const RetrievalMetrics& metrics,
+		const int num_threads, std::vector<double>* values,
+		std::vector<TwoStageTiming>* timings);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_TWO_STAGE_SEARCH_HPP_
@@ -0,0 +1,39 @@
+// Copyright 2014 Ruimao Zhang
+
+#ifndef CAFFE_UTIL_UNIX_SOCKET_HPP_
+#define CAFFE_UTIL_UNIX_SOCKET_HPP_
+
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Minimal helpers for the line-oriented protocols the retrieval tools speak
+// over local Unix domain stream sockets.
+
+// Binds and listens on path, removing a stale socket file first.
+int ListenUnixSocket(const std::string& path, const int backlog = 64);
+int ConnectUnixSocket(const std::string& path);
+// Writes all of data; returns false if the peer has gone away.
+bool WriteAll(const int fd, const std::string& data);
+
+// Buffered reader of '\n'-terminated lines from a socket.
+class LineReader {
+public:
+	explicit LineReader(const int fd) :
+			fd_(fd), begin_(0) {
+	}
+	// Reads the next line without its '\n'. Returns false at the end of the
+	// stream; a final unterminated line is dropped.
+	bool ReadLine(std::string* line);
+
+protected:
+	int fd_;
+	std::string buffer_;
+	size_t begin_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_UNIX_SOCKET_HPP_
@@ -13,6 +13,9 @@
 
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/image_cache.hpp"
+#include "caffe/util/packed_images.hpp"
+#include "caffe/util/parallel.hpp"
 namespace caffe {
 
 // The neuron layer is a specific type of layers that just works on single
@@ -340,23 +343,49 @@ protected:
 	int N_;
 };
 
-// This function is used to create a pthread that prefetches the data.
+// One prefetched batch: the images and the W matrix, and the triplets they
+// were sampled from.
+template<typename Dtype>
+struct DataLayerBatch {
+	shared_ptr<Blob<Dtype> > data;
+	shared_ptr<Blob<Dtype> > W;
+	std::vector<std::vector<std::string> > triplets;
+	std::vector<std::vector<int> > triplets_id;
+	std::map<std::string, int> name2id;
+	std::vector<int> imgclass;
+};
+
+template<typename Dtype>
+class DataLayer;
+
+// The long-lived prefetch thread: fills the free batches of the layer's
+// ring, one after the other, until the layer is destroyed.
 template<typename Dtype>
 void* DataLayerPrefetch(void* layer_pointer);
+// Samples and loads one batch.
+template<typename Dtype>
+void DataLayerFillBatch(DataLayer<Dtype>* layer, DataLayerBatch<Dtype>* batch);
 
 template<typename Dtype>
 class DataLayer: public Layer<Dtype> {
-	// The function used to perform prefetching.
+	// The functions used to perform prefetching.
 	friend void* DataLayerPrefetch<Dtype>(void* layer_pointer);
+	friend void DataLayerFillBatch<Dtype>(DataLayer<Dtype>* layer,
+			DataLayerBatch<Dtype>* batch);
 
 public:
 	explicit DataLayer(const LayerParameter& param) :
-			Layer<Dtype>(param) {
+			Layer<Dtype>(param), prefetching_(false) {
 	}
 	virtual ~DataLayer();
 	virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
 			vector<Blob<Dtype>*>* top);
 
+	// Batches ready in the prefetch ring.
+	int prefetch_queue_depth() const;
+	// Total time Forward waited for a batch, in microseconds.
+	double prefetch_stall_us() const;
+
 	virtual int getDataCount() const {
 		return counts_;
 	}
@@ -365,6 +394,12 @@ public:
 		return filenames_;
 	}
 
+	// The decoded images kept by the layer (with its hit and miss counts),
+	// or NULL if image_cache_mb is 0.
+	const ImageCache* image_cache() const {
+		return image_cache_.get();
+	}
+
 //	virtual shared_ptr<vector<std::string> >& getMutableFilenames() {
 //		return filenames_;
 //	}
@@ -412,6 +447,13 @@ protected:
 	virtual Dtype Backward_gpu(const vector<Blob<Dtype>*>& top,
 			const bool propagate_down, vector<Blob<Dtype>*>* bottom);
 
+	// The batch to serve, popped from the ring (waiting if none is ready)
+	// once the previous one has been served batch_iter times.
+	const DataLayerBatch<Dtype>& CurrentBatch();
+	// Hands the current batch's slot back to the prefetch thread after its
+	// last use.
+	void FinishBatch();
+
 //	shared_ptr<leveldb::DB> db_;
 //	shared_ptr<leveldb::Iterator> iter_;
 	int datum_channels_;
@@ -420,14 +462,31 @@ protected:
 	int datum_size_;
 
 	pthread_t thread_;
-	shared_ptr<Blob<Dtype> > prefetch_data_;
-	shared_ptr<Blob<Dtype> > prefetch_W_;
+	bool prefetching_;
+	// Ring of prefetch_depth batches; batch i goes to slot i % size.
+	vector<shared_ptr<DataLayerBatch<Dtype> > > batches_;
+	// Guards the counters below.
+	mutable pthread_mutex_t queue_mutex_;
+	pthread_cond_t batch_ready_;
+	pthread_cond_t slot_free_;
+	// Batches filled, popped and handed back so far.
+	long long filled_;
+	long long popped_;
+	long long released_;
+	bool stop_prefetch_;
+	double stall_us_;
+	long long stalls_;
+	// Slot of the batch being served and how many more times it is served.
+	int current_;
+	int uses_left_;
+	// The phase the layer was set up in; the prefetch thread keeps it while
+	// the solver switches phases.
+	Caffe::Phase phase_;
 //	shared_ptr<Blob<Dtype> > prefetch_label_;
 	Blob<Dtype> data_mean_;
 
 	// zhu
 	int counts_;
-	int batch_iter_;
 	int img_counts_per_class_per_iter_;
 //	shared_ptr<vector<std::string> > filenames_;
 //	shared_ptr<vector<cv::Point> > offset_;
@@ -454,6 +513,13 @@ protected:
 	int beg_index_;
 	// 下一张要读取的图片的id;
 	int curIndex;
+	// Decoded images by filename, shared by all batches.
+	shared_ptr<ImageCache> image_cache_;
+	// The images, when they come from a packed_source file.
+	shared_ptr<PackedImageFile> packed_images_;
+	// The loader_threads threads that load the images of every batch; the
+	// prefetch thread is one of them.
+	shared_ptr<WorkerPool> loader_pool_;
 };
 
 template<typename Dtype>
@@ -0,0 +1,22 @@
+#!/usr/bin/env sh
+# Sharded search on one box: starts $3 shard processes over the database
+# codes, scatters the query codes to them and verifies the merged top-k.
+# Usage: shard_search.sh query_codes.bin database_codes.bin num_shards k
+
+SOCKETS=""
+PIDS=""
+i=0
+while [ $i -lt $3 ]; do
+	SOCKET=/tmp/shard_$$_$i.sock
+	GLOG_logtostderr=1 ./build/examples/shard_server.bin $2 $i $3 $SOCKET &
+	PIDS="$PIDS $!"
+	SOCKETS="$SOCKETS $SOCKET"
+	i=$((i + 1))
+done
+for SOCKET in $SOCKETS; do
+	while [ ! -S $SOCKET ]; do sleep 0.1; done
+done
+
+GLOG_logtostderr=1 ./build/examples/shard_coordinator.bin $1 $4 result/triplet/shard_results.txt $SOCKETS --verify=$2
+kill $PIDS
+rm -f $SOCKETS
@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <leveldb/db.h>
 #include <pthread.h>
+#include <sys/time.h>
 
 #include <stdio.h>
 #include <string>
@@ -16,11 +17,15 @@
 #include <cstdlib>
 #include <ctime>
 #include <algorithm>
+#include <climits>
+#include <cstring>
 #include <fstream>
 
 #include "caffe/layer.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/Util.hpp"
+#include "caffe/util/dataset_manifest.hpp"
+#include "caffe/util/image_transform.hpp"
 #include "caffe/vision_layers.hpp"
 
 using std::string;
@@ -33,67 +38,117 @@ using std::vector;
 namespace caffe {
 int cropsize_h = 0;
 int cropsize_w = 0;
+// Decodes rootfolder/filename, or takes it from cache (if not NULL) when it
+// was decoded before.
+static shared_ptr<const DecodedImage> loadImage(const string& rootfolder,
+		const string& filename, ImageCache* cache) {
+	if (cache) {
+		shared_ptr<const DecodedImage> cached = cache->Lookup(filename);
+		if (cached) {
+			return cached;
+		}
+	}
+	cv::Mat img = cv::imread(rootfolder + "/" + filename, CV_LOAD_IMAGE_COLOR);
+	CHECK(img.data) << "Could not open or find file " << rootfolder << "/"
+			<< filename;
+	DecodedImage* decoded = new DecodedImage();
+	decoded->height = img.rows;
+	decoded->width = img.cols;
+	decoded->channels = img.channels();
+	const size_t row_bytes = img.cols * img.channels();
+	decoded->pixels.resize(img.rows * row_bytes);
+	for (int h = 0; h < img.rows; ++h) {
+		memcpy(&decoded->pixels[h * row_bytes], img.ptr<uint8_t>(h), row_bytes);
+	}
+	shared_ptr<const DecodedImage> image(decoded);
+	if (cache) {
+		cache->Insert(filename, image);
+	}
+	return image;
+}
+
+// Crop offsets and mirroring of one image. They are drawn on the prefetch
+// thread when the image is chosen, in the same order as the triplets, so the
+// random sequence does not depend on how many threads load the images.
+struct ImageAugment {
+	int h_off;
+	int w_off;
+	bool mirror;
+};
+
+static ImageAugment chooseAugment(const Caffe::Phase phase,
+		const int cropsize, const int height, const int width) {
+	ImageAugment augment;
+	augment.h_off = 0;
+	augment.w_off = 0;
+	augment.mirror = false;
+	if (!cropsize) {
+		return augment;
+	}
+	int perturb = 18;
+	// We only do random crop when we do training.
+	if (phase == Caffe::TRAIN && true/*!crop_center*/) {
+		augment.h_off = rand() % (height - cropsize_h);
+		augment.w_off = rand() % (width - cropsize_w);
+		augment.h_off = (height - cropsize_h) / 2 + perturb / 2
+				- rand() % perturb;
+		augment.w_off = (width - cropsize_w) / 2 + perturb / 2
+				- rand() % perturb;
+	} else {
+		augment.h_off = (height - cropsize_h) / 2;
+		augment.w_off = (width - cropsize_w) / 2;
+	}
+	bool mirror2 = true;
+	augment.mirror = phase == Caffe::TRAIN && mirror2 && rand() % 2;
+	return augment;
+}
+
 template<typename Dtype>
 void getImgData(const int& id, const string& rootfolder, const string& filename,
 		const int cropsize, const int channels, const int height,
 		const int width, const bool crop_center, const bool mirror,
-		Dtype* top_data, const Dtype* mean, const Dtype scale, const int size) {
-	cv::Mat img = cv::imread(rootfolder + "/" + filename, CV_LOAD_IMAGE_COLOR);
+		Dtype* top_data, const Dtype* mean, const Dtype scale, const int size,
+		ImageCache* cache, const PackedImageFile* packed,
+		const ImageAugment& augment) {
+	// Crop, mirror and mean subtraction read the interleaved pixels of a
+	// packed image in place, or the decoded ones, which may come from the
+	// cache.
+	shared_ptr<const DecodedImage> image;
+	const uint8_t* pixels;
+	int img_height, img_width;
+	if (packed) {
+		const int record = packed->Find(filename);
+		CHECK_GE(record, 0) << filename << " is not in the packed source.";
+		pixels = packed->image(record);
+		img_height = packed->height();
+		img_width = packed->width();
+	} else {
+		image = loadImage(rootfolder, filename, cache);
+		pixels = &image->pixels[0];
+		img_height = image->height;
+		img_width = image->width;
+	}
 
-	int h_off = 0, w_off = 0;
-	int perturb = 18;
+	const int h_off = augment.h_off, w_off = augment.w_off;
 	if (cropsize) {
-
-		// We only do random crop when we do training.
-		if (Caffe::phase() == Caffe::TRAIN && true/*!crop_center*/) {
-			h_off = rand() % (height - cropsize_h);
-			w_off = rand() % (width - cropsize_w);
-			h_off = (height - cropsize_h) / 2 + perturb / 2 - rand() % perturb;
-			w_off = (width - cropsize_w) / 2 + perturb / 2 - rand() % perturb;
-		} else {
-			h_off = (height - cropsize_h) / 2;
-			w_off = (width - cropsize_w) / 2;
-		}
-		bool mirror2 = true;
-		if (Caffe::phase() == Caffe::TRAIN && mirror2 && rand() % 2) {
-			// Copy mirrored version
-			for (int c = 0; c < channels; ++c) {
-				for (int h = 0; h < cropsize_h; ++h) {
-					for (int w = 0; w < cropsize_w; ++w) {
-						top_data[((id * channels + c) * cropsize_h + h)
-								* cropsize_w + cropsize_w - 1 - w] = 128 * scale
-								- (static_cast<uint8_t>(img.at < cv::Vec3b
-										> (h + h_off, w + w_off)[c])
-										- mean[(c * height + h + h_off) * width
-												+ w + w_off]) * scale;
-					}
-				}
-			}
-		} else {
-			// Normal copy
-			for (int c = 0; c < channels; ++c) {
-				for (int h = 0; h < cropsize_h; ++h) {
-					for (int w = 0; w < cropsize_w; ++w) {
-						top_data[((id * channels + c) * cropsize_h + h)
-								* cropsize_w + w] = 128 * scale
-								- (static_cast<uint8_t>(img.at < cv::Vec3b
-										> (h + h_off, w + w_off)[c])
-										- mean[(c * height + h + h_off) * width
-												+ w + w_off]) * scale;
-					}
-				}
-			}
-		}
+		// The mean image has the datum size, so the kernel indexes it like
+		// the pixels.
+		CHECK_EQ(img_height, height) << filename;
+		CHECK_EQ(img_width, width) << filename;
+		CHECK_EQ(channels, 3);
+		CropNormalizeHWC(pixels, img_height, img_width, channels, h_off, w_off,
+				cropsize_h, cropsize_w, augment.mirror, mean, scale,
+				top_data + id * channels * cropsize_h * cropsize_w);
 	} else {
 		// we will prefer to use data() first, and then try float_data()
 
 		for (int c = 0; c < channels; ++c) {
-			for (int h = 0; h < img.rows; ++h) {
-				for (int w = 0; w < img.cols; ++w) {
+			for (int h = 0; h < img_height; ++h) {
+				for (int w = 0; w < img_width; ++w) {
 					top_data[((id * channels + c) * cropsize + h) * cropsize + w] =
 							128 * scale
-									- (static_cast<uint8_t>(img.at < cv::Vec3b
-											> (h + h_off, w + w_off)[c])
+									- (pixels[((h + h_off) * img_width + w + w_off)
+											* 3 + c]
 											- mean[(c * height + h + h_off)
 													* width + w + w_off])
 											* scale;
@@ -107,22 +162,67 @@ Dtype* getFea(string pathName) {
 	return NULL;
 }
 
+// An image to be loaded into slot id of the batch.
+struct ImageJob {
+	int id;
+	string filename;
+	ImageAugment augment;
+};
+
+// The images of one batch, loaded on the layer's loader pool. Every job
+// writes its own slot of top_data, so the workers share nothing but the
+// job queue.
+template<typename Dtype>
+struct ImageLoadTask {
+	const vector<ImageJob>* jobs;
+	string rootfolder;
+	int cropsize;
+	int channels;
+	int height;
+	int width;
+	bool crop_center;
+	bool mirror;
+	Dtype* top_data;
+	const Dtype* mean;
+	Dtype scale;
+	int size;
+	ImageCache* cache;
+	const PackedImageFile* packed;
+};
+
 template<typename Dtype>
-void addIfNotExist(std::map<string, int>& name2id, const string& rootfolder,
+static void imageLoadWorker(WorkQueue* queue, void* task_pointer) {
+	ImageLoadTask<Dtype>* task =
+			reinterpret_cast<ImageLoadTask<Dtype>*>(task_pointer);
+	int begin, end;
+	while (queue->Next(&begin, &end)) {
+		for (int j = begin; j < end; ++j) {
+			const ImageJob& job = (*task->jobs)[j];
+			getImgData(job.id, task->rootfolder, job.filename, task->cropsize,
+					task->channels, task->height, task->width, task->crop_center,
+					task->mirror, task->top_data, task->mean, task->scale,
+					task->size, task->cache, task->packed, job.augment);
+		}
+	}
+}
+
+// Numbers the images of filenames not seen before in this batch and queues
+// them for loading.
+void addIfNotExist(std::map<string, int>& name2id,
 		const vector<string>& filenames, vector<int>& ids, const int cropsize,
-		const int channels, const int height, const int width,
-		const bool crop_center, const bool mirror, Dtype* top_data,
-		const Dtype* mean, const Dtype scale, const int size,
-		vector<int>& class_labels, std::vector<int>& imgclass) {
+		const int height, const int width, vector<int>& class_labels,
+		std::vector<int>& imgclass, vector<ImageJob>& jobs) {
 	for (int file_id = 0; file_id < filenames.size(); file_id++) {
 		std::map<string, int>::iterator name_iter = name2id.find(
 				filenames[file_id]);
 		if (name_iter == name2id.end()) {
 			//printf("\nbegin to load:%s%s",filenames[file_id].c_str() , ".jpg");
 			//LOG(INFO)<<("\nbegin to load");
-			getImgData(name2id.size(), rootfolder, filenames[file_id] + ".png",
-					cropsize, channels, height, width, crop_center, mirror,
-					top_data, mean, scale, size);
+			ImageJob job;
+			job.id = name2id.size();
+			job.filename = filenames[file_id] + ".png";
+			job.augment = chooseAugment(Caffe::TRAIN, cropsize, height, width);
+			jobs.push_back(job);
 			//LOG(INFO)<<("\n load suc");
 			int newid = name2id.size();
 			name2id.insert(name_iter,
@@ -138,23 +238,41 @@ void addIfNotExist(std::map<string, int>& name2id, const string& rootfolder,
 
 template<typename Dtype>
 void* DataLayerPrefetch(void* layer_pointer) {
-
 	CHECK(layer_pointer);
 	DataLayer<Dtype>* layer = reinterpret_cast<DataLayer<Dtype>*>(layer_pointer);
 	CHECK(layer);
+	const int depth = layer->batches_.size();
+	for (;;) {
+		pthread_mutex_lock(&layer->queue_mutex_);
+		while (!layer->stop_prefetch_
+				&& layer->filled_ - layer->released_ == depth) {
+			pthread_cond_wait(&layer->slot_free_, &layer->queue_mutex_);
+		}
+		if (layer->stop_prefetch_) {
+			pthread_mutex_unlock(&layer->queue_mutex_);
+			break;
+		}
+		DataLayerBatch<Dtype>* batch =
+				layer->batches_[layer->filled_ % depth].get();
+		pthread_mutex_unlock(&layer->queue_mutex_);
+
+		DataLayerFillBatch(layer, batch);
 
-	if (Caffe::phase() == Caffe::TRAIN && layer->batch_iter_ != 0) {
-//		LOG(INFO) << "Reusing previous batch";
-		layer->batch_iter_--;
-		return (void*) NULL;
+		pthread_mutex_lock(&layer->queue_mutex_);
+		++layer->filled_;
+		pthread_cond_signal(&layer->batch_ready_);
+		pthread_mutex_unlock(&layer->queue_mutex_);
 	}
-//	LOG(INFO) << "Generating new batch";
-	layer->batch_iter_ = layer->layer_param_.batch_iter() - 1;
+	return (void*) NULL;
+}
 
+template<typename Dtype>
+void DataLayerFillBatch(DataLayer<Dtype>* layer, DataLayerBatch<Dtype>* batch) {
+//	LOG(INFO) << "Generating new batch";
 	Datum datum;
-	CHECK(layer->prefetch_data_);
-	CHECK(layer->prefetch_W_);
-	Dtype* top_data = layer->prefetch_data_->mutable_cpu_data();
+	CHECK(batch->data);
+	CHECK(batch->W);
+	Dtype* top_data = batch->data->mutable_cpu_data();
 //	Dtype* top_label = layer->prefetch_label_->mutable_cpu_data();
 	const Dtype scale = layer->layer_param_.scale();
 	const int batchsize = layer->layer_param_.batchsize();
@@ -177,27 +295,50 @@ void* DataLayerPrefetch(void* layer_pointer) {
 	const int size = layer->datum_size_;
 	const Dtype* mean = layer->data_mean_.cpu_data();
 
+	// The images are chosen on this thread and loaded (decoded, cropped,
+	// mean subtracted) by the loader threads.
+	vector<ImageJob> jobs;
+	ImageLoadTask<Dtype> load_task;
+	load_task.jobs = &jobs;
+	load_task.rootfolder = layer->layer_param_.source();
+	load_task.cropsize = cropsize;
+	load_task.channels = channels;
+	load_task.height = height;
+	load_task.width = width;
+	load_task.crop_center = layer->layer_param_.crop_center();
+	load_task.mirror = mirror;
+	load_task.top_data = top_data;
+	load_task.mean = mean;
+	load_task.scale = scale;
+	load_task.size = size;
+	load_task.cache = layer->image_cache_.get();
+	load_task.packed = layer->packed_images_.get();
+	WorkerPool* loader_pool = layer->loader_pool_.get();
+
 //	const std::map<string, int>& class2id = layer->class2id_;
 	// 测试的时候不需要生成triplet
-	if (Caffe::phase() == Caffe::TEST) {
+	if (layer->phase_ == Caffe::TEST) {
 		for (int i = 0;
 				i < batchsize && layer->curIndex < layer->filenames_.size();
 				i++, layer->curIndex++) {
-			getImgData(i, layer->layer_param_.source(),
-					layer->filenames_[layer->curIndex], cropsize, channels,
-					height, width, layer->layer_param_.crop_center(), mirror,
-					top_data, mean, scale, size);
+			ImageJob job;
+			job.id = i;
+			job.filename = layer->filenames_[layer->curIndex];
+			job.augment = chooseAugment(Caffe::TEST, cropsize, height, width);
+			jobs.push_back(job);
 		}
-		return (void*) NULL;
+		loader_pool->Run(jobs.size(), 1, imageLoadWorker<Dtype>, &load_task);
+		return;
 	}
 
 	const vector<string>& class_names = layer->class_names_;
 	const vector<int>& img_counts_per_class = layer->img_counts_per_class_;
-	vector < vector<string> > &triplets = Caffe::mutable_prefetch_triplets(); //Defined in common.hpp
-	vector < vector<int> > &triplets_id = Caffe::mutable_prefetch_triplets_id();
-	std::map<string, int>& name2id = Caffe::mutable_prefetch_name2id();
-	std::vector<int>& imgclass = Caffe::mutable_prefetch_imgclass();
+	vector < vector<string> > &triplets = batch->triplets;
+	vector < vector<int> > &triplets_id = batch->triplets_id;
+	std::map<string, int>& name2id = batch->name2id;
+	std::vector<int>& imgclass = batch->imgclass;
 	name2id.clear();
+	imgclass.clear();
 
 	int img_total = class_per_iter * img_counts_per_class_per_iter;
 
@@ -228,7 +369,7 @@ void* DataLayerPrefetch(void* layer_pointer) {
 	}
 
 	//LOG(INFO)<<"beg_index:"<<layer->beg_index_;
-	memset(top_data, 0, sizeof(Dtype) * layer->prefetch_data_->count());
+	memset(top_data, 0, sizeof(Dtype) * batch->data->count());
 	std::vector<int> class_labels;
 	for (int index_i = 0; index_i < class_per_iter; index_i++) {
 		int class_index = candidate_classes[index_i % candidate_classes.size()];
@@ -268,23 +409,27 @@ void* DataLayerPrefetch(void* layer_pointer) {
 			triplets[index_i * triplet_per_class + triplet_i][2] = o3;
 
 			//LOG(INFO)<<("\nbegin to load triplet data");
-			addIfNotExist(name2id, layer->layer_param_.source(),
+			addIfNotExist(name2id,
 					triplets[index_i * triplet_per_class + triplet_i],
 					triplets_id[index_i * triplet_per_class + triplet_i],
-					cropsize, channels, height, width,
-					layer->layer_param_.crop_center(), mirror, top_data, mean,
-					scale, size, class_labels, imgclass);
+					cropsize, height, width, class_labels, imgclass, jobs);
 			//LOG(INFO)<<("\no problem");
 			class_labels.pop_back();
 		}
 	}
+	loader_pool->Run(jobs.size(), 1, imageLoadWorker<Dtype>, &load_task);
 
 	// LOG(INFO) << "Triplet Generated, computing L";
 
 	// Calculate W matrix(see vision_layers.hpp)
 	int img_num = imgclass.size();
+	// Slots left empty when the triplets share images get a distinct
+	// negative class each, so no padding pair is weighted as same-class.
+	for (int i = img_num; i < img_total; ++i) {
+		imgclass.push_back(-1 - (i - img_num));
+	}
 
-	Dtype* w_data = layer->prefetch_W_->mutable_cpu_data();
+	Dtype* w_data = batch->W->mutable_cpu_data();
 	Dtype sums[img_total + 10];
 	memset(w_data, 0, sizeof(Dtype) * img_total * img_total);
 	memset(sums, 0, sizeof(Dtype) * img_total);
@@ -309,13 +454,85 @@ void* DataLayerPrefetch(void* layer_pointer) {
 
 	}
 
-	return (void*) NULL;
+	if (layer->image_cache_) {
+		const ImageCache& cache = *layer->image_cache_;
+		LOG_EVERY_N(INFO, 100) << "Image cache: " << cache.count()
+				<< " images, " << (cache.size_bytes() >> 20) << " of "
+				<< (cache.capacity_bytes() >> 20) << " MB, " << cache.hits()
+				<< " hits, " << cache.misses() << " misses";
+	}
 }
 
 template<typename Dtype>
 DataLayer<Dtype>::~DataLayer<Dtype>() {
-// Finally, join the thread
+	if (!prefetching_) {
+		return;
+	}
+// Finally, stop and join the thread
+	pthread_mutex_lock(&queue_mutex_);
+	stop_prefetch_ = true;
+	pthread_cond_signal(&slot_free_);
+	pthread_mutex_unlock(&queue_mutex_);
 	CHECK(!pthread_join(thread_, NULL)) << "Pthread joining failed.";
+	pthread_cond_destroy(&slot_free_);
+	pthread_cond_destroy(&batch_ready_);
+	pthread_mutex_destroy(&queue_mutex_);
+}
+
+template<typename Dtype>
+int DataLayer<Dtype>::prefetch_queue_depth() const {
+	pthread_mutex_lock(&queue_mutex_);
+	const int depth = filled_ - popped_;
+	pthread_mutex_unlock(&queue_mutex_);
+	return depth;
+}
+
+template<typename Dtype>
+double DataLayer<Dtype>::prefetch_stall_us() const {
+	pthread_mutex_lock(&queue_mutex_);
+	const double stall_us = stall_us_;
+	pthread_mutex_unlock(&queue_mutex_);
+	return stall_us;
+}
+
+template<typename Dtype>
+const DataLayerBatch<Dtype>& DataLayer<Dtype>::CurrentBatch() {
+	if (uses_left_ == 0) {
+		pthread_mutex_lock(&queue_mutex_);
+		const long long ready = filled_ - popped_;
+		if (ready == 0) {
+			// The solver waits for the loaders.
+			struct timeval start, end;
+			gettimeofday(&start, NULL);
+			while (filled_ == popped_) {
+				pthread_cond_wait(&batch_ready_, &queue_mutex_);
+			}
+			gettimeofday(&end, NULL);
+			stall_us_ += (end.tv_sec - start.tv_sec) * 1e6
+					+ (end.tv_usec - start.tv_usec);
+			++stalls_;
+		}
+		current_ = popped_ % batches_.size();
+		++popped_;
+		LOG_EVERY_N(INFO, 100) << "Prefetch queue: " << ready << " of "
+				<< batches_.size() << " batches ready, " << stalls_
+				<< " stalls, " << stall_us_ / 1000 << " ms waiting in total";
+		pthread_mutex_unlock(&queue_mutex_);
+		// A training batch is served batch_iter times.
+		uses_left_ = phase_ == Caffe::TRAIN ?
+				std::max<int>(this->layer_param_.batch_iter(), 1) : 1;
+	}
+	return *batches_[current_];
+}
+
+template<typename Dtype>
+void DataLayer<Dtype>::FinishBatch() {
+	if (--uses_left_ == 0) {
+		pthread_mutex_lock(&queue_mutex_);
+		++released_;
+		pthread_cond_signal(&slot_free_);
+		pthread_mutex_unlock(&queue_mutex_);
+	}
 }
 
 template<typename Dtype>
@@ -324,12 +541,12 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 	CHECK_EQ(bottom.size(), 0) << "Data Layer takes no input blobs.";
 //	CHECK_EQ(top->size(), 2) << "Data Layer takes two blobs as output.";
 	CHECK_EQ(top->size(), 2) << "Data Layer takes two blobs as output.";
+	phase_ = Caffe::phase();
 
-	CHECK(this->layer_param_.has_img_files()) << "the file contain all the "
+	CHECK(this->layer_param_.has_img_files()
+			|| this->layer_param_.has_manifest()) << "the file contain all the "
 			<< "image names should be specified via attribute 'img_files' in prototxt";
 
-	std::ifstream img_files_if(this->layer_param_.img_files().c_str());
-	CHECK(img_files_if) << "Failed to open " << this->layer_param_.img_files();
 	string line;
 	counts_ = 0;
 	std::map<std::string, int>::iterator name_iter_tmp;
@@ -338,7 +555,39 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 	class_names_.clear();
 	img_counts_per_class_.clear();
 
-	while (img_files_if >> line) {
+	if (this->layer_param_.has_manifest()) {
+		// The compiled list already holds every class and image id, so
+		// nothing is parsed or looked up here.
+		DatasetManifest manifest(this->layer_param_.manifest());
+		if (Caffe::phase() == Caffe::TEST) {
+			vector<int> records;
+			manifest.Select(
+					this->layer_param_.has_id_lower_bound() ?
+							this->layer_param_.id_lower_bound() : INT_MIN,
+					this->layer_param_.has_id_upper_bound() ?
+							this->layer_param_.id_upper_bound() : INT_MAX,
+					&records);
+			filenames_.reserve(records.size());
+			for (int i = 0; i < records.size(); ++i) {
+				filenames_.push_back(manifest.name(records[i]));
+			}
+			counts_ = records.size();
+		} else {
+			for (int c = 0; c < manifest.num_classes(); ++c) {
+				class_names_.push_back(manifest.class_name(c));
+				img_counts_per_class_.push_back(manifest.class_count(c));
+			}
+			counts_ = manifest.count();
+		}
+	}
+
+	std::ifstream img_files_if;
+	if (!this->layer_param_.has_manifest()) {
+		img_files_if.open(this->layer_param_.img_files().c_str());
+		CHECK(img_files_if) << "Failed to open "
+				<< this->layer_param_.img_files();
+	}
+	while (img_files_if.is_open() && img_files_if >> line) {
 		if (line.empty()) {
 			continue;
 		}
@@ -380,7 +629,6 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 
 	int total_img_count = counts_;
 	if (Caffe::phase() == Caffe::TRAIN) {
-		batch_iter_ = 0;
 		beg_index_ = 1;
 
 		// 限制选择图片的数量
@@ -413,17 +661,31 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 		curIndex = 0;
 	}
 
-	cv::Mat img;
-	if (Caffe::phase() == Caffe::TRAIN) {
-		img = cv::imread(
-				this->layer_param_.source() + "/" + class_names_[0] + "_1.png",
-				CV_LOAD_IMAGE_COLOR);
-		LOG(INFO) << "begin to load img"
-				<< this->layer_param_.source() + "/" + class_names_[0]
-						+ "_1.png";
+	int img_height, img_width;
+	if (this->layer_param_.has_packed_source()) {
+		// Raw pixels straight from the mapping; source is not read.
+		packed_images_.reset(
+				new PackedImageFile(this->layer_param_.packed_source()));
+		CHECK_EQ(packed_images_->channels(), 3);
+		img_height = packed_images_->height();
+		img_width = packed_images_->width();
+		LOG(INFO) << "Reading " << packed_images_->count()
+				<< " packed images from " << this->layer_param_.packed_source();
 	} else {
-		img = cv::imread(this->layer_param_.source() + "/" + filenames_[0],
-				CV_LOAD_IMAGE_COLOR);
+		cv::Mat img;
+		if (Caffe::phase() == Caffe::TRAIN) {
+			img = cv::imread(
+					this->layer_param_.source() + "/" + class_names_[0]
+							+ "_1.png", CV_LOAD_IMAGE_COLOR);
+			LOG(INFO) << "begin to load img"
+					<< this->layer_param_.source() + "/" + class_names_[0]
+							+ "_1.png";
+		} else {
+			img = cv::imread(this->layer_param_.source() + "/" + filenames_[0],
+					CV_LOAD_IMAGE_COLOR);
+		}
+		img_height = img.rows;
+		img_width = img.cols;
 	}
 // image
 	int cropsize = this->layer_param_.cropsize();
@@ -437,14 +699,11 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 		cropsize_w = cropsize;
 // 测试的时候，不需要生成triplet，只需要计算所有图片的特征
 	int batchsize = this->layer_param_.batchsize();
+	int num_triplets = 0;
 	if (Caffe::phase() == Caffe::TRAIN) {
 		batchsize = this->layer_param_.class_per_iter()
 				* this->layer_param_.triplet_per_class();
-
-		Caffe::mutable_prefetch_triplets() = vector<vector<string> >(batchsize,
-				vector<string>(3, string()));
-		Caffe::mutable_prefetch_triplets_id() = vector<vector<int> >(batchsize,
-				vector<int>(3, 0));
+		num_triplets = batchsize;
 
 		batchsize *= 3;
 		LOG(INFO) << "total_img_count: " << total_img_count << ", batchsize: "
@@ -475,14 +734,23 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 
 	if (cropsize > 0) {
 		(*top)[0]->Reshape(batchsize, 3, cropsize_h, cropsize_w);
-		prefetch_data_.reset(
-				new Blob<Dtype>(batchsize, 3, cropsize_h, cropsize_w));
 	} else {
-		(*top)[0]->Reshape(batchsize, 3, img.rows, img.cols);
-		prefetch_data_.reset(new Blob<Dtype>(batchsize, 3, img.rows, img.cols));
+		(*top)[0]->Reshape(batchsize, 3, img_height, img_width);
+	}
+	// The ring of batches the prefetch thread fills ahead of Forward.
+	const int depth = std::max<int>(this->layer_param_.prefetch_depth(), 1);
+	batches_.resize(depth);
+	for (int i = 0; i < depth; ++i) {
+		batches_[i].reset(new DataLayerBatch<Dtype>());
+		batches_[i]->data.reset(new Blob<Dtype>((*top)[0]->num(),
+				(*top)[0]->channels(), (*top)[0]->height(),
+				(*top)[0]->width()));
+		batches_[i]->W.reset(new Blob<Dtype>(1, 1, batchsize, batchsize));
+		batches_[i]->triplets = vector<vector<string> >(num_triplets,
+				vector<string>(3, string()));
+		batches_[i]->triplets_id = vector<vector<int> >(num_triplets,
+				vector<int>(3, 0));
 	}
-
-	prefetch_W_.reset(new Blob<Dtype>(1, 1, batchsize, batchsize));
 
 	LOG(INFO) << "l_matrix size: " << batchsize << ", " << batchsize;
 	(*top)[1]->Reshape(1, 1, batchsize, batchsize);
@@ -492,12 +760,19 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 			<< (*top)[0]->width();
 
 	datum_channels_ = 3;
-	datum_height_ = img.rows;
-	datum_width_ = img.cols;
-	datum_size_ = 3 * img.rows * img.cols;
+	datum_height_ = img_height;
+	datum_width_ = img_width;
+	datum_size_ = 3 * img_height * img_width;
 
 	LOG(INFO) << datum_height_ << " " << cropsize << "!!";
 
+	if (this->layer_param_.image_cache_mb() > 0 && !packed_images_) {
+		image_cache_.reset(new ImageCache(
+				static_cast<size_t>(this->layer_param_.image_cache_mb()) << 20));
+		LOG(INFO) << "Caching up to " << this->layer_param_.image_cache_mb()
+				<< " MB of decoded images";
+	}
+
 	CHECK_GE(datum_height_, cropsize);
 	CHECK_GE(datum_width_, cropsize);
 // check if we want to have mean
@@ -519,15 +794,32 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 // cpu_data calls so that the prefetch thread does not accidentally make
 // simultaneous cudaMalloc calls when the main thread is running. In some
 // GPUs this seems to cause failures if we do not so.
-	prefetch_data_->mutable_cpu_data();
-	prefetch_W_->mutable_cpu_data();
+	for (int i = 0; i < depth; ++i) {
+		batches_[i]->data->mutable_cpu_data();
+		batches_[i]->W->mutable_cpu_data();
+	}
 //	prefetch_label_->mutable_cpu_data();
 	data_mean_.cpu_data();
-	LOG(INFO) << "Initializing prefetch";
+	LOG(INFO) << "Initializing prefetch, " << depth << " batches deep";
+	pthread_mutex_init(&queue_mutex_, NULL);
+	pthread_cond_init(&batch_ready_, NULL);
+	pthread_cond_init(&slot_free_, NULL);
+	filled_ = popped_ = released_ = 0;
+	stop_prefetch_ = false;
+	stall_us_ = 0;
+	stalls_ = 0;
+	current_ = -1;
+	uses_left_ = 0;
+	// The loader threads live as long as the prefetch thread, which hands
+	// them the images of every batch.
+	loader_pool_.reset(new WorkerPool(this->layer_param_.loader_threads()));
+	LOG(INFO) << "Loading images on " << loader_pool_->num_threads()
+			<< " threads";
 	CHECK(
 			!pthread_create(&thread_, NULL, DataLayerPrefetch<Dtype>,
 					reinterpret_cast<void*>(this)))
 			<< "Pthread execution failed.";
+	prefetching_ = true;
 	LOG(INFO) << "Prefetch initialized.";
 
 // output info
@@ -541,66 +833,60 @@ template<typename Dtype>
 void DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 		vector<Blob<Dtype>*>* top) {
 	// LOG(INFO) << "Passing data to next layer in CPU mode";
-	// LOG(INFO) << "Joining prefetch thread: " << thread_;
-	CHECK(!pthread_join(thread_, NULL)) << "Pthread joining failed.";
+	const DataLayerBatch<Dtype>& batch = CurrentBatch();
 	// CHECK((*top)[1]) << "L-Matrix Blob error";
 
 	// LOG(INFO) << "l_matrix layer: " << (*top)[1]->height() << ' ' << (*top)[1]->width();
 // Copy the data
-	memcpy((*top)[0]->mutable_cpu_data(), prefetch_data_->cpu_data(),
-			sizeof(Dtype) * prefetch_data_->count());
+	memcpy((*top)[0]->mutable_cpu_data(), batch.data->cpu_data(),
+			sizeof(Dtype) * batch.data->count());
 
-	memcpy((*top)[1]->mutable_cpu_data(), prefetch_W_->cpu_data(),
-			sizeof(Dtype) * prefetch_W_->count());
+	memcpy((*top)[1]->mutable_cpu_data(), batch.W->cpu_data(),
+			sizeof(Dtype) * batch.W->count());
 
 	// LOG(INFO) << "Data passed to upper layers";
 
-	Caffe::mutable_triplets() = Caffe::mutable_prefetch_triplets();
-	Caffe::mutable_triplets_id() = Caffe::mutable_prefetch_triplets_id();
-	Caffe::mutable_name2id() = Caffe::mutable_prefetch_name2id();
-
-// Start a new prefetch thread
-	CHECK(
-			!pthread_create(&thread_, NULL, DataLayerPrefetch<Dtype>,
-					reinterpret_cast<void*>(this)))
-			<< "Pthread execution failed.";
+	// The triplets are only sampled for training; skipping the copy in the
+	// test phase also lets several test nets run on different threads.
+	if (phase_ == Caffe::TRAIN) {
+		Caffe::mutable_triplets() = batch.triplets;
+		Caffe::mutable_triplets_id() = batch.triplets_id;
+		Caffe::mutable_name2id() = batch.name2id;
+	}
+	FinishBatch();
 }
 
 template<typename Dtype>
 void DataLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
 		vector<Blob<Dtype>*>* top) {
 	// LOG(INFO) << "Passing data to next layer in GPU mode";
-// First, join the thread
-
-	CHECK(!pthread_join(thread_, NULL)) << "Pthread joining failed.";
-//	 DataLayerPrefetch<Dtype>(this);
+// First, take a ready batch
+	const DataLayerBatch<Dtype>& batch = CurrentBatch();
 // Copy the data
-	// LOG(INFO) << "Joining prefetch thread: " << thread_;
 	// CHECK((*top)[1]) << "L-Matrix Blob error";
 
 	// LOG(INFO) << "l_matrix layer: " << (*top)[1]->height() << ' ' << (*top)[1]->width();
 	CUDA_CHECK(
-			cudaMemcpy((*top)[0]->mutable_gpu_data(),
-					prefetch_data_->cpu_data(),
-					sizeof(Dtype) * prefetch_data_->count(),
+			cudaMemcpy((*top)[0]->mutable_gpu_data(), batch.data->cpu_data(),
+					sizeof(Dtype) * batch.data->count(),
 					cudaMemcpyHostToDevice));
 	CUDA_CHECK(
-			cudaMemcpy((*top)[1]->mutable_gpu_data(), prefetch_W_->cpu_data(),
-					sizeof(Dtype) * prefetch_W_->count(),
+			cudaMemcpy((*top)[1]->mutable_gpu_data(), batch.W->cpu_data(),
+					sizeof(Dtype) * batch.W->count(),
 					cudaMemcpyHostToDevice));
 
 	// BlobProto proto;
-	// prefetch_W_->ToProto(&proto);
+	// batch.W->ToProto(&proto);
 	// WriteProtoToBinaryFile(proto, "w_matrix.p");
 
-	Caffe::mutable_triplets() = Caffe::mutable_prefetch_triplets();
-	Caffe::mutable_triplets_id() = Caffe::mutable_prefetch_triplets_id();
-	Caffe::mutable_name2id() = Caffe::mutable_prefetch_name2id();
-
-	CHECK(
-			!pthread_create(&thread_, NULL, DataLayerPrefetch<Dtype>,
-					reinterpret_cast<void*>(this)))
-			<< "Pthread execution failed.";
+	// The triplets are only sampled for training; skipping the copy in the
+	// test phase also lets several test nets run on different threads.
+	if (phase_ == Caffe::TRAIN) {
+		Caffe::mutable_triplets() = batch.triplets;
+		Caffe::mutable_triplets_id() = batch.triplets_id;
+		Caffe::mutable_name2id() = batch.name2id;
+	}
+	FinishBatch();
 }
 
 // The backward operations are dummy - they do not carry any computation.
@@ -0,0 +1,122 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/asymmetric_distance.hpp"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/hash_eval.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class AsymmetricDistanceTest: public ::testing::Test {
+protected:
+	virtual void SetUp() {
+		srand(1701);
+	}
+	static float Uniform() {
+		return 2.f * rand() / RAND_MAX - 1.f;
+	}
+};
+
+TEST_F(AsymmetricDistanceTest, TestMatchesDefinition) {
+	const int dim = 80, nbits = 70;
+	vector<float> weights(nbits), query(dim), feature(dim);
+	vector<int> bit_order(nbits);
+	for (int b = 0; b < nbits; ++b) {
+		weights[b] = Uniform();
+		bit_order[b] = dim - 1 - b;
+	}
+	for (int i = 0; i < dim; ++i) {
+		query[i] = Uniform();
+	}
+	HashCodeStore store(nbits);
+	for (int n = 0; n < 10; ++n) {
+		for (int i = 0; i < dim; ++i) {
+			feature[i] = Uniform();
+		}
+		store.Append(&feature[0], &bit_order[0]);
+	}
+	for (int len = 1; len <= nbits; len += 23) {
+		AsymmetricDistance distance(&weights[0], len);
+		distance.SetQuery(&query[0], &bit_order[0]);
+		for (int n = 0; n < store.num(); ++n) {
+			double expected = 0;
+			for (int b = 0; b < len; ++b) {
+				const int s = ((store.code(n)[b / 64] >> (b % 64)) & 1) ? 1 : -1;
+				const double diff = query[bit_order[b]] - s;
+				expected += std::fabs(weights[b]) * diff * diff;
+			}
+			EXPECT_NEAR(distance(store.code(n)), expected, 1e-3);
+		}
+	}
+}
+
+TEST_F(AsymmetricDistanceTest, TestRerank) {
+	const int nbits = 4;
+	float codes[4][nbits] = { { 1, 1, 1, 1 }, { -1, 1, 1, 1 },
+			{ 1, 1, 1, -1 }, { -1, -1, -1, -1 } };
+	HashCodeStore store(nbits);
+	store.AppendBatch(&codes[0][0], 4, nbits, (const int*) NULL);
+	// Bit 0 is barely positive, bit 3 strongly so: flipping bit 0 costs less.
+	float query[nbits] = { 0.1, 1, 1, 0.9 };
+	AsymmetricDistance distance((const float*) NULL, nbits);
+	distance.SetQuery(query, (const int*) NULL);
+	vector<int> ids;
+	for (int i = 3; i >= 0; --i) {
+		ids.push_back(i);
+	}
+	vector<float> distances;
+	distance.Rerank(store, 3, &ids, &distances);
+	ASSERT_EQ(ids.size(), 3);
+	EXPECT_EQ(ids[0], 0);
+	EXPECT_EQ(ids[1], 1);
+	EXPECT_EQ(ids[2], 2);
+	EXPECT_LT(distances[0], distances[1]);
+	EXPECT_LT(distances[1], distances[2]);
+}
+
+TEST_F(AsymmetricDistanceTest, TestBinaryQueriesMatchHamming) {
+	// With +-1 queries and unit weights the distance is 4 x Hamming, so the
+	// tie groups and every metric match the Hamming evaluation.
+	const int nbits = 10;
+	HashCodeStore queries(nbits), database(nbits);
+	vector<float> query_features;
+	vector<int> query_classes, database_classes;
+	vector<int> relevant_per_class(3, 0);
+	float feature[nbits];
+	for (int i = 0; i < 150; ++i) {
+		for (int b = 0; b < nbits; ++b) {
+			feature[b] = (rand() % 2) ? 1 : -1;
+		}
+		if (i < 30) {
+			queries.Append(feature, (const int*) NULL);
+			query_features.insert(query_features.end(), feature, feature + nbits);
+			query_classes.push_back(i % 3);
+		} else {
+			database.Append(feature, (const int*) NULL);
+			database_classes.push_back(i % 3);
+			relevant_per_class[i % 3]++;
+		}
+	}
+	vector<int> precision_ks(1, 10), cmc_ranks(1, 5);
+	RetrievalMetrics metrics(precision_ks, -1, cmc_ranks);
+	vector<double> hamming, asymmetric;
+	EvaluateQueries(HammingMetric(nbits), queries, &query_classes[0], database,
+			&database_classes[0], &relevant_per_class[0], metrics, 2, &hamming);
+	AsymmetricDistance distance((const float*) NULL, nbits);
+	EvaluateAsymmetric(distance, &query_features[0], queries.num(), nbits,
+			(const int*) NULL, &query_classes[0], database, &database_classes[0],
+			&relevant_per_class[0], metrics, 3, &asymmetric);
+	ASSERT_EQ(asymmetric.size(), hamming.size());
+	for (size_t i = 0; i < hamming.size(); ++i) {
+		EXPECT_NEAR(asymmetric[i], hamming[i], 1e-9);
+	}
+}
+
+}  // namespace caffe
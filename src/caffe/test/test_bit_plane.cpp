@@ -0,0 +1,131 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/bit_plane.hpp"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/mih_index.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class BitPlaneTest: public ::testing::Test {
+protected:
+	virtual void SetUp() {
+		srand(1701);
+	}
+	// num random codes; every tenth one is a noisy copy of an earlier code,
+	// so queries have close neighbours.
+	void FillStore(const int num, HashCodeStore* store) {
+		const int nbits = store->nbits();
+		vector<float> feature(nbits);
+		vector<vector<float> > features;
+		for (int i = 0; i < num; ++i) {
+			if (i % 10 == 9) {
+				feature = features[rand() % features.size()];
+				for (int b = 0; b < nbits; ++b) {
+					if (rand() % 16 == 0) {
+						feature[b] = -feature[b];
+					}
+				}
+			} else {
+				for (int b = 0; b < nbits; ++b) {
+					feature[b] = (rand() % 2) ? 1 : -1;
+				}
+			}
+			features.push_back(feature);
+			store->Append(&feature[0], (const int*) NULL);
+		}
+	}
+	void BruteForce(const HashCodeStore& store, const int* weights,
+			const uint64_t* query, const int k, vector<int>* ids,
+			vector<int>* distances) {
+		vector<std::pair<int, int> > scored(store.num());
+		for (int i = 0; i < store.num(); ++i) {
+			int dist = 0;
+			for (int b = 0; b < store.nbits(); ++b) {
+				if (((store.code(i)[b / 64] ^ query[b / 64]) >> (b % 64)) & 1) {
+					dist += weights ? weights[b] : 1;
+				}
+			}
+			scored[i] = std::make_pair(dist, i);
+		}
+		std::sort(scored.begin(), scored.end());
+		ids->clear();
+		distances->clear();
+		for (int i = 0; i < std::min(k, store.num()); ++i) {
+			distances->push_back(scored[i].first);
+			ids->push_back(scored[i].second);
+		}
+	}
+};
+
+TEST_F(BitPlaneTest, TestLayout) {
+	HashCodeStore store(70);
+	FillStore(130, &store);
+	BitPlaneStore planes;
+	planes.Build(store);
+	EXPECT_EQ(planes.blocks(), 3);
+	for (int i = 0; i < store.num(); ++i) {
+		for (int b = 0; b < store.nbits(); ++b) {
+			EXPECT_EQ((planes.plane(b)[i / 64] >> (i % 64)) & 1,
+					(store.code(i)[b / 64] >> (b % 64)) & 1);
+		}
+	}
+}
+
+TEST_F(BitPlaneTest, TestMatchesMultiIndexHash) {
+	const int nbits_list[2] = { 16, 130 };
+	for (int n = 0; n < 2; ++n) {
+		HashCodeStore store(nbits_list[n]);
+		FillStore(1000, &store);
+		BitPlaneStore planes;
+		planes.Build(store);
+		MultiIndexHash index;
+		index.Build(store);
+		vector<int> ids, distances, expected_ids, expected_distances;
+		const int ks[3] = { 1, 10, 1200 };
+		for (int q = 0; q < 40; ++q) {
+			for (int i = 0; i < 3; ++i) {
+				planes.KnnSearch(store.code(q * 23), ks[i], &ids, &distances);
+				index.KnnSearch(store.code(q * 23), ks[i], &expected_ids,
+						&expected_distances);
+				EXPECT_EQ(ids, expected_ids);
+				EXPECT_EQ(distances, expected_distances);
+			}
+		}
+	}
+}
+
+TEST_F(BitPlaneTest, TestWeightedPrunesPlanes) {
+	// Weights that fall with importance, as the ranked bits do.
+	const int nbits = 64;
+	vector<int> weights(nbits);
+	for (int b = 0; b < nbits; ++b) {
+		weights[b] = std::max(64 >> (b / 8), 1);
+	}
+	HashCodeStore store(nbits);
+	FillStore(5000, &store);
+	BitPlaneStore planes;
+	planes.Build(store, &weights[0]);
+	vector<int> ids, distances, expected_ids, expected_distances;
+	float scanned = 0, total_scanned = 0;
+	for (int q = 0; q < 40; ++q) {
+		const uint64_t* query = store.code(q * 101 + 9);
+		planes.KnnSearch(query, 5, &ids, &distances, &scanned);
+		BruteForce(store, &weights[0], query, 5, &expected_ids,
+				&expected_distances);
+		EXPECT_EQ(ids, expected_ids);
+		EXPECT_EQ(distances, expected_distances);
+		total_scanned += scanned;
+	}
+	EXPECT_LT(total_scanned / 40, 0.5);
+}
+
+}  // namespace caffe
@@ -0,0 +1,107 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/code_file.hpp"
+#include "caffe/util/hash_code.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class CodeFileTest: public ::testing::Test {
+protected:
+	virtual void SetUp() {
+		char name[] = "/tmp/code_file_XXXXXX";
+		close(mkstemp(name));
+		filename = name;
+	}
+	virtual void TearDown() {
+		remove(filename.c_str());
+	}
+	string filename;
+};
+
+TEST_F(CodeFileTest, TestPackedRoundTrip) {
+	const int nbits = 70;
+	const int num = 5;
+	vector<float> features(num * nbits);
+	for (int i = 0; i < num * nbits; ++i) {
+		features[i] = ((i * 7) % 5 < 2) ? 0.5 : -0.5;
+	}
+	vector<int> bit_order(nbits);
+	vector<float> weights(nbits);
+	for (int b = 0; b < nbits; ++b) {
+		bit_order[b] = nbits - 1 - b;
+		weights[b] = 0.25 * b;
+	}
+	HashCodeStore store(nbits);
+	store.AppendBatch(&features[0], num, nbits, &bit_order[0]);
+	CodeFileWriter writer;
+	writer.Open(filename, CODE_FILE_PACKED_BITS, nbits, nbits, &bit_order[0],
+			&weights[0]);
+	for (int i = 0; i < num; ++i) {
+		writer.Append(store.code(i), i % 2 ? "odd.jpg" : "");
+	}
+	writer.Close();
+	EXPECT_EQ(writer.count(), num);
+
+	CodeFile file(filename);
+	EXPECT_EQ(file.type(), CODE_FILE_PACKED_BITS);
+	EXPECT_EQ(file.count(), num);
+	EXPECT_EQ(file.dim(), nbits);
+	EXPECT_EQ(file.code_bits(), nbits);
+	ASSERT_TRUE(file.weights() != NULL);
+	for (int b = 0; b < nbits; ++b) {
+		EXPECT_EQ(file.bit_order()[b], bit_order[b]);
+		EXPECT_EQ(file.weights()[b], weights[b]);
+	}
+	vector<string> names;
+	file.names(&names);
+	ASSERT_EQ(names.size(), num);
+	for (int i = 0; i < num; ++i) {
+		EXPECT_EQ(names[i], i % 2 ? "odd.jpg" : "");
+	}
+	// Attaching serves the mapped codes without a copy.
+	HashCodeStore mapped;
+	mapped.Attach(file.codes(), file.count(), file.code_bits());
+	EXPECT_EQ(mapped.cpu_data(), file.codes());
+	for (int i = 0; i < num; ++i) {
+		EXPECT_EQ(HammingDistance(mapped.code(i), store.code(i), store.words()),
+				0);
+	}
+}
+
+TEST_F(CodeFileTest, TestFloatRoundTrip) {
+	const int dim = 3;
+	const float features[2 * dim] = { 0.1, -0.2, 0.3, -0.4, 0.5, -0.6 };
+	CodeFileWriter writer;
+	writer.Open(filename, CODE_FILE_FLOAT, dim, 2, NULL, NULL);
+	writer.Append(features, "a.jpg");
+	writer.Append(features + dim, "bb.jpg");
+	writer.Close();
+
+	CodeFile file(filename);
+	EXPECT_EQ(file.type(), CODE_FILE_FLOAT);
+	EXPECT_EQ(file.count(), 2);
+	EXPECT_EQ(file.dim(), dim);
+	EXPECT_EQ(file.code_bits(), 2);
+	EXPECT_TRUE(file.weights() == NULL);
+	for (int i = 0; i < dim; ++i) {
+		EXPECT_EQ(file.bit_order()[i], i);
+	}
+	for (int i = 0; i < 2 * dim; ++i) {
+		EXPECT_EQ(file.features()[i], features[i]);
+	}
+	EXPECT_EQ(file.name(0), "a.jpg");
+	EXPECT_EQ(file.name(1), "bb.jpg");
+}
+
+}  // namespace caffe
@@ -0,0 +1,84 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/dataset_manifest.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DatasetManifestTest: public ::testing::Test {
+protected:
+	virtual void SetUp() {
+		char list_name[] = "/tmp/manifest_list_XXXXXX";
+		char manifest_name[] = "/tmp/manifest_XXXXXX";
+		close(mkstemp(list_name));
+		close(mkstemp(manifest_name));
+		list_file_ = list_name;
+		manifest_file_ = manifest_name;
+		std::ofstream list(list_file_.c_str());
+		list << "cat_3.png\ndog_1.png\ncat_12.png\n\nbig_bird_7.jpg dog_5.png\n"
+				<< "bird_2.png\n";
+	}
+	virtual void TearDown() {
+		remove(list_file_.c_str());
+		remove(manifest_file_.c_str());
+	}
+	string list_file_;
+	string manifest_file_;
+};
+
+TEST_F(DatasetManifestTest, TestParseImageName) {
+	string class_name;
+	int image_id;
+	ParseImageName("big_bird_17.png", &class_name, &image_id);
+	EXPECT_EQ(class_name, "big_bird");
+	EXPECT_EQ(image_id, 17);
+}
+
+TEST_F(DatasetManifestTest, TestRoundTrip) {
+	EXPECT_EQ(CompileDatasetManifest(list_file_, manifest_file_), 6);
+	DatasetManifest manifest(manifest_file_);
+	ASSERT_EQ(manifest.count(), 6);
+	ASSERT_EQ(manifest.num_classes(), 4);
+	const char* names[6] = { "cat_3.png", "dog_1.png", "cat_12.png",
+			"big_bird_7.jpg", "dog_5.png", "bird_2.png" };
+	const int class_ids[6] = { 0, 1, 0, 2, 1, 3 };
+	const int image_ids[6] = { 3, 1, 12, 7, 5, 2 };
+	for (int i = 0; i < 6; ++i) {
+		EXPECT_EQ(manifest.name(i), names[i]);
+		EXPECT_EQ(manifest.class_id(i), class_ids[i]);
+		EXPECT_EQ(manifest.image_id(i), image_ids[i]);
+	}
+	const char* class_names[4] = { "cat", "dog", "big_bird", "bird" };
+	const int class_counts[4] = { 2, 2, 1, 1 };
+	for (int c = 0; c < 4; ++c) {
+		EXPECT_EQ(manifest.class_name(c), class_names[c]);
+		EXPECT_EQ(manifest.class_count(c), class_counts[c]);
+	}
+}
+
+TEST_F(DatasetManifestTest, TestSelectAndAssignClasses) {
+	CompileDatasetManifest(list_file_, manifest_file_);
+	DatasetManifest manifest(manifest_file_);
+	vector<int> records;
+	manifest.Select(2, 7, &records);
+	const int expected[4] = { 0, 3, 4, 5 };
+	EXPECT_EQ(records, vector<int>(expected, expected + 4));
+	vector<int> class_ids, count_per_class;
+	manifest.AssignClasses(records, &class_ids, &count_per_class);
+	// cat, big_bird, dog, bird renumbered in order of first appearance.
+	const int expected_ids[4] = { 0, 1, 2, 3 };
+	EXPECT_EQ(class_ids, vector<int>(expected_ids, expected_ids + 4));
+	EXPECT_EQ(count_per_class, vector<int>(4, 1));
+}
+
+}  // namespace caffe
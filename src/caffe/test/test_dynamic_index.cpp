@@ -0,0 +1,147 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <utility>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/dynamic_index.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DynamicHashIndexTest: public ::testing::Test {
+protected:
+	DynamicHashIndexTest() :
+			nbits_(40), index_(40) {
+		srand(1701);
+	}
+	vector<uint64_t> RandomCode() {
+		// Few distinct codes so that there are plenty of distance ties.
+		vector<uint64_t> code(1, 0);
+		for (int b = 0; b < nbits_; ++b) {
+			if (rand() % 4 == 0) {
+				code[0] |= uint64_t(1) << b;
+			}
+		}
+		return code;
+	}
+	void Insert(const int key) {
+		vector<uint64_t> code = RandomCode();
+		index_.Insert(key, &code[0]);
+		reference_[key] = code;
+	}
+	void Remove(const int key) {
+		EXPECT_EQ(index_.Remove(key), reference_.erase(key) == 1);
+	}
+	void CheckKnn(const int k) {
+		EXPECT_EQ(index_.size(), reference_.size());
+		for (int q = 0; q < 5; ++q) {
+			vector<uint64_t> query = RandomCode();
+			vector<std::pair<int, int> > expected;
+			for (std::map<int, vector<uint64_t> >::iterator it =
+					reference_.begin(); it != reference_.end(); ++it) {
+				expected.push_back(
+						std::make_pair(HammingDistance(&it->second[0], &query[0], 1),
+								it->first));
+			}
+			std::sort(expected.begin(), expected.end());
+			expected.resize(std::min<int>(k, expected.size()));
+			vector<int> keys, distances;
+			index_.KnnSearch(&query[0], k, &keys, &distances);
+			ASSERT_EQ(keys.size(), expected.size());
+			for (size_t i = 0; i < keys.size(); ++i) {
+				EXPECT_EQ(distances[i], expected[i].first);
+				EXPECT_EQ(keys[i], expected[i].second);
+			}
+		}
+	}
+
+	int nbits_;
+	DynamicHashIndex index_;
+	std::map<int, vector<uint64_t> > reference_;
+};
+
+TEST_F(DynamicHashIndexTest, TestInsertRemoveCompact) {
+	CheckKnn(10);
+	for (int round = 0; round < 4; ++round) {
+		for (int i = 0; i < 300; ++i) {
+			const int key = rand() % 500;
+			if (rand() % 3 == 0) {
+				Remove(key);
+			} else {
+				// Re-inserting a live key replaces its code.
+				Insert(key);
+			}
+		}
+		CheckKnn(1);
+		CheckKnn(25);
+		index_.Compact();
+		EXPECT_EQ(index_.pending(), 0);
+		CheckKnn(25);
+		CheckKnn(1000);
+	}
+}
+
+struct ReaderArgs {
+	DynamicHashIndex* index;
+	int* stop;
+	int searches;
+	bool sorted;
+};
+
+static void* SearchLoop(void* arg) {
+	ReaderArgs* args = reinterpret_cast<ReaderArgs*>(arg);
+	uint64_t query = 0x5555555555ULL;
+	vector<int> keys, distances;
+	while (!__sync_fetch_and_add(args->stop, 0)) {
+		args->index->KnnSearch(&query, 20, &keys, &distances);
+		for (size_t i = 1; i < keys.size(); ++i) {
+			args->sorted &= distances[i - 1] < distances[i]
+					|| (distances[i - 1] == distances[i] && keys[i - 1] < keys[i]);
+		}
+		++args->searches;
+	}
+	return NULL;
+}
+
+TEST_F(DynamicHashIndexTest, TestBackgroundCompaction) {
+	index_.StartCompactionThread(64);
+	int stop = 0;
+	ReaderArgs args[2];
+	pthread_t readers[2];
+	for (int i = 0; i < 2; ++i) {
+		args[i].index = &index_;
+		args[i].stop = &stop;
+		args[i].searches = 0;
+		args[i].sorted = true;
+		ASSERT_EQ(pthread_create(&readers[i], NULL, SearchLoop, &args[i]), 0);
+	}
+	for (int i = 0; i < 5000; ++i) {
+		const int key = rand() % 2000;
+		if (rand() % 4 == 0) {
+			Remove(key);
+		} else {
+			Insert(key);
+		}
+	}
+	__sync_fetch_and_add(&stop, 1);
+	for (int i = 0; i < 2; ++i) {
+		pthread_join(readers[i], NULL);
+		EXPECT_TRUE(args[i].sorted);
+	}
+	index_.StopCompactionThread();
+	// The background compactions kept the pending work bounded.
+	EXPECT_LE(index_.pending(), std::max(64, index_.size() / 8) + 1);
+	CheckKnn(30);
+	index_.Compact();
+	CheckKnn(30);
+}
+
+}  // namespace caffe
@@ -0,0 +1,107 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/feature_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class FeatureCacheTest: public ::testing::Test {
+protected:
+	virtual void SetUp() {
+		char directory[] = "/tmp/feature_cache_XXXXXX";
+		CHECK(mkdtemp(directory));
+		directory_ = directory;
+		files_.push_back(directory_ + "/snapshot");
+		files_.push_back(directory_ + "/net.prototxt");
+		WriteFile(files_[0], "weights");
+		WriteFile(files_[1], "layers {}");
+	}
+	virtual void TearDown() {
+		for (size_t i = 0; i < files_.size(); ++i) {
+			remove(files_[i].c_str());
+		}
+		rmdir(directory_.c_str());
+	}
+	void WriteFile(const string& filename, const string& content) {
+		std::ofstream file(filename.c_str());
+		file << content;
+	}
+	string directory_;
+	vector<string> files_;
+};
+
+TEST_F(FeatureCacheTest, TestKey) {
+	const string key = FeatureCache::Key(files_);
+	EXPECT_EQ(key.size(), 16);
+	EXPECT_EQ(FeatureCache::Key(files_), key);
+	WriteFile(files_[0], "weightz");
+	EXPECT_NE(FeatureCache::Key(files_), key);
+	// Moving content from one file to the other changes the key too.
+	WriteFile(files_[0], "weights layers");
+	WriteFile(files_[1], " {}");
+	EXPECT_NE(FeatureCache::Key(files_), key);
+}
+
+TEST_F(FeatureCacheTest, TestLookup) {
+	FeatureCache cache(directory_);
+	const string key = FeatureCache::Key(files_);
+	CodeFile file;
+	EXPECT_FALSE(cache.Lookup(key, &file));
+
+	const float feature[2] = { 0.5, -0.5 };
+	const string pending = cache.PendingPath(key);
+	CodeFileWriter writer;
+	writer.Open(pending, CODE_FILE_FLOAT, 2, 2, NULL, NULL);
+	writer.Append(feature, "a.png");
+	writer.Close();
+	EXPECT_FALSE(cache.Lookup(key, &file));
+	cache.Commit(pending, key);
+	files_.push_back(cache.EntryPath(key));
+
+	ASSERT_TRUE(cache.Lookup(key, &file));
+	EXPECT_EQ(file.count(), 1);
+	EXPECT_EQ(file.features()[1], -0.5);
+	EXPECT_EQ(file.name(0), "a.png");
+}
+
+TEST_F(FeatureCacheTest, TestSameKeyTwice) {
+	FeatureCache cache(directory_);
+	const string key = FeatureCache::Key(files_);
+	// Two writers of one key, interleaved as the query and database
+	// extractions of an all-vs-all run are.
+	const string pending[2] = { cache.PendingPath(key),
+			cache.PendingPath(key) };
+	EXPECT_NE(pending[0], pending[1]);
+	CodeFileWriter writers[2];
+	for (int w = 0; w < 2; ++w) {
+		writers[w].Open(pending[w], CODE_FILE_FLOAT, 2, 2, NULL, NULL);
+	}
+	const float features[2][2] = { { 1, 2 }, { 3, 4 } };
+	for (int w = 0; w < 2; ++w) {
+		writers[w].Append(features[w], w ? "b.png" : "a.png");
+	}
+	for (int w = 0; w < 2; ++w) {
+		writers[w].Close();
+		cache.Commit(pending[w], key);
+	}
+	files_.push_back(cache.EntryPath(key));
+	EXPECT_NE(access(pending[0].c_str(), F_OK), 0);
+	EXPECT_NE(access(pending[1].c_str(), F_OK), 0);
+
+	CodeFile file;
+	ASSERT_TRUE(cache.Lookup(key, &file));
+	EXPECT_EQ(file.count(), 1);
+	EXPECT_EQ(file.features()[0], 3);
+	EXPECT_EQ(file.name(0), "b.png");
+}
+
+}  // namespace caffe
@@ -0,0 +1,114 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <cstdlib>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/float_distance.hpp"
+#include "caffe/util/retrieval_metrics.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class FloatDistanceTest: public ::testing::Test {
+protected:
+	virtual void SetUp() {
+		srand(1701);
+	}
+};
+
+TEST_F(FloatDistanceTest, TestGatherAndDistances) {
+	const int dim = 20, ndims = 7, num_queries = 5, num_database = 90;
+	vector<float> queries(num_queries * dim), database(num_database * dim);
+	for (size_t i = 0; i < queries.size(); ++i) {
+		queries[i] = 2.f * rand() / RAND_MAX - 1.f;
+	}
+	for (size_t i = 0; i < database.size(); ++i) {
+		database[i] = 2.f * rand() / RAND_MAX - 1.f;
+	}
+	int dims[ndims] = { 19, 3, 0, 11, 7, 8, 15 };
+	vector<float> gathered_queries(num_queries * ndims);
+	vector<float> gathered_database(num_database * ndims);
+	GatherDimensions(&queries[0], num_queries, dim, dims, ndims,
+			&gathered_queries[0]);
+	GatherDimensions(&database[0], num_database, dim, dims, ndims,
+			&gathered_database[0]);
+	EXPECT_EQ(gathered_database[2 * ndims + 1], database[2 * dim + 3]);
+	vector<float> query_norms(num_queries), database_norms(num_database);
+	SquaredNorms(&gathered_queries[0], num_queries, ndims, &query_norms[0]);
+	SquaredNorms(&gathered_database[0], num_database, ndims,
+			&database_norms[0]);
+	vector<float> distances(num_queries * num_database);
+	SquaredL2Distances(&gathered_queries[0], &query_norms[0], num_queries,
+			&gathered_database[0], &database_norms[0], num_database, ndims,
+			&distances[0]);
+	for (int i = 0; i < num_queries; ++i) {
+		for (int j = 0; j < num_database; ++j) {
+			float expected = 0;
+			for (int d = 0; d < ndims; ++d) {
+				const float diff = queries[i * dim + dims[d]]
+						- database[j * dim + dims[d]];
+				expected += diff * diff;
+			}
+			EXPECT_NEAR(distances[i * num_database + j], expected, 1e-4);
+		}
+	}
+}
+
+TEST_F(FloatDistanceTest, TestEvaluationTies) {
+	// Small integer features keep the arithmetic exact, so ties are exact.
+	const int dim = 6, num_queries = 150, num_database = 200;
+	const int num_classes = 3;
+	vector<float> queries(num_queries * dim), database(num_database * dim);
+	for (size_t i = 0; i < queries.size(); ++i) {
+		queries[i] = rand() % 3 - 1;
+	}
+	for (size_t i = 0; i < database.size(); ++i) {
+		database[i] = rand() % 3 - 1;
+	}
+	vector<int> query_classes(num_queries), database_classes(num_database);
+	vector<int> relevant_per_class(num_classes, 0);
+	for (int i = 0; i < num_queries; ++i) {
+		query_classes[i] = i % num_classes;
+	}
+	for (int j = 0; j < num_database; ++j) {
+		database_classes[j] = j % num_classes;
+		relevant_per_class[j % num_classes]++;
+	}
+	vector<int> precision_ks(1, 10), cmc_ranks(1, 3);
+	RetrievalMetrics metrics(precision_ks, -1, cmc_ranks);
+	vector<double> values, single;
+	EvaluateFloat(&queries[0], num_queries, &database[0], num_database, dim,
+			&query_classes[0], &database_classes[0], &relevant_per_class[0],
+			metrics, 3, &values);
+	EvaluateFloat(&queries[0], num_queries, &database[0], num_database, dim,
+			&query_classes[0], &database_classes[0], &relevant_per_class[0],
+			metrics, 1, &single);
+	ASSERT_EQ(values.size(), num_queries * metrics.size());
+	for (int i = 0; i < num_queries; ++i) {
+		// Squared distances of values in {-1, 0, 1} are at most 4 * dim.
+		vector<int> total(4 * dim + 1, 0), relevant(4 * dim + 1, 0);
+		for (int j = 0; j < num_database; ++j) {
+			int dist = 0;
+			for (int d = 0; d < dim; ++d) {
+				const int diff = queries[i * dim + d] - database[j * dim + d];
+				dist += diff * diff;
+			}
+			total[dist]++;
+			relevant[dist] += database_classes[j] == query_classes[i];
+		}
+		vector<double> expected(metrics.size());
+		metrics.Compute(&total[0], &relevant[0], total.size(),
+				relevant_per_class[query_classes[i]], &expected[0]);
+		for (int m = 0; m < metrics.size(); ++m) {
+			EXPECT_NEAR(values[i * metrics.size() + m], expected[m], 1e-9)
+					<< metrics.name(m);
+			EXPECT_EQ(values[i * metrics.size() + m],
+					single[i * metrics.size() + m]);
+		}
+	}
+}
+
+}  // namespace caffe
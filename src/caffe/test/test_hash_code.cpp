@@ -0,0 +1,138 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <cstring>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/hash_code.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+typedef ::testing::Types<float, double> Dtypes;
+
+template<typename Dtype>
+class HashCodeTest: public ::testing::Test {
+};
+
+TYPED_TEST_CASE(HashCodeTest, Dtypes);
+
+TYPED_TEST(HashCodeTest, TestBinarize) {
+	TypeParam feature[70];
+	for (int i = 0; i < 70; ++i) {
+		feature[i] = (i % 3 == 0) ? 0.5 : -0.5;
+	}
+	uint64_t code[2];
+	BinarizeCode(feature, 70, (const int*) NULL, code);
+	for (int b = 0; b < 70; ++b) {
+		EXPECT_EQ(b % 3 == 0, ((code[b / 64] >> (b % 64)) & 1) == 1);
+	}
+	// the padding bits of the last word stay clear
+	EXPECT_EQ(code[1] >> 6, 0);
+}
+
+TYPED_TEST(HashCodeTest, TestBitOrder) {
+	TypeParam feature[4] = { -1, 1, -1, 1 };
+	int bit_order[3] = { 3, 0, 1 };
+	uint64_t code;
+	BinarizeCode(feature, 3, bit_order, &code);
+	EXPECT_EQ(code, 5);
+}
+
+TYPED_TEST(HashCodeTest, TestDistance) {
+	TypeParam features[3 * 96];
+	for (int i = 0; i < 96; ++i) {
+		features[i] = 1;
+		features[96 + i] = (i < 10) ? -1 : 1;
+		features[192 + i] = -1;
+	}
+	HashCodeStore store(96);
+	store.AppendBatch(features, 3, 96, (const int*) NULL);
+	EXPECT_EQ(store.num(), 3);
+	EXPECT_EQ(store.words(), 2);
+	EXPECT_EQ(store.memory_size(), 3 * 2 * sizeof(uint64_t));
+	EXPECT_EQ(store.Distance(0, store.code(0)), 0);
+	EXPECT_EQ(store.Distance(1, store.code(0)), 10);
+	EXPECT_EQ(store.Distance(2, store.code(0)), 96);
+	EXPECT_EQ(store.Distance(2, store.code(1)), 86);
+}
+
+TYPED_TEST(HashCodeTest, TestCopy) {
+	TypeParam feature[2][70];
+	for (int i = 0; i < 70; ++i) {
+		feature[0][i] = (i % 3 == 0) ? 0.5 : -0.5;
+		feature[1][i] = (i % 5 == 0) ? 0.5 : -0.5;
+	}
+	vector<HashCodeStore> stores;
+	{
+		HashCodeStore store(70);
+		store.AppendBatch(&feature[0][0], 2, 70, (const int*) NULL);
+		// Growing the vector copies the stores again.
+		for (int i = 0; i < 10; ++i) {
+			stores.push_back(store);
+		}
+		HashCodeStore assigned;
+		assigned = store;
+		store.Append(&feature[0][0], (const int*) NULL);
+		stores.push_back(assigned);
+	}
+	// Every copy owns its codes.
+	for (size_t s = 1; s < stores.size(); ++s) {
+		ASSERT_EQ(stores[s].num(), 2);
+		EXPECT_NE(stores[s].cpu_data(), stores[0].cpu_data());
+		EXPECT_EQ(memcmp(stores[s].cpu_data(), stores[0].cpu_data(),
+				stores[0].memory_size()), 0);
+	}
+	uint64_t expected[2];
+	BinarizeCode(&feature[1][0], 70, (const int*) NULL, expected);
+	EXPECT_EQ(memcmp(stores.back().code(1), expected, sizeof(expected)), 0);
+
+	// Copies of an attached store share the external codes.
+	HashCodeStore attached;
+	attached.Attach(expected, 1, 70);
+	HashCodeStore copy(attached);
+	EXPECT_EQ(copy.cpu_data(), expected);
+}
+
+TYPED_TEST(HashCodeTest, TestRankBitsByWeight) {
+	TypeParam weight[5] = { 0.5, -2, 0.1, 1, -0.5 };
+	vector<int> order;
+	RankBitsByWeight(weight, 5, &order);
+	EXPECT_EQ(order[0], 1);
+	EXPECT_EQ(order[1], 3);
+	EXPECT_EQ(order[2], 4);
+	EXPECT_EQ(order[3], 0);
+	EXPECT_EQ(order[4], 2);
+}
+
+TYPED_TEST(HashCodeTest, TestRankBitsByWeightTies) {
+	TypeParam weight[5] = { 1, 0.5, -1, 0.5, 1 };
+	vector<int> order;
+	RankBitsByWeight(weight, 5, &order);
+	EXPECT_EQ(order[0], 4);
+	EXPECT_EQ(order[1], 2);
+	EXPECT_EQ(order[2], 0);
+	EXPECT_EQ(order[3], 3);
+	EXPECT_EQ(order[4], 1);
+}
+
+TYPED_TEST(HashCodeTest, TestPrefixDistance) {
+	TypeParam a[100], b[100];
+	for (int i = 0; i < 100; ++i) {
+		a[i] = 1;
+		b[i] = (i % 4 == 0) ? -1 : 1;
+	}
+	uint64_t code_a[2], code_b[2];
+	BinarizeCode(a, 100, (const int*) NULL, code_a);
+	BinarizeCode(b, 100, (const int*) NULL, code_b);
+	for (int len = 0; len <= 100; ++len) {
+		EXPECT_EQ(PrefixHammingDistance(code_a, code_b, len), (len + 3) / 4);
+		for (int begin = 0; begin <= len; begin += 7) {
+			EXPECT_EQ(RangeHammingDistance(code_a, code_b, begin, len),
+					(len + 3) / 4 - (begin + 3) / 4);
+		}
+	}
+}
+
+}  // namespace caffe
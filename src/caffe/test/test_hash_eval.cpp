@@ -0,0 +1,199 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/hash_eval.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class HashEvalTest: public ::testing::Test {
+};
+
+// Plain AP of a fixed ranking given as relevance flags.
+static double RankedAP(const std::vector<int>& flags, const int num_relevant) {
+	double sum = 0;
+	int right = 0;
+	for (size_t k = 0; k < flags.size(); ++k) {
+		if (flags[k]) {
+			right++;
+			sum += double(right) / (k + 1);
+		}
+	}
+	return sum / num_relevant;
+}
+
+TEST_F(HashEvalTest, TestNoTies) {
+	// one item per distance: relevant at ranks 1, 3, 4
+	int total[5] = { 1, 1, 1, 1, 1 };
+	int relevant[5] = { 1, 0, 1, 1, 0 };
+	int flags[5] = { 1, 0, 1, 1, 0 };
+	EXPECT_NEAR(AveragePrecision(total, relevant, 5, 3),
+			RankedAP(std::vector<int>(flags, flags + 5), 3), 1e-9);
+}
+
+TEST_F(HashEvalTest, TestTiesAreAveraged) {
+	// distance 0: 1 relevant; distance 1: 4 items, 2 relevant; distance 2:
+	// 3 items, 1 relevant. Average AP over every order of the tie groups.
+	int total[3] = { 1, 4, 3 };
+	int relevant[3] = { 1, 2, 1 };
+	std::vector<int> group1, group2;
+	group1.push_back(0);
+	group1.push_back(0);
+	group1.push_back(1);
+	group1.push_back(1);
+	group2.push_back(0);
+	group2.push_back(0);
+	group2.push_back(1);
+	double sum = 0;
+	int orders = 0;
+	do {
+		do {
+			std::vector<int> flags(1, 1);
+			flags.insert(flags.end(), group1.begin(), group1.end());
+			flags.insert(flags.end(), group2.begin(), group2.end());
+			sum += RankedAP(flags, 5);
+			orders++;
+		} while (std::next_permutation(group2.begin(), group2.end()));
+	} while (std::next_permutation(group1.begin(), group1.end()));
+	EXPECT_NEAR(AveragePrecision(total, relevant, 3, 5), sum / orders, 1e-9);
+}
+
+TEST_F(HashEvalTest, TestRankByDistance) {
+	float features[4][8] = { { 1, 1, 1, 1, 1, 1, 1, 1 }, { 1, 1, 1, 1, 1, 1,
+			1, -1 }, { -1, -1, 1, 1, 1, 1, 1, 1 }, { 1, 1, 1, 1, 1, 1, 1, -1 } };
+	int classes[4] = { 0, 1, 0, 0 };
+	HashCodeStore store(8);
+	store.AppendBatch(&features[0][0], 4, 8, (const int*) NULL);
+	HammingMetric metric(8);
+	int total[9], relevant[9];
+	RankByDistance(metric, store.code(0), 0, store, classes, total, relevant);
+	EXPECT_EQ(total[0], 1);
+	EXPECT_EQ(relevant[0], 1);
+	EXPECT_EQ(total[1], 2);
+	EXPECT_EQ(relevant[1], 1);
+	EXPECT_EQ(total[2], 1);
+	EXPECT_EQ(relevant[2], 1);
+	EXPECT_EQ(total[8], 0);
+}
+
+TEST_F(HashEvalTest, TestThreadsAreDeterministic) {
+	srand(1701);
+	const int nbits = 16;
+	HashCodeStore queries(nbits), database(nbits);
+	std::vector<int> query_classes, database_classes;
+	std::vector<int> relevant_per_class(5, 0);
+	float feature[nbits];
+	for (int i = 0; i < 300; ++i) {
+		for (int b = 0; b < nbits; ++b) {
+			feature[b] = (rand() % 2) ? 1 : -1;
+		}
+		if (i < 100) {
+			queries.Append(feature, (const int*) NULL);
+			query_classes.push_back(i % 5);
+		} else {
+			database.Append(feature, (const int*) NULL);
+			database_classes.push_back(i % 5);
+			relevant_per_class[i % 5]++;
+		}
+	}
+	HammingMetric metric(nbits);
+	std::vector<double> ap1, ap7;
+	EvaluateQueries(metric, queries, &query_classes[0], database,
+			&database_classes[0], &relevant_per_class[0], 1, &ap1);
+	EvaluateQueries(metric, queries, &query_classes[0], database,
+			&database_classes[0], &relevant_per_class[0], 7, &ap7);
+	ASSERT_EQ(ap1.size(), 100);
+	std::vector<int> total(nbits + 1), relevant(nbits + 1);
+	for (int i = 0; i < 100; ++i) {
+		RankByDistance(metric, queries.code(i), query_classes[i], database,
+				&database_classes[0], &total[0], &relevant[0]);
+		EXPECT_EQ(ap1[i], AveragePrecision(&total[0], &relevant[0],
+				nbits + 1, relevant_per_class[query_classes[i]]));
+		EXPECT_EQ(ap1[i], ap7[i]);
+	}
+	std::vector<double> sum1, sum7;
+	ReduceByClass(ap1, &query_classes[0], 5, &sum1);
+	ReduceByClass(ap7, &query_classes[0], 5, &sum7);
+	for (int c = 0; c < 5; ++c) {
+		EXPECT_EQ(sum1[c], sum7[c]);
+	}
+}
+
+TEST_F(HashEvalTest, TestPrefixLengths) {
+	srand(1701);
+	const int nbits = 80;
+	HashCodeStore queries(nbits), database(nbits);
+	std::vector<int> query_classes, database_classes;
+	std::vector<int> relevant_per_class(4, 0);
+	float feature[nbits];
+	for (int i = 0; i < 200; ++i) {
+		for (int b = 0; b < nbits; ++b) {
+			feature[b] = (rand() % 2) ? 1 : -1;
+		}
+		if (i < 40) {
+			queries.Append(feature, (const int*) NULL);
+			query_classes.push_back(i % 4);
+		} else {
+			database.Append(feature, (const int*) NULL);
+			database_classes.push_back(i % 4);
+			relevant_per_class[i % 4]++;
+		}
+	}
+	std::vector<int> lengths;
+	lengths.push_back(8);
+	lengths.push_back(16);
+	lengths.push_back(70);
+	lengths.push_back(80);
+	std::vector<std::vector<double> > ap;
+	EvaluatePrefixLengths(queries, &query_classes[0], database,
+			&database_classes[0], &relevant_per_class[0], lengths, 3, &ap);
+	ASSERT_EQ(ap.size(), lengths.size());
+	for (size_t l = 0; l < lengths.size(); ++l) {
+		std::vector<double> expected;
+		EvaluateQueries(HammingMetric(lengths[l]), queries, &query_classes[0],
+				database, &database_classes[0], &relevant_per_class[0], 1,
+				&expected);
+		for (int i = 0; i < queries.num(); ++i) {
+			EXPECT_NEAR(ap[l][i], expected[i], 1e-12);
+		}
+	}
+}
+
+TEST_F(HashEvalTest, TestWeightedHamming) {
+	srand(1701);
+	const int nbits = 100;
+	float weights[nbits];
+	for (int b = 0; b < nbits; ++b) {
+		// already integers when quantized to 4 levels
+		weights[b] = (b % 2 ? -1 : 1) * (b % 4 + 1);
+	}
+	float a[nbits], c[nbits];
+	for (int b = 0; b < nbits; ++b) {
+		a[b] = (rand() % 2) ? 1 : -1;
+		c[b] = (rand() % 2) ? 1 : -1;
+	}
+	uint64_t code_a[2], code_c[2];
+	BinarizeCode(a, nbits, (const int*) NULL, code_a);
+	BinarizeCode(c, nbits, (const int*) NULL, code_c);
+	for (int len = 4; len <= nbits; len += 12) {
+		WeightedHammingMetric metric(weights, len, 4);
+		int expected = 0, max_distance = 0;
+		for (int b = 0; b < len; ++b) {
+			EXPECT_EQ(metric.bit_weight(b), b % 4 + 1);
+			expected += (a[b] != c[b]) ? (b % 4 + 1) : 0;
+			max_distance += b % 4 + 1;
+		}
+		EXPECT_EQ(metric(code_a, code_c), expected);
+		EXPECT_EQ(metric(code_a, code_a), 0);
+		EXPECT_EQ(metric.max_distance(), max_distance);
+	}
+}
+
+}  // namespace caffe
@@ -0,0 +1,82 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <string>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/image_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ImageCacheTest: public ::testing::Test {
+protected:
+	// A height x width x 3 image filled with value.
+	shared_ptr<const DecodedImage> MakeImage(const int height, const int width,
+			const uint8_t value) {
+		DecodedImage* image = new DecodedImage();
+		image->height = height;
+		image->width = width;
+		image->channels = 3;
+		image->pixels.assign(height * width * 3, value);
+		return shared_ptr<const DecodedImage>(image);
+	}
+};
+
+TEST_F(ImageCacheTest, TestHitsAndMisses) {
+	ImageCache cache(1000);
+	EXPECT_FALSE(cache.Lookup("a_1"));
+	cache.Insert("a_1", MakeImage(4, 5, 7));
+	shared_ptr<const DecodedImage> image = cache.Lookup("a_1");
+	ASSERT_TRUE(image);
+	EXPECT_EQ(image->height, 4);
+	EXPECT_EQ(image->width, 5);
+	EXPECT_EQ(*image->pixel(3, 4), 7);
+	EXPECT_EQ(cache.hits(), 1);
+	EXPECT_EQ(cache.misses(), 1);
+	EXPECT_EQ(cache.size_bytes(), 60);
+}
+
+TEST_F(ImageCacheTest, TestEvictsLeastRecentlyUsed) {
+	// Room for three 10x10x3 images.
+	ImageCache cache(1000);
+	cache.Insert("a", MakeImage(10, 10, 1));
+	cache.Insert("b", MakeImage(10, 10, 2));
+	cache.Insert("c", MakeImage(10, 10, 3));
+	EXPECT_TRUE(cache.Lookup("a"));
+	cache.Insert("d", MakeImage(10, 10, 4));
+	EXPECT_EQ(cache.count(), 3);
+	EXPECT_LE(cache.size_bytes(), cache.capacity_bytes());
+	EXPECT_FALSE(cache.Lookup("b"));
+	EXPECT_TRUE(cache.Lookup("a"));
+	EXPECT_TRUE(cache.Lookup("c"));
+	EXPECT_TRUE(cache.Lookup("d"));
+}
+
+TEST_F(ImageCacheTest, TestEvictedImageStaysValid) {
+	ImageCache cache(300);
+	cache.Insert("a", MakeImage(10, 10, 1));
+	shared_ptr<const DecodedImage> image = cache.Lookup("a");
+	cache.Insert("b", MakeImage(10, 10, 2));
+	EXPECT_FALSE(cache.Lookup("a"));
+	EXPECT_EQ(*image->pixel(9, 9), 1);
+}
+
+TEST_F(ImageCacheTest, TestOversizedImageNotCached) {
+	ImageCache cache(100);
+	cache.Insert("big", MakeImage(10, 10, 1));
+	EXPECT_FALSE(cache.Lookup("big"));
+	EXPECT_EQ(cache.size_bytes(), 0);
+}
+
+TEST_F(ImageCacheTest, TestReplace) {
+	ImageCache cache(1000);
+	cache.Insert("a", MakeImage(10, 10, 1));
+	cache.Insert("a", MakeImage(5, 5, 2));
+	EXPECT_EQ(cache.count(), 1);
+	EXPECT_EQ(cache.size_bytes(), 75);
+	EXPECT_EQ(*cache.Lookup("a")->pixel(0, 0), 2);
+}
+
+}  // namespace caffe
@@ -0,0 +1,71 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/image_transform.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template<typename Dtype>
+class ImageTransformTest: public ::testing::Test {
+protected:
+	ImageTransformTest() :
+			height_(7), width_(9) {
+	}
+	// Crops with CropNormalizeHWC and with the per-pixel formula.
+	void Check(const int channels, const int h_off, const int w_off,
+			const int crop_h, const int crop_w, const bool mirror) {
+		vector<uint8_t> src(height_ * width_ * channels);
+		for (size_t i = 0; i < src.size(); ++i) {
+			src[i] = (i * 37 + 11) % 256;
+		}
+		vector<Dtype> mean(channels * height_ * width_);
+		for (size_t i = 0; i < mean.size(); ++i) {
+			mean[i] = (i * 13) % 200 + Dtype(0.25);
+		}
+		const Dtype scale = 0.0125;
+		vector<Dtype> dst(channels * crop_h * crop_w, -1);
+		CropNormalizeHWC(&src[0], height_, width_, channels, h_off, w_off, crop_h,
+				crop_w, mirror, &mean[0], scale, &dst[0]);
+		for (int c = 0; c < channels; ++c) {
+			for (int h = 0; h < crop_h; ++h) {
+				for (int w = 0; w < crop_w; ++w) {
+					const int out = mirror ? crop_w - 1 - w : w;
+					const Dtype expected = 128 * scale
+							- (src[((h + h_off) * width_ + w + w_off) * channels + c]
+									- mean[(c * height_ + h + h_off) * width_ + w
+											+ w_off]) * scale;
+					EXPECT_EQ(dst[(c * crop_h + h) * crop_w + out], expected)
+							<< "c=" << c << " h=" << h << " w=" << w;
+				}
+			}
+		}
+	}
+	int height_;
+	int width_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(ImageTransformTest, Dtypes);
+
+TYPED_TEST(ImageTransformTest, TestOneChannel) {
+	this->Check(1, 1, 2, 5, 6, false);
+	this->Check(1, 1, 2, 5, 6, true);
+}
+
+TYPED_TEST(ImageTransformTest, TestThreeChannels) {
+	this->Check(3, 2, 1, 4, 7, false);
+	this->Check(3, 2, 1, 4, 7, true);
+	this->Check(3, 0, 0, 7, 9, true);
+}
+
+TYPED_TEST(ImageTransformTest, TestOtherChannels) {
+	this->Check(4, 0, 3, 6, 5, false);
+	this->Check(4, 0, 3, 6, 5, true);
+}
+
+}  // namespace caffe
@@ -0,0 +1,122 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/mih_index.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class MultiIndexHashTest: public ::testing::Test {
+protected:
+	virtual void SetUp() {
+		srand(1701);
+		store_.Reset(48);
+		// Clustered codes so that small radii return something.
+		vector<float> center(48), feature(48);
+		for (int i = 0; i < 500; ++i) {
+			if (i % 50 == 0) {
+				for (int b = 0; b < 48; ++b) {
+					center[b] = (rand() % 2) ? 1 : -1;
+				}
+			}
+			for (int b = 0; b < 48; ++b) {
+				feature[b] = (rand() % 8 == 0) ? -center[b] : center[b];
+			}
+			store_.Append(&feature[0], (const int*) NULL);
+		}
+	}
+
+	void BruteForce(const uint64_t* query, vector<std::pair<int, int> >* all) {
+		all->clear();
+		for (int i = 0; i < store_.num(); ++i) {
+			all->push_back(std::make_pair(store_.Distance(i, query), i));
+		}
+		std::sort(all->begin(), all->end());
+	}
+
+	HashCodeStore store_;
+};
+
+TEST_F(MultiIndexHashTest, TestKnn) {
+	MultiIndexHash index;
+	index.Build(store_, 4);
+	EXPECT_EQ(index.num_substrings(), 4);
+	vector<int> ids, distances;
+	vector<std::pair<int, int> > all;
+	for (int q = 0; q < store_.num(); q += 37) {
+		BruteForce(store_.code(q), &all);
+		index.KnnSearch(store_.code(q), 20, &ids, &distances);
+		ASSERT_EQ(ids.size(), 20);
+		for (int i = 0; i < 20; ++i) {
+			EXPECT_EQ(distances[i], all[i].first);
+			EXPECT_EQ(ids[i], all[i].second);
+		}
+	}
+}
+
+TEST_F(MultiIndexHashTest, TestKnnWholeDatabase) {
+	MultiIndexHash index;
+	index.Build(store_);
+	vector<int> ids, distances;
+	index.KnnSearch(store_.code(0), 1000, &ids, &distances);
+	EXPECT_EQ(ids.size(), store_.num());
+}
+
+TEST_F(MultiIndexHashTest, TestRadius) {
+	MultiIndexHash index;
+	index.Build(store_, 3);
+	vector<int> ids, distances;
+	vector<std::pair<int, int> > all;
+	for (int q = 0; q < store_.num(); q += 41) {
+		BruteForce(store_.code(q), &all);
+		for (int radius = 0; radius <= 12; radius += 3) {
+			index.RadiusSearch(store_.code(q), radius, &ids, &distances);
+			size_t expected = 0;
+			while (expected < all.size() && all[expected].first <= radius) {
+				++expected;
+			}
+			ASSERT_EQ(ids.size(), expected);
+			for (size_t i = 0; i < expected; ++i) {
+				EXPECT_EQ(ids[i], all[i].second);
+			}
+		}
+	}
+}
+
+TEST_F(MultiIndexHashTest, TestGroupedRadius) {
+	MultiIndexHash index;
+	index.Build(store_);
+	// Probing pays off for small radii only; the full radius is a scan.
+	EXPECT_FALSE(index.PrefersLinearScan(0));
+	EXPECT_TRUE(index.PrefersLinearScan(48));
+	vector<int> ids, offsets;
+	vector<std::pair<int, int> > all;
+	for (int q = 0; q < store_.num(); q += 41) {
+		BruteForce(store_.code(q), &all);
+		for (int radius = 0; radius <= 48; radius += 4) {
+			index.GroupedRadiusSearch(store_.code(q), radius, &ids, &offsets);
+			ASSERT_EQ(offsets.size(), radius + 2);
+			size_t expected = 0;
+			while (expected < all.size() && all[expected].first <= radius) {
+				++expected;
+			}
+			ASSERT_EQ(ids.size(), expected);
+			for (int d = 0; d <= radius; ++d) {
+				for (int i = offsets[d]; i < offsets[d + 1]; ++i) {
+					EXPECT_EQ(all[i].first, d);
+					EXPECT_EQ(ids[i], all[i].second);
+				}
+			}
+		}
+	}
+}
+
+}  // namespace caffe
@@ -0,0 +1,84 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/packed_images.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class PackedImagesTest: public ::testing::Test {
+protected:
+	virtual void SetUp() {
+		char filename[] = "/tmp/packed_images_XXXXXX";
+		close(mkstemp(filename));
+		filename_ = filename;
+	}
+	virtual void TearDown() {
+		remove(filename_.c_str());
+	}
+	// A 3x5x3 image whose every byte is value + its offset.
+	vector<uint8_t> MakeImage(const int value) {
+		vector<uint8_t> pixels(3 * 5 * 3);
+		for (size_t i = 0; i < pixels.size(); ++i) {
+			pixels[i] = value + i;
+		}
+		return pixels;
+	}
+	string filename_;
+};
+
+TEST_F(PackedImagesTest, TestRoundTrip) {
+	PackedImageWriter writer;
+	writer.Open(filename_, 3, 5, 3);
+	// Appended out of (class, id) order, as a list file may be.
+	const char* classes[5] = { "cat", "dog", "cat", "big_bird", "cat" };
+	const int ids[5] = { 12, 1, 3, 7, 100 };
+	for (int i = 0; i < 5; ++i) {
+		writer.Append(classes[i], ids[i], &MakeImage(i * 10)[0]);
+	}
+	writer.Close();
+
+	PackedImageFile packed(filename_);
+	EXPECT_EQ(packed.count(), 5);
+	EXPECT_EQ(packed.height(), 3);
+	EXPECT_EQ(packed.width(), 5);
+	EXPECT_EQ(packed.channels(), 3);
+	ASSERT_EQ(packed.num_classes(), 3);
+	EXPECT_EQ(packed.class_name(2), "big_bird");
+	for (int i = 0; i < 5; ++i) {
+		const int record = packed.Find(classes[i], ids[i]);
+		ASSERT_EQ(record, i);
+		const vector<uint8_t> expected = MakeImage(i * 10);
+		for (size_t j = 0; j < expected.size(); ++j) {
+			EXPECT_EQ(packed.image(record)[j], expected[j]);
+		}
+	}
+	EXPECT_EQ(packed.Find("cat_3.png"), 2);
+	EXPECT_EQ(packed.Find("big_bird_7"), 3);
+	EXPECT_EQ(packed.Find("cat", 4), -1);
+	EXPECT_EQ(packed.Find("cow", 1), -1);
+	EXPECT_EQ(packed.Find("cat_200.png"), -1);
+}
+
+TEST_F(PackedImagesTest, TestImagesAligned) {
+	PackedImageWriter writer;
+	writer.Open(filename_, 3, 5, 3);
+	writer.Append("a", 1, &MakeImage(0)[0]);
+	writer.Append("a", 2, &MakeImage(1)[0]);
+	writer.Close();
+	PackedImageFile packed(filename_);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(packed.image(0))
+			% kPackedImageAlignment, 0);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(packed.image(1)) % 8, 0);
+	EXPECT_EQ(packed.image(1)[44], 45);
+}
+
+}  // namespace caffe
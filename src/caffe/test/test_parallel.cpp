@@ -0,0 +1,72 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/parallel.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ParallelTest: public ::testing::Test {
+};
+
+// Counts the visits of every item.
+static void CountWorker(WorkQueue* queue, void* arg) {
+	int* visits = reinterpret_cast<int*>(arg);
+	int begin, end;
+	while (queue->Next(&begin, &end)) {
+		for (int i = begin; i < end; ++i) {
+			__sync_fetch_and_add(&visits[i], 1);
+		}
+	}
+}
+
+TEST_F(ParallelTest, TestWorkQueueChunks) {
+	WorkQueue queue(10, 4);
+	int begin, end;
+	ASSERT_TRUE(queue.Next(&begin, &end));
+	EXPECT_EQ(begin, 0);
+	EXPECT_EQ(end, 4);
+	ASSERT_TRUE(queue.Next(&begin, &end));
+	EXPECT_EQ(begin, 4);
+	EXPECT_EQ(end, 8);
+	ASSERT_TRUE(queue.Next(&begin, &end));
+	EXPECT_EQ(begin, 8);
+	EXPECT_EQ(end, 10);
+	EXPECT_FALSE(queue.Next(&begin, &end));
+}
+
+TEST_F(ParallelTest, TestEveryItemOnce) {
+	const int threads[4] = { 1, 2, 5, 0 };
+	for (int t = 0; t < 4; ++t) {
+		std::vector<int> visits(1000, 0);
+		ParallelFor(1000, 7, threads[t], CountWorker, &visits[0]);
+		for (int i = 0; i < 1000; ++i) {
+			EXPECT_EQ(visits[i], 1) << "item " << i << ", threads " << threads[t];
+		}
+	}
+	// Nothing to do.
+	ParallelFor(0, 7, 4, CountWorker, NULL);
+}
+
+TEST_F(ParallelTest, TestWorkerPoolReuse) {
+	const int threads[3] = { 1, 4, 0 };
+	for (int t = 0; t < 3; ++t) {
+		WorkerPool pool(threads[t]);
+		EXPECT_GE(pool.num_threads(), 1);
+		// Loops of different sizes on the same threads.
+		for (int loop = 0; loop < 50; ++loop) {
+			const int num = 1 + loop * 13;
+			std::vector<int> visits(num, 0);
+			pool.Run(num, 1 + loop % 5, CountWorker, &visits[0]);
+			for (int i = 0; i < num; ++i) {
+				ASSERT_EQ(visits[i], 1) << "item " << i << ", loop " << loop;
+			}
+		}
+	}
+}
+
+}  // namespace caffe
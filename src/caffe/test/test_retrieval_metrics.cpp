@@ -0,0 +1,157 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/hash_eval.hpp"
+#include "caffe/util/retrieval_metrics.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class RetrievalMetricsTest: public ::testing::Test {
+protected:
+	RetrievalMetricsTest() {
+		precision_ks_.push_back(1);
+		precision_ks_.push_back(3);
+		precision_ks_.push_back(6);
+		precision_ks_.push_back(20);
+		cmc_ranks_.push_back(1);
+		cmc_ranks_.push_back(2);
+		cmc_ranks_.push_back(5);
+	}
+	vector<int> precision_ks_;
+	vector<int> cmc_ranks_;
+};
+
+TEST_F(RetrievalMetricsTest, TestNames) {
+	RetrievalMetrics metrics(precision_ks_, 2, cmc_ranks_);
+	ASSERT_EQ(metrics.size(), 10);
+	EXPECT_EQ(metrics.name(0), "mAP");
+	EXPECT_EQ(metrics.name(2), "P@3");
+	EXPECT_EQ(metrics.name(5), "P@r2");
+	EXPECT_EQ(metrics.name(6), "R@r2");
+	EXPECT_EQ(metrics.name(9), "CMC@5");
+	EXPECT_EQ(RetrievalMetrics().size(), 1);
+}
+
+TEST_F(RetrievalMetricsTest, TestTiesAreAveraged) {
+	// distance 0: 1 irrelevant; distance 1: 4 items, 2 relevant; distance 2:
+	// 3 items, 1 relevant. 5 relevant items exist in total.
+	int total[3] = { 1, 4, 3 };
+	int relevant[3] = { 0, 2, 1 };
+	RetrievalMetrics metrics(precision_ks_, 1, cmc_ranks_);
+	vector<double> values(metrics.size());
+	metrics.Compute(total, relevant, 3, 5, &values[0]);
+
+	// Average every metric over all orders of the tie groups.
+	vector<int> group1, group2;
+	group1.push_back(0);
+	group1.push_back(0);
+	group1.push_back(1);
+	group1.push_back(1);
+	group2.push_back(0);
+	group2.push_back(0);
+	group2.push_back(1);
+	vector<double> expected(metrics.size(), 0.);
+	int orders = 0;
+	do {
+		do {
+			vector<int> flags(1, 0);
+			flags.insert(flags.end(), group1.begin(), group1.end());
+			flags.insert(flags.end(), group2.begin(), group2.end());
+			int m = 1;
+			for (size_t i = 0; i < precision_ks_.size(); ++i, ++m) {
+				const int k = precision_ks_[i];
+				const int end = std::min<int>(k, flags.size());
+				expected[m] += double(std::count(flags.begin(),
+						flags.begin() + end, 1)) / k;
+			}
+			m += 2;
+			for (size_t i = 0; i < cmc_ranks_.size(); ++i, ++m) {
+				const int k = std::min<int>(cmc_ranks_[i], flags.size());
+				expected[m] += std::count(flags.begin(), flags.begin() + k, 1) > 0;
+			}
+			orders++;
+		} while (std::next_permutation(group2.begin(), group2.end()));
+	} while (std::next_permutation(group1.begin(), group1.end()));
+	for (size_t m = 1; m <= precision_ks_.size(); ++m) {
+		EXPECT_NEAR(values[m], expected[m] / orders, 1e-9) << metrics.name(m);
+	}
+	// Radius 1 retrieves the first 5 items, 2 of them relevant.
+	EXPECT_NEAR(values[5], 2. / 5, 1e-9);
+	EXPECT_NEAR(values[6], 2. / 5, 1e-9);
+	for (int m = 7; m < metrics.size(); ++m) {
+		EXPECT_NEAR(values[m], expected[m] / orders, 1e-9) << metrics.name(m);
+	}
+	EXPECT_NEAR(values[0], AveragePrecision(total, relevant, 3, 5), 1e-12);
+}
+
+TEST_F(RetrievalMetricsTest, TestEmptyRadius) {
+	int total[3] = { 0, 0, 4 };
+	int relevant[3] = { 0, 0, 4 };
+	RetrievalMetrics metrics(vector<int>(), 1, vector<int>());
+	vector<double> values(metrics.size());
+	metrics.Compute(total, relevant, 3, 4, &values[0]);
+	EXPECT_EQ(values[1], 0.);
+	EXPECT_EQ(values[2], 0.);
+}
+
+TEST_F(RetrievalMetricsTest, TestEvaluationMatchesAP) {
+	srand(1701);
+	const int nbits = 12;
+	HashCodeStore queries(nbits), database(nbits);
+	vector<int> query_classes, database_classes;
+	vector<int> relevant_per_class(4, 0);
+	float feature[nbits];
+	for (int i = 0; i < 200; ++i) {
+		for (int b = 0; b < nbits; ++b) {
+			feature[b] = (rand() % 2) ? 1 : -1;
+		}
+		if (i < 40) {
+			queries.Append(feature, (const int*) NULL);
+			query_classes.push_back(i % 4);
+		} else {
+			database.Append(feature, (const int*) NULL);
+			database_classes.push_back(i % 4);
+			relevant_per_class[i % 4]++;
+		}
+	}
+	RetrievalMetrics metrics(precision_ks_, 2, cmc_ranks_);
+	vector<int> lengths;
+	lengths.push_back(6);
+	lengths.push_back(nbits);
+	vector<vector<double> > ap, values;
+	EvaluatePrefixLengths(queries, &query_classes[0], database,
+			&database_classes[0], &relevant_per_class[0], lengths, 3, &ap);
+	EvaluatePrefixLengths(queries, &query_classes[0], database,
+			&database_classes[0], &relevant_per_class[0], lengths, metrics, 3,
+			&values);
+	vector<double> single;
+	EvaluateQueries(HammingMetric(nbits), queries, &query_classes[0], database,
+			&database_classes[0], &relevant_per_class[0], metrics, 2, &single);
+	ASSERT_EQ(values[1].size(), queries.num() * metrics.size());
+	for (int i = 0; i < queries.num(); ++i) {
+		for (size_t l = 0; l < lengths.size(); ++l) {
+			EXPECT_EQ(values[l][i * metrics.size()], ap[l][i]);
+		}
+		for (int m = 0; m < metrics.size(); ++m) {
+			EXPECT_EQ(single[i * metrics.size() + m],
+					values[1][i * metrics.size() + m]);
+		}
+	}
+	vector<double> mean;
+	metrics.Mean(values[1], &mean);
+	double map = 0;
+	for (int i = 0; i < queries.num(); ++i) {
+		map += ap[1][i];
+	}
+	EXPECT_NEAR(mean[0], map / queries.num(), 1e-12);
+}
+
+}  // namespace caffe
@@ -0,0 +1,152 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/mih_index.hpp"
+#include "caffe/util/shard_search.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ShardSearchTest: public ::testing::Test {
+protected:
+	// Few bits and many items, so distances tie across shards.
+	ShardSearchTest() :
+			nbits_(10), num_(500), num_shards_(3), database_(10) {
+	}
+	virtual void SetUp() {
+		srand(1701);
+		vector<float> feature(nbits_);
+		for (int i = 0; i < num_; ++i) {
+			for (int b = 0; b < nbits_; ++b) {
+				feature[b] = (rand() % 2) ? 1 : -1;
+			}
+			database_.Append(&feature[0], (const int*) NULL);
+		}
+		index_.Build(database_);
+		shards_.resize(num_shards_);
+		shard_indexes_.resize(num_shards_);
+		for (int s = 0; s < num_shards_; ++s) {
+			const int begin = ShardBegin(num_, s, num_shards_);
+			const int end = ShardBegin(num_, s + 1, num_shards_);
+			shards_[s].Attach(database_.code(begin), end - begin, nbits_);
+			shard_indexes_[s].Build(shards_[s]);
+		}
+	}
+
+	int nbits_;
+	int num_;
+	int num_shards_;
+	HashCodeStore database_;
+	MultiIndexHash index_;
+	vector<HashCodeStore> shards_;
+	vector<MultiIndexHash> shard_indexes_;
+};
+
+TEST_F(ShardSearchTest, TestProtocol) {
+	uint64_t code[2] = { 0xdeadbeefcafeULL, 7 };
+	vector<uint64_t> parsed(2);
+	int k = 0;
+	ASSERT_TRUE(ParseKnnRequest(FormatKnnRequest(code, 2, 25), &k, &parsed));
+	EXPECT_EQ(k, 25);
+	EXPECT_EQ(parsed[0], code[0]);
+	EXPECT_EQ(parsed[1], code[1]);
+	EXPECT_FALSE(ParseKnnRequest(FormatKnnRequest(code, 1, 25), &k, &parsed));
+	vector<int> ids(3), distances(3), parsed_ids, parsed_distances;
+	for (int i = 0; i < 3; ++i) {
+		ids[i] = 10 * i;
+		distances[i] = i;
+	}
+	ASSERT_TRUE(ParseKnnResponse(FormatKnnResponse(ids, distances),
+			&parsed_ids, &parsed_distances));
+	EXPECT_EQ(parsed_ids, ids);
+	EXPECT_EQ(parsed_distances, distances);
+	EXPECT_FALSE(ParseKnnResponse("error oops", &parsed_ids,
+			&parsed_distances));
+}
+
+TEST_F(ShardSearchTest, TestMergeMatchesSingleIndex) {
+	vector<vector<int> > ids(num_shards_), distances(num_shards_);
+	vector<int> merged_ids, merged_distances, expected_ids, expected_distances;
+	const int ks[3] = { 1, 37, num_ + 10 };
+	for (int q = 0; q < 50; ++q) {
+		const uint64_t* query = database_.code(q * 7);
+		for (int i = 0; i < 3; ++i) {
+			for (int s = 0; s < num_shards_; ++s) {
+				shard_indexes_[s].KnnSearch(query, ks[i], &ids[s], &distances[s]);
+				for (size_t j = 0; j < ids[s].size(); ++j) {
+					ids[s][j] += ShardBegin(num_, s, num_shards_);
+				}
+			}
+			MergeShardResults(ids, distances, ks[i], &merged_ids,
+					&merged_distances);
+			index_.KnnSearch(query, ks[i], &expected_ids, &expected_distances);
+			EXPECT_EQ(merged_ids, expected_ids);
+			EXPECT_EQ(merged_distances, expected_distances);
+		}
+	}
+}
+
+struct ShardThread {
+	const MultiIndexHash* index;
+	int id_offset;
+	int listen_fd;
+};
+
+static void* ServeOneConnection(void* arg) {
+	ShardThread* shard = reinterpret_cast<ShardThread*>(arg);
+	const int fd = accept(shard->listen_fd, NULL, NULL);
+	ServeShardConnection(*shard->index, shard->id_offset, fd);
+	close(fd);
+	return NULL;
+}
+
+TEST_F(ShardSearchTest, TestScatterGather) {
+	char directory[] = "/tmp/shard_search_XXXXXX";
+	ASSERT_TRUE(mkdtemp(directory) != NULL);
+	vector<string> paths(num_shards_);
+	vector<ShardThread> shards(num_shards_);
+	vector<pthread_t> threads(num_shards_);
+	for (int s = 0; s < num_shards_; ++s) {
+		std::ostringstream path;
+		path << directory << "/shard" << s;
+		paths[s] = path.str();
+		shards[s].index = &shard_indexes_[s];
+		shards[s].id_offset = ShardBegin(num_, s, num_shards_);
+		shards[s].listen_fd = ListenUnixSocket(paths[s]);
+		ASSERT_EQ(pthread_create(&threads[s], NULL, ServeOneConnection,
+				&shards[s]), 0);
+	}
+	{
+		ShardedIndex sharded(paths, nbits_);
+		EXPECT_EQ(sharded.num_shards(), num_shards_);
+		vector<int> ids, distances, expected_ids, expected_distances;
+		for (int q = 0; q < 30; ++q) {
+			sharded.KnnSearch(database_.code(q * 11), 20, &ids, &distances);
+			index_.KnnSearch(database_.code(q * 11), 20, &expected_ids,
+					&expected_distances);
+			EXPECT_EQ(ids, expected_ids);
+			EXPECT_EQ(distances, expected_distances);
+		}
+	}
+	for (int s = 0; s < num_shards_; ++s) {
+		EXPECT_EQ(pthread_join(threads[s], NULL), 0);
+		close(shards[s].listen_fd);
+		unlink(paths[s].c_str());
+	}
+	rmdir(directory);
+}
+
+}  // namespace caffe
@@ -0,0 +1,134 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/hash_eval.hpp"
+#include "caffe/util/mih_index.hpp"
+#include "caffe/util/topk_search.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class TopKSearchTest: public ::testing::Test {
+protected:
+	virtual void SetUp() {
+		srand(1701);
+	}
+	// Random codes where every tenth one repeats an earlier code, so there
+	// are exact matches and ties.
+	void FillStore(const int num, HashCodeStore* store) {
+		const int nbits = store->nbits();
+		vector<vector<float> > features;
+		vector<float> feature(nbits);
+		for (int i = 0; i < num; ++i) {
+			if (i % 10 == 9) {
+				feature = features[rand() % features.size()];
+			} else {
+				for (int b = 0; b < nbits; ++b) {
+					feature[b] = (rand() % 2) ? 1 : -1;
+				}
+			}
+			features.push_back(feature);
+			store->Append(&feature[0], (const int*) NULL);
+		}
+	}
+	template<typename Metric>
+	void BruteForce(const Metric& metric, const HashCodeStore& database,
+			const uint64_t* query, const int n, int* ids, int* distances) {
+		vector<std::pair<int, int> > scored(database.num());
+		for (int j = 0; j < database.num(); ++j) {
+			scored[j] = std::make_pair(metric(query, database.code(j)), j);
+		}
+		std::sort(scored.begin(), scored.end());
+		for (int r = 0; r < n; ++r) {
+			distances[r] = scored[r].first;
+			ids[r] = scored[r].second;
+		}
+	}
+};
+
+TEST_F(TopKSearchTest, TestMatchesMultiIndexHash) {
+	HashCodeStore database(48);
+	FillStore(3000, &database);
+	HashCodeStore queries(48);
+	FillStore(37, &queries);
+	// Some queries are database codes, so they have exact matches.
+	for (int i = 0; i < 20; ++i) {
+		queries.AppendCode(database.code(i * 131));
+	}
+	MultiIndexHash index;
+	index.Build(database);
+	HammingMetric metric(48);
+	TopKSearcher<HammingMetric> searcher(metric, database);
+	vector<int> ids, distances, expected_ids, expected_distances;
+	const int ks[3] = { 1, 100, 1 };
+	for (int t = 0; t < 3; ++t) {
+		const int k = ks[t];
+		searcher.Search(queries, k, &ids, &distances, t + 1);
+		ASSERT_EQ(ids.size(), queries.num() * k);
+		for (int i = 0; i < queries.num(); ++i) {
+			index.KnnSearch(queries.code(i), k, &expected_ids,
+					&expected_distances);
+			EXPECT_TRUE(std::equal(expected_ids.begin(), expected_ids.end(),
+					ids.begin() + i * k));
+			EXPECT_TRUE(std::equal(expected_distances.begin(),
+					expected_distances.end(), distances.begin() + i * k));
+		}
+	}
+}
+
+TEST_F(TopKSearchTest, TestWeighted) {
+	const int nbits = 70;
+	vector<float> weights(nbits);
+	for (int b = 0; b < nbits; ++b) {
+		weights[b] = 1. / (1 + b);
+	}
+	WeightedHammingMetric metric(&weights[0], nbits);
+	HashCodeStore database(nbits);
+	FillStore(2500, &database);
+	HashCodeStore queries(nbits);
+	FillStore(50, &queries);
+	TopKSearcher<WeightedHammingMetric> searcher(metric, database);
+	vector<int> ids, distances;
+	const int k = 25;
+	searcher.Search(queries, k, &ids, &distances, 4);
+	vector<int> expected_ids(k), expected_distances(k);
+	for (int i = 0; i < queries.num(); ++i) {
+		BruteForce(metric, database, queries.code(i), k, &expected_ids[0],
+				&expected_distances[0]);
+		EXPECT_TRUE(std::equal(expected_ids.begin(), expected_ids.end(),
+				ids.begin() + i * k));
+		EXPECT_TRUE(std::equal(expected_distances.begin(),
+				expected_distances.end(), distances.begin() + i * k));
+	}
+}
+
+TEST_F(TopKSearchTest, TestKLargerThanDatabase) {
+	HashCodeStore database(16);
+	FillStore(30, &database);
+	HashCodeStore queries(16);
+	FillStore(3, &queries);
+	HammingMetric metric(16);
+	TopKSearcher<HammingMetric> searcher(metric, database);
+	vector<int> ids, distances;
+	searcher.Search(queries, 100, &ids, &distances);
+	ASSERT_EQ(ids.size(), 3 * 30);
+	vector<int> expected_ids(30), expected_distances(30);
+	for (int i = 0; i < 3; ++i) {
+		BruteForce(metric, database, queries.code(i), 30, &expected_ids[0],
+				&expected_distances[0]);
+		EXPECT_TRUE(std::equal(expected_ids.begin(), expected_ids.end(),
+				ids.begin() + i * 30));
+		EXPECT_TRUE(std::equal(expected_distances.begin(),
+				expected_distances.end(), distances.begin() + i * 30));
+	}
+}
+
+}  // namespace caffe
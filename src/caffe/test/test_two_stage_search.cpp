@@ -0,0 +1,164 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/code_file.hpp"
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/mih_index.hpp"
+#include "caffe/util/two_stage_search.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class TwoStageSearchTest: public ::testing::Test {
+protected:
+	TwoStageSearchTest() :
+			dim_(24), num_(300), database_(24) {
+	}
+	virtual void SetUp() {
+		char filename[] = "/tmp/two_stage_search_XXXXXX";
+		close(mkstemp(filename));
+		filename_ = filename;
+		srand(1701);
+		features_.resize(num_ * dim_);
+		for (int i = 0; i < num_ * dim_; ++i) {
+			features_[i] = 2.f * rand() / RAND_MAX - 1.f;
+		}
+		CodeFileWriter writer;
+		writer.Open(filename_, CODE_FILE_FLOAT, dim_, dim_, NULL, NULL);
+		for (int i = 0; i < num_; ++i) {
+			writer.Append(&features_[i * dim_], "item");
+		}
+		writer.Close();
+		file_.Open(filename_);
+		file_.AdviseRandomAccess();
+		database_.AppendBatch(&features_[0], num_, dim_, (const int*) NULL);
+		index_.Build(database_);
+	}
+	virtual void TearDown() {
+		file_.Close();
+		remove(filename_.c_str());
+	}
+	float FloatDistance(const float* query, const int i) const {
+		float dist = 0;
+		for (int d = 0; d < dim_; ++d) {
+			const float diff = query[d] - features_[i * dim_ + d];
+			dist += diff * diff;
+		}
+		return dist;
+	}
+	// The float re-ranking of the Hamming top-shortlist items.
+	void Expected(const float* query, const int shortlist,
+			vector<std::pair<float, int> >* ranked) const {
+		uint64_t code[1];
+		BinarizeCode(query, dim_, (const int*) NULL, code);
+		vector<std::pair<int, int> > hamming(num_);
+		for (int i = 0; i < num_; ++i) {
+			hamming[i] = std::make_pair(database_.Distance(i, code), i);
+		}
+		std::sort(hamming.begin(), hamming.end());
+		ranked->clear();
+		for (int i = 0; i < std::min(shortlist, num_); ++i) {
+			ranked->push_back(std::make_pair(
+					FloatDistance(query, hamming[i].second), hamming[i].second));
+		}
+		std::sort(ranked->begin(), ranked->end());
+	}
+
+	string filename_;
+	int dim_;
+	int num_;
+	vector<float> features_;
+	CodeFile file_;
+	HashCodeStore database_;
+	MultiIndexHash index_;
+};
+
+TEST_F(TwoStageSearchTest, TestRerankShortlist) {
+	TwoStageSearcher searcher(index_, file_, 10);
+	for (int q = 0; q < 20; ++q) {
+		const float* query = &features_[(q * 13) * dim_];
+		uint64_t code[1];
+		BinarizeCode(query, dim_, (const int*) NULL, code);
+		const int shortlists[3] = { 1, 40, num_ };
+		for (int s = 0; s < 3; ++s) {
+			searcher.set_shortlist(shortlists[s]);
+			vector<std::pair<float, int> > expected;
+			Expected(query, shortlists[s], &expected);
+			vector<int> ids;
+			vector<float> distances;
+			TwoStageTiming timing;
+			searcher.Search(code, query, 5, &ids, &distances, &timing);
+			ASSERT_EQ(ids.size(), std::min<size_t>(5, expected.size()));
+			for (size_t i = 0; i < ids.size(); ++i) {
+				EXPECT_EQ(ids[i], expected[i].second);
+				EXPECT_FLOAT_EQ(distances[i], expected[i].first);
+			}
+			EXPECT_GE(timing.shortlist_us, 0);
+			EXPECT_GE(timing.rerank_us, 0);
+		}
+	}
+}
+
+TEST_F(TwoStageSearchTest, TestEvaluation) {
+	const int num_queries = 30, num_classes = 4;
+	HashCodeStore queries(dim_);
+	vector<float> query_features;
+	vector<int> query_classes, database_classes(num_);
+	vector<int> relevant_per_class(num_classes, 0);
+	for (int i = 0; i < num_; ++i) {
+		database_classes[i] = i % num_classes;
+		relevant_per_class[i % num_classes]++;
+	}
+	for (int q = 0; q < num_queries; ++q) {
+		const float* query = &features_[(q * 7) * dim_];
+		queries.Append(query, (const int*) NULL);
+		query_features.insert(query_features.end(), query, query + dim_);
+		query_classes.push_back(q % num_classes);
+	}
+	const int shortlist = 25;
+	TwoStageSearcher searcher(index_, file_, shortlist);
+	RetrievalMetrics metrics;
+	vector<double> values;
+	vector<TwoStageTiming> timings;
+	EvaluateTwoStage(searcher, queries, &query_features[0], &query_classes[0],
+			&database_classes[0], &relevant_per_class[0], metrics, 3, &values,
+			&timings);
+	ASSERT_EQ(values.size(), num_queries);
+	ASSERT_EQ(timings.size(), num_queries);
+	for (int q = 0; q < num_queries; ++q) {
+		vector<std::pair<float, int> > ranked;
+		Expected(&query_features[q * dim_], shortlist, &ranked);
+		// Each distinct float distance, then the unlisted rest.
+		vector<int> total, relevant;
+		int found = 0;
+		for (size_t j = 0; j < ranked.size(); ++j) {
+			const int hit = database_classes[ranked[j].second] == query_classes[q];
+			if (j == 0 || ranked[j].first != ranked[j - 1].first) {
+				total.push_back(0);
+				relevant.push_back(0);
+			}
+			total.back()++;
+			relevant.back() += hit;
+			found += hit;
+		}
+		const int num_relevant = relevant_per_class[query_classes[q]];
+		total.push_back(num_ - shortlist);
+		relevant.push_back(num_relevant - found);
+		EXPECT_NEAR(values[q],
+				AveragePrecision(&total[0], &relevant[0], total.size(),
+						num_relevant), 1e-12);
+	}
+}
+
+}  // namespace caffe
@@ -0,0 +1,66 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <cuda_runtime.h>
+
+#include "gtest/gtest.h"
+#include "caffe/util/unix_socket.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+TEST(UnixSocketTest, TestLineReader) {
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	// A line longer than one read chunk, an empty line and an unterminated
+	// tail that is dropped.
+	const string long_line(10000, 'x');
+	EXPECT_TRUE(WriteAll(fds[0], "first\n" + long_line + "\n\nsecond\ntail"));
+	close(fds[0]);
+	LineReader reader(fds[1]);
+	string line;
+	ASSERT_TRUE(reader.ReadLine(&line));
+	EXPECT_EQ(line, "first");
+	ASSERT_TRUE(reader.ReadLine(&line));
+	EXPECT_EQ(line, long_line);
+	ASSERT_TRUE(reader.ReadLine(&line));
+	EXPECT_EQ(line, "");
+	ASSERT_TRUE(reader.ReadLine(&line));
+	EXPECT_EQ(line, "second");
+	EXPECT_FALSE(reader.ReadLine(&line));
+	close(fds[1]);
+}
+
+TEST(UnixSocketTest, TestConnect) {
+	char directory[] = "/tmp/unix_socket_XXXXXX";
+	ASSERT_TRUE(mkdtemp(directory) != NULL);
+	const string path = string(directory) + "/socket";
+	const int listen_fd = ListenUnixSocket(path);
+	const int client_fd = ConnectUnixSocket(path);
+	const int server_fd = accept(listen_fd, NULL, NULL);
+	ASSERT_GE(server_fd, 0);
+	EXPECT_TRUE(WriteAll(client_fd, "ping\n"));
+	LineReader reader(server_fd);
+	string line;
+	ASSERT_TRUE(reader.ReadLine(&line));
+	EXPECT_EQ(line, "ping");
+	close(server_fd);
+	// Writing to a closed peer fails instead of raising SIGPIPE.
+	bool written = true;
+	for (int i = 0; i < 100 && written; ++i) {
+		written = WriteAll(client_fd, "pong\n");
+	}
+	EXPECT_FALSE(written);
+	close(client_fd);
+	close(listen_fd);
+	unlink(path.c_str());
+	rmdir(directory);
+}
+
+}  // namespace caffe
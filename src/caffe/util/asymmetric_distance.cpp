@@ -0,0 +1,156 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "caffe/util/asymmetric_distance.hpp"
+#include "caffe/util/parallel.hpp"
+
+using std::vector;
+
+namespace caffe {
+
+template<typename Dtype>
+AsymmetricDistance::AsymmetricDistance(const Dtype* weights, const int nbits) :
+		nbits_(nbits), words_(HashCodeWords(nbits)), weights_(nbits, 1.f), table_(
+				static_cast<size_t>(words_) * 8 * 256, 0.f) {
+	CHECK_GT(nbits, 0);
+	if (weights) {
+		for (int b = 0; b < nbits; ++b) {
+			weights_[b] = std::fabs(static_cast<float>(weights[b]));
+		}
+	}
+}
+
+template AsymmetricDistance::AsymmetricDistance<float>(const float* weights,
+		const int nbits);
+template AsymmetricDistance::AsymmetricDistance<double>(const double* weights,
+		const int nbits);
+
+template<typename Dtype>
+void AsymmetricDistance::SetQuery(const Dtype* feature, const int* bit_order) {
+	for (int p = 0; p < words_ * 8; ++p) {
+		float* table = &table_[p * 256];
+		// Cost of every bit of the byte when clear, and how much setting it
+		// changes that: w (q - 1)^2 - w (q + 1)^2 = -4 w q.
+		float clear = 0, delta[8];
+		for (int k = 0; k < 8; ++k) {
+			const int b = p * 8 + k;
+			if (b < nbits_) {
+				const float q = feature[bit_order ? bit_order[b] : b];
+				clear += weights_[b] * (q + 1) * (q + 1);
+				delta[k] = -4 * weights_[b] * q;
+			} else {
+				delta[k] = 0;
+			}
+		}
+		table[0] = clear;
+		for (int v = 1; v < 256; ++v) {
+			const int low = v & -v;
+			table[v] = table[v ^ low] + delta[__builtin_ctz(low)];
+		}
+	}
+}
+
+template void AsymmetricDistance::SetQuery<float>(const float* feature,
+		const int* bit_order);
+template void AsymmetricDistance::SetQuery<double>(const double* feature,
+		const int* bit_order);
+
+void AsymmetricDistance::Rerank(const HashCodeStore& database, const int k,
+		vector<int>* ids, vector<float>* distances) const {
+	vector<std::pair<float, int> > scored(ids->size());
+	for (size_t i = 0; i < ids->size(); ++i) {
+		scored[i] = std::make_pair((*this)(database.code((*ids)[i])), (*ids)[i]);
+	}
+	const size_t kept = (k < 0) ? scored.size() :
+			std::min(scored.size(), static_cast<size_t>(k));
+	std::partial_sort(scored.begin(), scored.begin() + kept, scored.end());
+	ids->resize(kept);
+	distances->resize(kept);
+	for (size_t i = 0; i < kept; ++i) {
+		(*distances)[i] = scored[i].first;
+		(*ids)[i] = scored[i].second;
+	}
+}
+
+struct AsymmetricEvalTask {
+	const AsymmetricDistance* distance;
+	const float* queries;
+	int num_queries;
+	int dim;
+	const int* bit_order;
+	const int* query_classes;
+	const HashCodeStore* database;
+	const int* database_classes;
+	const int* relevant_per_class;
+	const RetrievalMetrics* metrics;
+	double* values;
+};
+
+static void AsymmetricEvalWorker(WorkQueue* queue, void* task_pointer) {
+	AsymmetricEvalTask* task =
+			reinterpret_cast<AsymmetricEvalTask*>(task_pointer);
+	// The tables are per query, so every worker scores with its own copy.
+	AsymmetricDistance distance(*task->distance);
+	const int database_num = task->database->num();
+	vector<std::pair<float, int> > scored(database_num);
+	vector<int> total, relevant;
+	int begin, end;
+	while (queue->Next(&begin, &end)) {
+		for (int i = begin; i < end; ++i) {
+			const int query_class = task->query_classes[i];
+			distance.SetQuery(task->queries + i * task->dim, task->bit_order);
+			for (int j = 0; j < database_num; ++j) {
+				scored[j] = std::make_pair(distance(task->database->code(j)),
+						task->database_classes[j] == query_class);
+			}
+			std::sort(scored.begin(), scored.end());
+			// Equal distances form one tie group.
+			total.clear();
+			relevant.clear();
+			for (int j = 0; j < database_num; ++j) {
+				if (j == 0 || scored[j].first != scored[j - 1].first) {
+					total.push_back(0);
+					relevant.push_back(0);
+				}
+				total.back()++;
+				relevant.back() += scored[j].second;
+			}
+			task->metrics->Compute(&total[0], &relevant[0], total.size(),
+					task->relevant_per_class[query_class],
+					task->values + i * task->metrics->size());
+		}
+	}
+}
+
+void EvaluateAsymmetric(const AsymmetricDistance& distance,
+		const float* queries, const int num_queries, const int dim,
+		const int* bit_order, const int* query_classes,
+		const HashCodeStore& database, const int* database_classes,
+		const int* relevant_per_class, const RetrievalMetrics& metrics,
+		const int num_threads, vector<double>* values) {
+	CHECK_LT(metrics.radius(), 0)
+			<< "Radius metrics need integer distances.";
+	CHECK_LE(distance.nbits(), database.nbits());
+	values->assign(num_queries * metrics.size(), 0.);
+	if (num_queries == 0 || database.num() == 0) {
+		return;
+	}
+	AsymmetricEvalTask task;
+	task.distance = &distance;
+	task.queries = queries;
+	task.num_queries = num_queries;
+	task.dim = dim;
+	task.bit_order = bit_order;
+	task.query_classes = query_classes;
+	task.database = &database;
+	task.database_classes = database_classes;
+	task.relevant_per_class = relevant_per_class;
+	task.metrics = &metrics;
+	task.values = &(*values)[0];
+	ParallelFor(num_queries, 16, num_threads, AsymmetricEvalWorker, &task);
+}
+
+}  // namespace caffe
@@ -0,0 +1,174 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <algorithm>
+#include <utility>
+
+#include "caffe/util/bit_plane.hpp"
+
+using std::vector;
+
+namespace caffe {
+
+const int BitPlaneStore::kCheckInterval;
+const int BitPlaneStore::kSparseRatio;
+
+void BitPlaneStore::Build(const HashCodeStore& codes, const int* weights) {
+	nbits_ = codes.nbits();
+	num_ = codes.num();
+	blocks_ = (num_ + 63) / 64;
+	weights_.assign(nbits_, 1);
+	if (weights) {
+		weights_.assign(weights, weights + nbits_);
+	}
+	remaining_.assign(nbits_ + 1, 0);
+	for (int b = nbits_ - 1; b >= 0; --b) {
+		CHECK_GE(weights_[b], 0);
+		remaining_[b] = remaining_[b + 1] + weights_[b];
+	}
+	slices_ = 1;
+	while ((1 << slices_) <= remaining_[0]) {
+		++slices_;
+	}
+	planes_.assign(static_cast<size_t>(nbits_) * blocks_, 0);
+	for (int i = 0; i < num_; ++i) {
+		const uint64_t* code = codes.code(i);
+		const uint64_t item = uint64_t(1) << (i % 64);
+		for (int b = 0; b < nbits_; ++b) {
+			if ((code[b / 64] >> (b % 64)) & 1) {
+				planes_[static_cast<size_t>(b) * blocks_ + i / 64] |= item;
+			}
+		}
+	}
+}
+
+// Partial distance of item j of a block from its bit-sliced counters.
+static inline int SlicedValue(const uint64_t* counters, const int slices,
+		const int j) {
+	int value = 0;
+	for (int s = 0; s < slices; ++s) {
+		value |= static_cast<int>((counters[s] >> j) & 1) << s;
+	}
+	return value;
+}
+
+void BitPlaneStore::KnnSearch(const uint64_t* query, const int k,
+		vector<int>* ids, vector<int>* distances, float* scanned) const {
+	ids->clear();
+	distances->clear();
+	if (num_ == 0 || k <= 0) {
+		if (scanned) {
+			*scanned = 0;
+		}
+		return;
+	}
+	vector<uint64_t> counters(static_cast<size_t>(blocks_) * slices_, 0);
+	vector<uint64_t> alive(blocks_, ~uint64_t(0));
+	if (num_ % 64) {
+		alive.back() = (uint64_t(1) << (num_ % 64)) - 1;
+	}
+	vector<int> live(blocks_);
+	for (int blk = 0; blk < blocks_; ++blk) {
+		live[blk] = blk;
+	}
+	vector<int> bounds;
+	// Plane words read, where a sparse pass over n items counts n / 64.
+	double read = 0;
+	int p = 0;
+	size_t alive_items = num_;
+	while (p < nbits_ && alive_items * kSparseRatio >= live.size() * 64) {
+		const int end = std::min(p + kCheckInterval, nbits_);
+		for (size_t l = 0; l < live.size(); ++l) {
+			const int blk = live[l];
+			uint64_t* counter = &counters[static_cast<size_t>(blk) * slices_];
+			for (int b = p; b < end; ++b) {
+				const uint64_t diff = planes_[static_cast<size_t>(b) * blocks_
+						+ blk] ^ (((query[b / 64] >> (b % 64)) & 1) ?
+						~uint64_t(0) : 0);
+				// Adds weight * diff to the counters, one set weight bit at a
+				// time with a ripple carry.
+				for (int w = weights_[b], s0 = 0; w; w >>= 1, ++s0) {
+					if (!(w & 1)) {
+						continue;
+					}
+					uint64_t carry = diff;
+					for (int s = s0; s < slices_ && carry; ++s) {
+						const uint64_t next = counter[s] & carry;
+						counter[s] ^= carry;
+						carry = next;
+					}
+				}
+			}
+		}
+		read += static_cast<double>(live.size()) * (end - p);
+		p = end;
+		if (p == nbits_) {
+			break;
+		}
+		// Every item scores at most partial + remaining_[p], so the k-th
+		// smallest such bound is at least the k-th best distance.
+		bounds.clear();
+		for (size_t l = 0; l < live.size(); ++l) {
+			const int blk = live[l];
+			const uint64_t* counter =
+					&counters[static_cast<size_t>(blk) * slices_];
+			for (uint64_t a = alive[blk]; a; a &= a - 1) {
+				bounds.push_back(SlicedValue(counter, slices_,
+						__builtin_ctzll(a)) + remaining_[p]);
+			}
+		}
+		if (static_cast<int>(bounds.size()) <= k) {
+			continue;
+		}
+		std::nth_element(bounds.begin(), bounds.begin() + k - 1, bounds.end());
+		const int threshold = bounds[k - 1];
+		size_t kept = 0;
+		alive_items = 0;
+		for (size_t l = 0; l < live.size(); ++l) {
+			const int blk = live[l];
+			const uint64_t* counter =
+					&counters[static_cast<size_t>(blk) * slices_];
+			for (uint64_t a = alive[blk]; a; a &= a - 1) {
+				const int j = __builtin_ctzll(a);
+				// Strictly greater, so items tied with the k-th stay.
+				if (SlicedValue(counter, slices_, j) > threshold) {
+					alive[blk] &= ~(uint64_t(1) << j);
+				}
+			}
+			if (alive[blk]) {
+				live[kept++] = blk;
+				alive_items += __builtin_popcountll(alive[blk]);
+			}
+		}
+		live.resize(kept);
+	}
+
+	// Once the survivors are sparse in their blocks, the rest of their
+	// planes is read bit by bit.
+	vector<std::pair<int, int> > scored;
+	for (size_t l = 0; l < live.size(); ++l) {
+		const int blk = live[l];
+		const uint64_t* counter = &counters[static_cast<size_t>(blk) * slices_];
+		for (uint64_t a = alive[blk]; a; a &= a - 1) {
+			const int j = __builtin_ctzll(a);
+			int dist = SlicedValue(counter, slices_, j);
+			for (int b = p; b < nbits_; ++b) {
+				const uint64_t bit = (planes_[static_cast<size_t>(b) * blocks_
+						+ blk] >> j) ^ (query[b / 64] >> (b % 64));
+				dist += (bit & 1) ? weights_[b] : 0;
+			}
+			scored.push_back(std::make_pair(dist, blk * 64 + j));
+		}
+	}
+	read += static_cast<double>(scored.size()) * (nbits_ - p) / 64;
+	const size_t result = std::min(scored.size(), static_cast<size_t>(k));
+	std::partial_sort(scored.begin(), scored.begin() + result, scored.end());
+	for (size_t i = 0; i < result; ++i) {
+		distances->push_back(scored[i].first);
+		ids->push_back(scored[i].second);
+	}
+	if (scanned) {
+		*scanned = read / (static_cast<double>(nbits_) * blocks_);
+	}
+}
+
+}  // namespace caffe
@@ -0,0 +1,155 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "caffe/util/code_file.hpp"
+#include "caffe/util/hash_code.hpp"
+
+using std::string;
+using std::vector;
+
+namespace caffe {
+
+static const char kCodeFileMagic[8] = { 'B', 'S', 'D', 'H', 'C', 'O', 'D',
+		'E' };
+static const uint32_t kCodeFileVersion = 1;
+
+static uint64_t Align8(const uint64_t offset) {
+	return (offset + 7) & ~uint64_t(7);
+}
+
+static void PadTo(std::ofstream* file, const uint64_t offset) {
+	static const char zeros[8] = { 0 };
+	const uint64_t pos = file->tellp();
+	CHECK_LE(pos, offset);
+	file->write(zeros, offset - pos);
+}
+
+CodeFileWriter::~CodeFileWriter() {
+	if (file_.is_open()) {
+		Close();
+	}
+}
+
+void CodeFileWriter::Open(const string& filename, const CodeFileType type,
+		const int dim, const int code_bits, const int* bit_order,
+		const float* weights) {
+	CHECK(!file_.is_open()) << "CodeFileWriter is already open.";
+	CHECK_GT(dim, 0);
+	if (type == CODE_FILE_PACKED_BITS) {
+		CHECK_EQ(dim, code_bits) << "Packed files hold code_bits bits per row.";
+		row_bytes_ = HashCodeWords(code_bits) * sizeof(uint64_t);
+	} else {
+		row_bytes_ = dim * sizeof(float);
+	}
+	filename_ = filename;
+	file_.open(filename.c_str(),
+			std::ios::out | std::ios::trunc | std::ios::binary);
+	CHECK(file_) << "Failed to open " << filename;
+
+	memset(&header_, 0, sizeof(header_));
+	memcpy(header_.magic, kCodeFileMagic, sizeof(header_.magic));
+	header_.version = kCodeFileVersion;
+	header_.type = type;
+	header_.dim = dim;
+	header_.code_bits = code_bits;
+	header_.row_bytes = row_bytes_;
+	header_.bit_order_offset = Align8(sizeof(header_));
+	uint64_t offset = Align8(header_.bit_order_offset + dim * sizeof(int));
+	if (weights) {
+		header_.weights_offset = offset;
+		offset = Align8(offset + dim * sizeof(float));
+	}
+	header_.data_offset = offset;
+
+	// The header is rewritten with the final counts by Close().
+	file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+	PadTo(&file_, header_.bit_order_offset);
+	for (int i = 0; i < dim; ++i) {
+		const int32_t dim_i = bit_order ? bit_order[i] : i;
+		file_.write(reinterpret_cast<const char*>(&dim_i), sizeof(dim_i));
+	}
+	if (weights) {
+		PadTo(&file_, header_.weights_offset);
+		file_.write(reinterpret_cast<const char*>(weights),
+				dim * sizeof(float));
+	}
+	PadTo(&file_, header_.data_offset);
+	count_ = 0;
+	name_offsets_.assign(1, 0);
+	names_.clear();
+}
+
+void CodeFileWriter::Append(const void* row, const string& name) {
+	CHECK(file_.is_open()) << "CodeFileWriter is not open.";
+	file_.write(reinterpret_cast<const char*>(row), row_bytes_);
+	names_ += name;
+	name_offsets_.push_back(names_.size());
+	++count_;
+}
+
+void CodeFileWriter::Close() {
+	CHECK(file_.is_open()) << "CodeFileWriter is not open.";
+	header_.count = count_;
+	header_.names_offset = Align8(header_.data_offset + count_ * row_bytes_);
+	PadTo(&file_, header_.names_offset);
+	file_.write(reinterpret_cast<const char*>(&name_offsets_[0]),
+			name_offsets_.size() * sizeof(uint64_t));
+	file_.write(names_.data(), names_.size());
+	header_.file_size = file_.tellp();
+	file_.seekp(0);
+	file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+	CHECK(file_) << "Failed to write " << filename_;
+	file_.close();
+	name_offsets_.clear();
+	names_.clear();
+}
+
+void CodeFile::Open(const string& filename) {
+	Close();
+	int fd = open(filename.c_str(), O_RDONLY);
+	CHECK_NE(fd, -1) << "File not found: " << filename;
+	struct stat st;
+	CHECK_EQ(fstat(fd, &st), 0) << "Failed to stat " << filename;
+	size_ = st.st_size;
+	CHECK_GE(size_, sizeof(CodeFileHeader)) << filename << " is truncated.";
+	void* data = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	CHECK(data != MAP_FAILED) << "Failed to mmap " << filename;
+	data_ = reinterpret_cast<const char*>(data);
+	header_ = reinterpret_cast<const CodeFileHeader*>(data_);
+	CHECK_EQ(memcmp(header_->magic, kCodeFileMagic, sizeof(kCodeFileMagic)), 0)
+			<< filename << " is not a code file.";
+	CHECK_EQ(header_->version, kCodeFileVersion)
+			<< "Unsupported code file version in " << filename;
+	CHECK_EQ(header_->file_size, size_) << filename << " is truncated.";
+}
+
+void CodeFile::Close() {
+	if (data_) {
+		munmap(const_cast<char*>(data_), size_);
+	}
+	data_ = NULL;
+	size_ = 0;
+	header_ = NULL;
+}
+
+void CodeFile::names(vector<string>* names) const {
+	names->resize(count());
+	for (int i = 0; i < count(); ++i) {
+		(*names)[i] = name(i);
+	}
+}
+
+void CodeFile::AdviseRandomAccess() const {
+	CHECK(is_open());
+	CHECK_EQ(madvise(const_cast<char*>(data_), size_, MADV_RANDOM), 0)
+			<< "madvise failed.";
+}
+
+}  // namespace caffe
@@ -0,0 +1,184 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+
+#include "caffe/util/dataset_manifest.hpp"
+
+using std::string;
+using std::vector;
+
+namespace caffe {
+
+static const char kManifestMagic[8] = { 'B', 'S', 'D', 'H', 'L', 'I', 'S',
+		'T' };
+static const uint32_t kManifestVersion = 1;
+
+static uint64_t Align8(const uint64_t offset) {
+	return (offset + 7) & ~uint64_t(7);
+}
+
+static void PadTo(std::ofstream* file, const uint64_t offset) {
+	static const char zeros[8] = { 0 };
+	const uint64_t pos = file->tellp();
+	CHECK_LE(pos, offset);
+	file->write(zeros, offset - pos);
+}
+
+// Writes a string table: num + 1 offsets, then the characters. Returns the
+// offset just past it.
+static uint64_t WriteStrings(std::ofstream* file, const uint64_t offset,
+		const vector<string>& strings) {
+	PadTo(file, offset);
+	uint64_t position = 0;
+	file->write(reinterpret_cast<const char*>(&position), sizeof(position));
+	for (size_t i = 0; i < strings.size(); ++i) {
+		position += strings[i].size();
+		file->write(reinterpret_cast<const char*>(&position), sizeof(position));
+	}
+	for (size_t i = 0; i < strings.size(); ++i) {
+		file->write(strings[i].data(), strings[i].size());
+	}
+	return offset + (strings.size() + 1) * sizeof(uint64_t) + position;
+}
+
+static void WriteInts(std::ofstream* file, const uint64_t offset,
+		const vector<int32_t>& values) {
+	PadTo(file, offset);
+	if (!values.empty()) {
+		file->write(reinterpret_cast<const char*>(&values[0]),
+				values.size() * sizeof(int32_t));
+	}
+}
+
+void ParseImageName(const string& filename, string* class_name,
+		int* image_id) {
+	const size_t underscore = filename.find_last_of('_');
+	*class_name = filename.substr(0, underscore);
+	const size_t begin = underscore + 1;
+	const size_t dot = filename.find_last_of('.');
+	*image_id = atoi(filename.substr(begin, dot - begin).c_str());
+}
+
+int CompileDatasetManifest(const string& list_file,
+		const string& manifest_file) {
+	std::ifstream list(list_file.c_str());
+	CHECK(list) << "Failed to open " << list_file;
+	vector<string> names, class_names;
+	vector<int32_t> class_ids, image_ids, class_counts;
+	std::map<string, int> class2id;
+	string line, class_name;
+	int image_id;
+	while (list >> line) {
+		ParseImageName(line, &class_name, &image_id);
+		std::map<string, int>::iterator iter = class2id.find(class_name);
+		if (iter == class2id.end()) {
+			iter = class2id.insert(iter,
+					std::make_pair(class_name, static_cast<int>(class_names.size())));
+			class_names.push_back(class_name);
+			class_counts.push_back(0);
+		}
+		names.push_back(line);
+		class_ids.push_back(iter->second);
+		image_ids.push_back(image_id);
+		class_counts[iter->second]++;
+	}
+
+	DatasetManifestHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kManifestMagic, sizeof(header.magic));
+	header.version = kManifestVersion;
+	header.num_classes = class_names.size();
+	header.count = names.size();
+	header.class_ids_offset = Align8(sizeof(header));
+	header.image_ids_offset = Align8(header.class_ids_offset
+			+ header.count * sizeof(int32_t));
+	header.class_counts_offset = Align8(header.image_ids_offset
+			+ header.count * sizeof(int32_t));
+	header.names_offset = Align8(header.class_counts_offset
+			+ header.num_classes * sizeof(int32_t));
+
+	std::ofstream file(manifest_file.c_str(),
+			std::ios::out | std::ios::trunc | std::ios::binary);
+	CHECK(file) << "Failed to open " << manifest_file;
+	// The header is rewritten once the string tables are placed.
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	WriteInts(&file, header.class_ids_offset, class_ids);
+	WriteInts(&file, header.image_ids_offset, image_ids);
+	WriteInts(&file, header.class_counts_offset, class_counts);
+	header.class_names_offset = Align8(WriteStrings(&file, header.names_offset,
+			names));
+	header.file_size = WriteStrings(&file, header.class_names_offset,
+			class_names);
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	CHECK(file) << "Failed to write " << manifest_file;
+	return names.size();
+}
+
+void DatasetManifest::Open(const string& filename) {
+	Close();
+	int fd = open(filename.c_str(), O_RDONLY);
+	CHECK_NE(fd, -1) << "File not found: " << filename;
+	struct stat st;
+	CHECK_EQ(fstat(fd, &st), 0) << "Failed to stat " << filename;
+	size_ = st.st_size;
+	CHECK_GE(size_, sizeof(DatasetManifestHeader)) << filename
+			<< " is truncated.";
+	void* data = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	CHECK(data != MAP_FAILED) << "Failed to mmap " << filename;
+	data_ = reinterpret_cast<const char*>(data);
+	header_ = reinterpret_cast<const DatasetManifestHeader*>(data_);
+	CHECK_EQ(memcmp(header_->magic, kManifestMagic, sizeof(kManifestMagic)), 0)
+			<< filename << " is not a dataset manifest.";
+	CHECK_EQ(header_->version, kManifestVersion)
+			<< "Unsupported manifest version in " << filename;
+	CHECK_EQ(header_->file_size, size_) << filename << " is truncated.";
+}
+
+void DatasetManifest::Close() {
+	if (data_) {
+		munmap(const_cast<char*>(data_), size_);
+	}
+	data_ = NULL;
+	size_ = 0;
+	header_ = NULL;
+}
+
+void DatasetManifest::Select(const int lower, const int upper,
+		vector<int>* records) const {
+	records->clear();
+	const int32_t* image_ids = Section<int32_t>(header_->image_ids_offset);
+	for (int i = 0; i < count(); ++i) {
+		if (image_ids[i] >= lower && image_ids[i] <= upper) {
+			records->push_back(i);
+		}
+	}
+}
+
+void DatasetManifest::AssignClasses(const vector<int>& records,
+		vector<int>* class_ids, vector<int>* count_per_class) const {
+	const int32_t* ids = Section<int32_t>(header_->class_ids_offset);
+	vector<int> dense(num_classes(), -1);
+	class_ids->resize(records.size());
+	count_per_class->clear();
+	for (size_t i = 0; i < records.size(); ++i) {
+		int& id = dense[ids[records[i]]];
+		if (id < 0) {
+			id = count_per_class->size();
+			count_per_class->push_back(0);
+		}
+		(*class_ids)[i] = id;
+		(*count_per_class)[id]++;
+	}
+}
+
+}  // namespace caffe
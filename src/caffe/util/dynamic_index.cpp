@@ -0,0 +1,274 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <algorithm>
+#include <utility>
+
+#include "caffe/util/dynamic_index.hpp"
+
+using std::vector;
+
+namespace caffe {
+
+DynamicHashIndex::DynamicHashIndex(const int nbits) :
+		nbits_(nbits), words_(HashCodeWords(nbits)), compacting_(false), compaction_running_(
+				false), stop_compaction_(false), min_pending_(0) {
+	pthread_mutex_init(&snapshot_mutex_, NULL);
+	pthread_mutex_init(&update_mutex_, NULL);
+	pthread_mutex_init(&compaction_mutex_, NULL);
+	pthread_cond_init(&compaction_cond_, NULL);
+	Segment* base = new Segment();
+	base->codes.Reset(nbits);
+	Snapshot empty;
+	empty.base.reset(base);
+	empty.dead.reset(new std::set<int>());
+	empty.live = 0;
+	Publish(empty);
+}
+
+DynamicHashIndex::~DynamicHashIndex() {
+	if (compaction_running_) {
+		StopCompactionThread();
+	}
+	pthread_cond_destroy(&compaction_cond_);
+	pthread_mutex_destroy(&compaction_mutex_);
+	pthread_mutex_destroy(&update_mutex_);
+	pthread_mutex_destroy(&snapshot_mutex_);
+}
+
+shared_ptr<const DynamicHashIndex::Snapshot> DynamicHashIndex::snapshot() const {
+	pthread_mutex_lock(&snapshot_mutex_);
+	shared_ptr<const Snapshot> current = current_;
+	pthread_mutex_unlock(&snapshot_mutex_);
+	return current;
+}
+
+void DynamicHashIndex::Publish(const Snapshot& snapshot) {
+	shared_ptr<const Snapshot> next(new Snapshot(snapshot));
+	pthread_mutex_lock(&snapshot_mutex_);
+	current_.swap(next);
+	pthread_mutex_unlock(&snapshot_mutex_);
+	// The previous snapshot is released here, outside the lock, unless a
+	// reader still holds it.
+}
+
+int DynamicHashIndex::size() const {
+	return snapshot()->live;
+}
+
+int DynamicHashIndex::pending() const {
+	shared_ptr<const Snapshot> current = snapshot();
+	return current->delta_keys.size() + current->dead->size();
+}
+
+bool DynamicHashIndex::NeedsCompaction(const Snapshot& snapshot) const {
+	const int pending = snapshot.delta_keys.size() + snapshot.dead->size();
+	return pending > std::max(min_pending_, snapshot.base->codes.num() / 8);
+}
+
+void DynamicHashIndex::ApplyInsert(const int key, const uint64_t* code,
+		Snapshot* snapshot) {
+	ApplyRemove(key, snapshot);
+	snapshot->delta_codes.insert(snapshot->delta_codes.end(), code,
+			code + words_);
+	snapshot->delta_keys.push_back(key);
+	locations_[key] = -1;
+	++snapshot->live;
+}
+
+bool DynamicHashIndex::ApplyRemove(const int key, Snapshot* snapshot) {
+	LocationMap::iterator location = locations_.find(key);
+	if (location == locations_.end()) {
+		return false;
+	}
+	if (location->second >= 0) {
+		std::set<int>* dead = new std::set<int>(*snapshot->dead);
+		dead->insert(location->second);
+		snapshot->dead.reset(dead);
+	} else {
+		const int j = std::find(snapshot->delta_keys.begin(),
+				snapshot->delta_keys.end(), key) - snapshot->delta_keys.begin();
+		snapshot->delta_keys.erase(snapshot->delta_keys.begin() + j);
+		snapshot->delta_codes.erase(
+				snapshot->delta_codes.begin() + static_cast<size_t>(j) * words_,
+				snapshot->delta_codes.begin()
+						+ static_cast<size_t>(j + 1) * words_);
+	}
+	locations_.erase(location);
+	--snapshot->live;
+	return true;
+}
+
+void DynamicHashIndex::Insert(const int key, const uint64_t* code) {
+	pthread_mutex_lock(&update_mutex_);
+	Snapshot next = *snapshot();
+	ApplyInsert(key, code, &next);
+	if (compacting_) {
+		Update update;
+		update.insert = true;
+		update.key = key;
+		update.code.assign(code, code + words_);
+		missed_updates_.push_back(update);
+	}
+	Publish(next);
+	if (compaction_running_ && NeedsCompaction(next)) {
+		pthread_cond_signal(&compaction_cond_);
+	}
+	pthread_mutex_unlock(&update_mutex_);
+}
+
+bool DynamicHashIndex::Remove(const int key) {
+	pthread_mutex_lock(&update_mutex_);
+	Snapshot next = *snapshot();
+	const bool removed = ApplyRemove(key, &next);
+	if (removed) {
+		if (compacting_) {
+			Update update;
+			update.insert = false;
+			update.key = key;
+			missed_updates_.push_back(update);
+		}
+		Publish(next);
+		if (compaction_running_ && NeedsCompaction(next)) {
+			pthread_cond_signal(&compaction_cond_);
+		}
+	}
+	pthread_mutex_unlock(&update_mutex_);
+	return removed;
+}
+
+void DynamicHashIndex::KnnSearch(const uint64_t* query, const int k,
+		vector<int>* keys, vector<int>* distances) const {
+	shared_ptr<const Snapshot> current = snapshot();
+	const Segment& base = *current->base;
+	const std::set<int>& dead = *current->dead;
+	// (distance, key)
+	vector<std::pair<int, int> > results;
+	if (base.codes.num() > 0 && k > 0) {
+		// Base slots are in key order, so the MIH tie-break by slot is the
+		// tie-break by key, and k live items are among the first
+		// k + |dead| results.
+		vector<int> ids, dists;
+		base.index.KnnSearch(query, k + dead.size(), &ids, &dists);
+		for (size_t i = 0; i < ids.size(); ++i) {
+			if (dead.find(ids[i]) == dead.end()) {
+				results.push_back(std::make_pair(dists[i], base.keys[ids[i]]));
+			}
+		}
+	}
+	for (size_t j = 0; j < current->delta_keys.size(); ++j) {
+		results.push_back(
+				std::make_pair(
+						HammingDistance(&current->delta_codes[j * words_], query,
+								words_), current->delta_keys[j]));
+	}
+	const int count = std::min<int>(std::max(k, 0), results.size());
+	std::partial_sort(results.begin(), results.begin() + count, results.end());
+	keys->resize(count);
+	distances->resize(count);
+	for (int i = 0; i < count; ++i) {
+		(*distances)[i] = results[i].first;
+		(*keys)[i] = results[i].second;
+	}
+}
+
+void DynamicHashIndex::Compact() {
+	pthread_mutex_lock(&compaction_mutex_);
+	pthread_mutex_lock(&update_mutex_);
+	shared_ptr<const Snapshot> start = snapshot();
+	compacting_ = true;
+	missed_updates_.clear();
+	pthread_mutex_unlock(&update_mutex_);
+
+	// Build the new base from the live items of the starting snapshot,
+	// without holding any lock.
+	const Segment& old_base = *start->base;
+	vector<std::pair<int, const uint64_t*> > items;
+	items.reserve(start->live);
+	for (int i = 0; i < old_base.codes.num(); ++i) {
+		if (start->dead->find(i) == start->dead->end()) {
+			items.push_back(std::make_pair(old_base.keys[i], old_base.codes.code(i)));
+		}
+	}
+	for (size_t j = 0; j < start->delta_keys.size(); ++j) {
+		items.push_back(
+				std::make_pair(start->delta_keys[j],
+						&start->delta_codes[j * words_]));
+	}
+	std::sort(items.begin(), items.end());
+	Segment* base = new Segment();
+	base->codes.Reset(nbits_);
+	base->codes.Reserve(items.size());
+	base->keys.resize(items.size());
+	LocationMap locations;
+	const int num_items = items.size();
+	for (int i = 0; i < num_items; ++i) {
+		base->codes.AppendCode(items[i].second);
+		base->keys[i] = items[i].first;
+		locations.insert(locations.end(), std::make_pair(items[i].first, i));
+	}
+	if (!items.empty()) {
+		base->index.Build(base->codes);
+	}
+
+	// Swap it in and replay what changed in the meantime.
+	pthread_mutex_lock(&update_mutex_);
+	Snapshot next;
+	next.base.reset(base);
+	next.dead.reset(new std::set<int>());
+	next.live = items.size();
+	locations_.swap(locations);
+	for (size_t i = 0; i < missed_updates_.size(); ++i) {
+		if (missed_updates_[i].insert) {
+			ApplyInsert(missed_updates_[i].key, &missed_updates_[i].code[0],
+					&next);
+		} else {
+			ApplyRemove(missed_updates_[i].key, &next);
+		}
+	}
+	missed_updates_.clear();
+	compacting_ = false;
+	Publish(next);
+	pthread_mutex_unlock(&update_mutex_);
+	pthread_mutex_unlock(&compaction_mutex_);
+}
+
+void DynamicHashIndex::StartCompactionThread(const int min_pending) {
+	pthread_mutex_lock(&update_mutex_);
+	CHECK(!compaction_running_) << "Compaction thread already running.";
+	min_pending_ = min_pending;
+	stop_compaction_ = false;
+	compaction_running_ = true;
+	pthread_mutex_unlock(&update_mutex_);
+	CHECK(!pthread_create(&compaction_thread_, NULL, CompactionEntry, this))
+			<< "Pthread execution failed.";
+}
+
+void DynamicHashIndex::StopCompactionThread() {
+	pthread_mutex_lock(&update_mutex_);
+	stop_compaction_ = true;
+	pthread_cond_signal(&compaction_cond_);
+	pthread_mutex_unlock(&update_mutex_);
+	CHECK(!pthread_join(compaction_thread_, NULL)) << "Pthread joining failed.";
+	compaction_running_ = false;
+}
+
+void* DynamicHashIndex::CompactionEntry(void* arg) {
+	reinterpret_cast<DynamicHashIndex*>(arg)->CompactionLoop();
+	return NULL;
+}
+
+void DynamicHashIndex::CompactionLoop() {
+	pthread_mutex_lock(&update_mutex_);
+	while (!stop_compaction_) {
+		if (NeedsCompaction(*snapshot())) {
+			pthread_mutex_unlock(&update_mutex_);
+			Compact();
+			pthread_mutex_lock(&update_mutex_);
+		} else {
+			pthread_cond_wait(&compaction_cond_, &update_mutex_);
+		}
+	}
+	pthread_mutex_unlock(&update_mutex_);
+}
+
+}  // namespace caffe
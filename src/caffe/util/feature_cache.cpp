@@ -0,0 +1,72 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "caffe/util/feature_cache.hpp"
+
+using std::string;
+using std::vector;
+
+namespace caffe {
+
+uint64_t FingerprintFile(const string& filename, const uint64_t seed) {
+	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+	CHECK(file) << "Failed to open " << filename;
+	uint64_t hash = seed;
+	char buffer[1 << 16];
+	while (file) {
+		file.read(buffer, sizeof(buffer));
+		const std::streamsize got = file.gcount();
+		for (std::streamsize i = 0; i < got; ++i) {
+			hash ^= static_cast<unsigned char>(buffer[i]);
+			hash *= 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+string FeatureCache::Key(const vector<string>& files) {
+	uint64_t hash = kFingerprintSeed;
+	for (size_t i = 0; i < files.size(); ++i) {
+		hash = FingerprintFile(files[i], hash);
+		// Separate the files so moving bytes between them changes the key.
+		hash = (hash ^ 0xff) * 1099511628211ULL;
+	}
+	std::ostringstream key;
+	key << std::hex;
+	key.width(16);
+	key.fill('0');
+	key << hash;
+	return key.str();
+}
+
+bool FeatureCache::Lookup(const string& key, CodeFile* file) const {
+	const string path = EntryPath(key);
+	if (access(path.c_str(), R_OK) != 0) {
+		return false;
+	}
+	file->Open(path);
+	return true;
+}
+
+string FeatureCache::PendingPath(const string& key) const {
+	const string pattern = EntryPath(key) + ".XXXXXX";
+	vector<char> path(pattern.begin(), pattern.end());
+	path.push_back('\0');
+	const int fd = mkstemp(&path[0]);
+	CHECK_GE(fd, 0) << "Failed to create a pending cache entry for " << pattern;
+	close(fd);
+	return string(&path[0]);
+}
+
+void FeatureCache::Commit(const string& pending_path, const string& key) const {
+	CHECK_EQ(rename(pending_path.c_str(), EntryPath(key).c_str()), 0)
+			<< "Failed to publish cache entry " << EntryPath(key);
+}
+
+}  // namespace caffe
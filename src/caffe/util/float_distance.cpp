@@ -0,0 +1,160 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <algorithm>
+#include <utility>
+
+#include "caffe/util/float_distance.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
+
+using std::vector;
+
+namespace caffe {
+
+template<typename Dtype>
+void GatherDimensions(const Dtype* features, const int num, const int dim,
+		const int* dims, const int ndims, Dtype* gathered) {
+	CHECK_LE(ndims, dim);
+	for (int i = 0; i < num; ++i) {
+		const Dtype* feature = features + static_cast<size_t>(i) * dim;
+		Dtype* row = gathered + static_cast<size_t>(i) * ndims;
+		if (dims) {
+			for (int d = 0; d < ndims; ++d) {
+				row[d] = feature[dims[d]];
+			}
+		} else {
+			std::copy(feature, feature + ndims, row);
+		}
+	}
+}
+
+template void GatherDimensions<float>(const float* features, const int num,
+		const int dim, const int* dims, const int ndims, float* gathered);
+template void GatherDimensions<double>(const double* features, const int num,
+		const int dim, const int* dims, const int ndims, double* gathered);
+
+template<typename Dtype>
+void SquaredNorms(const Dtype* x, const int num, const int dim, Dtype* norms) {
+	for (int i = 0; i < num; ++i) {
+		const Dtype* row = x + static_cast<size_t>(i) * dim;
+		Dtype norm = 0;
+		for (int d = 0; d < dim; ++d) {
+			norm += row[d] * row[d];
+		}
+		norms[i] = norm;
+	}
+}
+
+template void SquaredNorms<float>(const float* x, const int num,
+		const int dim, float* norms);
+template void SquaredNorms<double>(const double* x, const int num,
+		const int dim, double* norms);
+
+template<typename Dtype>
+void SquaredL2Distances(const Dtype* queries, const Dtype* query_norms,
+		const int num_queries, const Dtype* database,
+		const Dtype* database_norms, const int num_database, const int dim,
+		Dtype* distances) {
+	caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, num_queries, num_database,
+			dim, Dtype(-2), queries, database, Dtype(0), distances);
+	for (int i = 0; i < num_queries; ++i) {
+		Dtype* row = distances + static_cast<size_t>(i) * num_database;
+		for (int j = 0; j < num_database; ++j) {
+			row[j] = std::max(row[j] + query_norms[i] + database_norms[j],
+					Dtype(0));
+		}
+	}
+}
+
+template void SquaredL2Distances<float>(const float* queries,
+		const float* query_norms, const int num_queries, const float* database,
+		const float* database_norms, const int num_database, const int dim,
+		float* distances);
+template void SquaredL2Distances<double>(const double* queries,
+		const double* query_norms, const int num_queries,
+		const double* database, const double* database_norms,
+		const int num_database, const int dim, double* distances);
+
+struct FloatEvalTask {
+	const float* queries;
+	const float* query_norms;
+	const float* database;
+	const float* database_norms;
+	int num_database;
+	int dim;
+	const int* query_classes;
+	const int* database_classes;
+	const int* relevant_per_class;
+	const RetrievalMetrics* metrics;
+	double* values;
+};
+
+static void FloatEvalWorker(WorkQueue* queue, void* task_pointer) {
+	FloatEvalTask* task = reinterpret_cast<FloatEvalTask*>(task_pointer);
+	const int num_database = task->num_database;
+	vector<float> distances(static_cast<size_t>(kFloatEvalTile) * num_database);
+	vector<std::pair<float, int> > scored(num_database);
+	vector<int> total, relevant;
+	int begin, end;
+	while (queue->Next(&begin, &end)) {
+		SquaredL2Distances(task->queries + static_cast<size_t>(begin) * task->dim,
+				task->query_norms + begin, end - begin, task->database,
+				task->database_norms, num_database, task->dim, &distances[0]);
+		for (int i = begin; i < end; ++i) {
+			const int query_class = task->query_classes[i];
+			const float* row = &distances[static_cast<size_t>(i - begin)
+					* num_database];
+			for (int j = 0; j < num_database; ++j) {
+				scored[j] = std::make_pair(row[j],
+						task->database_classes[j] == query_class);
+			}
+			std::sort(scored.begin(), scored.end());
+			// Equal distances form one tie group.
+			total.clear();
+			relevant.clear();
+			for (int j = 0; j < num_database; ++j) {
+				if (j == 0 || scored[j].first != scored[j - 1].first) {
+					total.push_back(0);
+					relevant.push_back(0);
+				}
+				total.back()++;
+				relevant.back() += scored[j].second;
+			}
+			task->metrics->Compute(&total[0], &relevant[0], total.size(),
+					task->relevant_per_class[query_class],
+					task->values + i * task->metrics->size());
+		}
+	}
+}
+
+void EvaluateFloat(const float* queries, const int num_queries,
+		const float* database, const int num_database, const int dim,
+		const int* query_classes, const int* database_classes,
+		const int* relevant_per_class, const RetrievalMetrics& metrics,
+		const int num_threads, vector<double>* values) {
+	CHECK_LT(metrics.radius(), 0)
+			<< "Radius metrics need integer distances.";
+	values->assign(num_queries * metrics.size(), 0.);
+	if (num_queries == 0 || num_database == 0) {
+		return;
+	}
+	vector<float> query_norms(num_queries), database_norms(num_database);
+	SquaredNorms(queries, num_queries, dim, &query_norms[0]);
+	SquaredNorms(database, num_database, dim, &database_norms[0]);
+	FloatEvalTask task;
+	task.queries = queries;
+	task.query_norms = &query_norms[0];
+	task.database = database;
+	task.database_norms = &database_norms[0];
+	task.num_database = num_database;
+	task.dim = dim;
+	task.query_classes = query_classes;
+	task.database_classes = database_classes;
+	task.relevant_per_class = relevant_per_class;
+	task.metrics = &metrics;
+	task.values = &(*values)[0];
+	ParallelFor(num_queries, kFloatEvalTile, num_threads, FloatEvalWorker,
+			&task);
+}
+
+}  // namespace caffe
@@ -0,0 +1,133 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#include "caffe/util/hash_code.hpp"
+
+namespace caffe {
+
+// Ties put the higher dimension first, as the stable ascending sort read
+// from the back did before.
+template<typename Dtype>
+static bool MoreImportant(const std::pair<Dtype, int>& a,
+		const std::pair<Dtype, int>& b) {
+	return a.first > b.first || (a.first == b.first && a.second > b.second);
+}
+
+template<typename Dtype>
+void RankBitsByWeight(const Dtype* weight, const int dim,
+		std::vector<int>* order) {
+	std::vector<std::pair<Dtype, int> > ranked(dim);
+	for (int i = 0; i < dim; ++i) {
+		ranked[i] = std::make_pair(static_cast<Dtype>(std::fabs(weight[i])), i);
+	}
+	std::sort(ranked.begin(), ranked.end(), MoreImportant<Dtype>);
+	order->resize(dim);
+	for (int i = 0; i < dim; ++i) {
+		(*order)[i] = ranked[i].second;
+	}
+}
+
+template void RankBitsByWeight<float>(const float* weight, const int dim,
+		std::vector<int>* order);
+template void RankBitsByWeight<double>(const double* weight, const int dim,
+		std::vector<int>* order);
+
+template<typename Dtype>
+void BinarizeCode(const Dtype* feature, const int nbits, const int* bit_order,
+		uint64_t* code) {
+	memset(code, 0, sizeof(uint64_t) * HashCodeWords(nbits));
+	for (int b = 0; b < nbits; ++b) {
+		const int dim = bit_order ? bit_order[b] : b;
+		if (feature[dim] > 0) {
+			code[b / 64] |= uint64_t(1) << (b % 64);
+		}
+	}
+}
+
+template void BinarizeCode<float>(const float* feature, const int nbits,
+		const int* bit_order, uint64_t* code);
+template void BinarizeCode<double>(const double* feature, const int nbits,
+		const int* bit_order, uint64_t* code);
+
+HashCodeStore::HashCodeStore(const HashCodeStore& other) :
+		nbits_(other.nbits_), words_(other.words_), num_(other.num_),
+		attached_(other.attached_), data_(NULL), codes_(other.codes_) {
+	data_ = attached_ ? other.data_ : (codes_.empty() ? NULL : &codes_[0]);
+}
+
+HashCodeStore& HashCodeStore::operator=(const HashCodeStore& other) {
+	if (this != &other) {
+		nbits_ = other.nbits_;
+		words_ = other.words_;
+		num_ = other.num_;
+		attached_ = other.attached_;
+		codes_ = other.codes_;
+		data_ = attached_ ? other.data_ : (codes_.empty() ? NULL : &codes_[0]);
+	}
+	return *this;
+}
+
+void HashCodeStore::Reset(const int nbits) {
+	CHECK_GT(nbits, 0) << "Hash code length must be positive.";
+	nbits_ = nbits;
+	words_ = HashCodeWords(nbits);
+	num_ = 0;
+	attached_ = false;
+	data_ = NULL;
+	codes_.clear();
+}
+
+void HashCodeStore::Attach(const uint64_t* codes, const int num,
+		const int nbits) {
+	Reset(nbits);
+	num_ = num;
+	attached_ = true;
+	data_ = codes;
+}
+
+void HashCodeStore::Reserve(const int num) {
+	codes_.reserve(static_cast<size_t>(num) * words_);
+}
+
+template<typename Dtype>
+void HashCodeStore::Append(const Dtype* feature, const int* bit_order) {
+	CHECK_GT(words_, 0) << "HashCodeStore used before Reset().";
+	CHECK(!attached_) << "Cannot append to attached codes.";
+	codes_.resize(codes_.size() + words_);
+	data_ = &codes_[0];
+	BinarizeCode(feature, nbits_, bit_order,
+			&codes_[static_cast<size_t>(num_) * words_]);
+	++num_;
+}
+
+template<typename Dtype>
+void HashCodeStore::AppendBatch(const Dtype* features, const int num,
+		const int dim, const int* bit_order) {
+	Reserve(num_ + num);
+	for (int i = 0; i < num; ++i) {
+		Append(features + i * dim, bit_order);
+	}
+}
+
+void HashCodeStore::AppendCode(const uint64_t* code) {
+	CHECK_GT(words_, 0) << "HashCodeStore used before Reset().";
+	CHECK(!attached_) << "Cannot append to attached codes.";
+	codes_.insert(codes_.end(), code, code + words_);
+	data_ = &codes_[0];
+	++num_;
+}
+
+template void HashCodeStore::Append<float>(const float* feature,
+		const int* bit_order);
+template void HashCodeStore::Append<double>(const double* feature,
+		const int* bit_order);
+template void HashCodeStore::AppendBatch<float>(const float* features,
+		const int num, const int dim, const int* bit_order);
+template void HashCodeStore::AppendBatch<double>(const double* features,
+		const int num, const int dim, const int* bit_order);
+
+}  // namespace caffe
@@ -0,0 +1,143 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <cmath>
+
+#include "caffe/util/hash_eval.hpp"
+
+namespace caffe {
+
+template<typename Dtype>
+WeightedHammingMetric::WeightedHammingMetric(const Dtype* weights,
+		const int nbits, const int levels) :
+		words_(HashCodeWords(nbits)), max_distance_(0) {
+	CHECK_GT(levels, 0);
+	double max_weight = 0;
+	for (int b = 0; b < nbits; ++b) {
+		max_weight = std::max(max_weight, std::fabs(double(weights[b])));
+	}
+	bit_weights_.assign(nbits, 1);
+	if (max_weight > 0) {
+		for (int b = 0; b < nbits; ++b) {
+			bit_weights_[b] = static_cast<int>(std::floor(
+					std::fabs(double(weights[b])) / max_weight * levels + 0.5));
+		}
+	}
+	// Bits past nbits keep weight 0, which also masks the unused prefix.
+	table_.assign(static_cast<size_t>(words_) * 8 * 256, 0);
+	for (int p = 0; p < words_ * 8; ++p) {
+		for (int v = 1; v < 256; ++v) {
+			const int low = v & -v;
+			const int b = p * 8 + __builtin_ctz(low);
+			table_[p * 256 + v] = table_[p * 256 + (v ^ low)]
+					+ (b < nbits ? bit_weights_[b] : 0);
+		}
+	}
+	for (int b = 0; b < nbits; ++b) {
+		max_distance_ += bit_weights_[b];
+	}
+}
+
+template WeightedHammingMetric::WeightedHammingMetric<float>(
+		const float* weights, const int nbits, const int levels);
+template WeightedHammingMetric::WeightedHammingMetric<double>(
+		const double* weights, const int nbits, const int levels);
+
+void ReduceByClass(const std::vector<double>& ap, const int* query_classes,
+		const int num_classes, std::vector<double>* class_sum) {
+	class_sum->assign(num_classes, 0.);
+	for (size_t i = 0; i < ap.size(); ++i) {
+		(*class_sum)[query_classes[i]] += ap[i];
+	}
+}
+
+struct PrefixEvalTask {
+	const HashCodeStore* queries;
+	const int* query_classes;
+	const HashCodeStore* database;
+	const int* database_classes;
+	const int* relevant_per_class;
+	const std::vector<int>* lengths;
+	const RetrievalMetrics* metrics;
+	std::vector<std::vector<double> >* values;
+};
+
+static void PrefixEvalWorker(WorkQueue* queue, void* task_pointer) {
+	PrefixEvalTask* task = reinterpret_cast<PrefixEvalTask*>(task_pointer);
+	const std::vector<int>& lengths = *task->lengths;
+	const int num_lengths = lengths.size();
+	const int database_num = task->database->num();
+	// The histograms of all lengths live in one buffer.
+	std::vector<int> offsets(num_lengths + 1, 0);
+	for (int l = 0; l < num_lengths; ++l) {
+		offsets[l + 1] = offsets[l] + lengths[l] + 1;
+	}
+	std::vector<int> total(offsets[num_lengths]);
+	std::vector<int> relevant(offsets[num_lengths]);
+	int begin, end;
+	while (queue->Next(&begin, &end)) {
+		for (int i = begin; i < end; ++i) {
+			const uint64_t* query = task->queries->code(i);
+			const int query_class = task->query_classes[i];
+			std::fill(total.begin(), total.end(), 0);
+			std::fill(relevant.begin(), relevant.end(), 0);
+			for (int j = 0; j < database_num; ++j) {
+				const uint64_t* code = task->database->code(j);
+				const int same = (task->database_classes[j] == query_class);
+				int dist = 0;
+				for (int l = 0, bit = 0; l < num_lengths; ++l) {
+					// Reuse the distance of the shorter prefix.
+					dist += RangeHammingDistance(query, code, bit, lengths[l]);
+					bit = lengths[l];
+					total[offsets[l] + dist]++;
+					relevant[offsets[l] + dist] += same;
+				}
+			}
+			const int size = task->metrics->size();
+			for (int l = 0; l < num_lengths; ++l) {
+				task->metrics->Compute(&total[offsets[l]], &relevant[offsets[l]],
+						lengths[l] + 1, task->relevant_per_class[query_class],
+						&(*task->values)[l][i * size]);
+			}
+		}
+	}
+}
+
+void EvaluatePrefixLengths(const HashCodeStore& queries,
+		const int* query_classes, const HashCodeStore& database,
+		const int* database_classes, const int* relevant_per_class,
+		const std::vector<int>& lengths, const int num_threads,
+		std::vector<std::vector<double> >* ap) {
+	EvaluatePrefixLengths(queries, query_classes, database, database_classes,
+			relevant_per_class, lengths, RetrievalMetrics(), num_threads, ap);
+}
+
+void EvaluatePrefixLengths(const HashCodeStore& queries,
+		const int* query_classes, const HashCodeStore& database,
+		const int* database_classes, const int* relevant_per_class,
+		const std::vector<int>& lengths, const RetrievalMetrics& metrics,
+		const int num_threads, std::vector<std::vector<double> >* values) {
+	for (size_t l = 0; l < lengths.size(); ++l) {
+		CHECK_GT(lengths[l], l > 0 ? lengths[l - 1] : 0)
+				<< "Code lengths must be positive and ascending.";
+	}
+	CHECK(lengths.empty() || lengths.back() <= database.nbits())
+			<< "Code length " << lengths.back() << " is longer than the "
+			<< database.nbits() << " stored bits.";
+	values->assign(lengths.size(),
+			std::vector<double>(queries.num() * metrics.size(), 0.));
+	if (queries.num() == 0 || lengths.empty()) {
+		return;
+	}
+	PrefixEvalTask task;
+	task.queries = &queries;
+	task.query_classes = query_classes;
+	task.database = &database;
+	task.database_classes = database_classes;
+	task.relevant_per_class = relevant_per_class;
+	task.lengths = &lengths;
+	task.metrics = &metrics;
+	task.values = values;
+	ParallelFor(queries.num(), 16, num_threads, PrefixEvalWorker, &task);
+}
+
+}  // namespace caffe
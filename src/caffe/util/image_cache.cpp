@@ -0,0 +1,86 @@
+// Copyright 2014 Ruimao Zhang
+
+#include "caffe/util/image_cache.hpp"
+
+using std::string;
+
+namespace caffe {
+
+ImageCache::ImageCache(const size_t capacity_bytes) :
+		capacity_bytes_(capacity_bytes), size_bytes_(0), hits_(0), misses_(0) {
+	pthread_mutex_init(&mutex_, NULL);
+}
+
+ImageCache::~ImageCache() {
+	pthread_mutex_destroy(&mutex_);
+}
+
+shared_ptr<const DecodedImage> ImageCache::Lookup(const string& key) {
+	shared_ptr<const DecodedImage> image;
+	pthread_mutex_lock(&mutex_);
+	std::map<string, EntryList::iterator>::iterator iter = index_.find(key);
+	if (iter == index_.end()) {
+		++misses_;
+	} else {
+		++hits_;
+		entries_.splice(entries_.begin(), entries_, iter->second);
+		image = iter->second->second;
+	}
+	pthread_mutex_unlock(&mutex_);
+	return image;
+}
+
+void ImageCache::Insert(const string& key,
+		const shared_ptr<const DecodedImage>& image) {
+	const size_t bytes = image->pixels.size();
+	if (bytes > capacity_bytes_) {
+		return;
+	}
+	pthread_mutex_lock(&mutex_);
+	std::map<string, EntryList::iterator>::iterator iter = index_.find(key);
+	if (iter != index_.end()) {
+		size_bytes_ -= iter->second->second->pixels.size();
+		entries_.erase(iter->second);
+		index_.erase(iter);
+	}
+	entries_.push_front(Entry(key, image));
+	index_[key] = entries_.begin();
+	size_bytes_ += bytes;
+	while (size_bytes_ > capacity_bytes_) {
+		const Entry& last = entries_.back();
+		size_bytes_ -= last.second->pixels.size();
+		index_.erase(last.first);
+		entries_.pop_back();
+	}
+	pthread_mutex_unlock(&mutex_);
+}
+
+size_t ImageCache::size_bytes() const {
+	pthread_mutex_lock(&mutex_);
+	const size_t size = size_bytes_;
+	pthread_mutex_unlock(&mutex_);
+	return size;
+}
+
+int ImageCache::count() const {
+	pthread_mutex_lock(&mutex_);
+	const int count = entries_.size();
+	pthread_mutex_unlock(&mutex_);
+	return count;
+}
+
+long long ImageCache::hits() const {
+	pthread_mutex_lock(&mutex_);
+	const long long hits = hits_;
+	pthread_mutex_unlock(&mutex_);
+	return hits;
+}
+
+long long ImageCache::misses() const {
+	pthread_mutex_lock(&mutex_);
+	const long long misses = misses_;
+	pthread_mutex_unlock(&mutex_);
+	return misses;
+}
+
+}  // namespace caffe
@@ -0,0 +1,112 @@
+// Copyright 2014 Ruimao Zhang
+
+#include "caffe/util/image_transform.hpp"
+
+namespace caffe {
+
+// One output row of one channel. src steps by the channel count; dst is
+// walked backwards when mirroring, so both loops stay branch-free.
+template<typename Dtype, int kStride>
+static inline void NormalizeRow(const uint8_t* src, const Dtype* mean,
+		const int n, const bool mirror, const Dtype bias, const Dtype scale,
+		Dtype* dst) {
+	if (mirror) {
+		Dtype* last = dst + n - 1;
+		for (int w = 0; w < n; ++w) {
+			last[-w] = bias - (static_cast<Dtype>(src[w * kStride]) - mean[w])
+					* scale;
+		}
+	} else {
+		for (int w = 0; w < n; ++w) {
+			dst[w] = bias - (static_cast<Dtype>(src[w * kStride]) - mean[w])
+					* scale;
+		}
+	}
+}
+
+// Three channels, deinterleaved in one pass over the source row.
+template<typename Dtype>
+static inline void NormalizeRow3(const uint8_t* src, const Dtype* mean0,
+		const Dtype* mean1, const Dtype* mean2, const int n, const bool mirror,
+		const Dtype bias, const Dtype scale, Dtype* dst0, Dtype* dst1,
+		Dtype* dst2) {
+	if (mirror) {
+		dst0 += n - 1;
+		dst1 += n - 1;
+		dst2 += n - 1;
+		for (int w = 0; w < n; ++w) {
+			const uint8_t* pixel = src + 3 * w;
+			dst0[-w] = bias - (static_cast<Dtype>(pixel[0]) - mean0[w]) * scale;
+			dst1[-w] = bias - (static_cast<Dtype>(pixel[1]) - mean1[w]) * scale;
+			dst2[-w] = bias - (static_cast<Dtype>(pixel[2]) - mean2[w]) * scale;
+		}
+	} else {
+		for (int w = 0; w < n; ++w) {
+			const uint8_t* pixel = src + 3 * w;
+			dst0[w] = bias - (static_cast<Dtype>(pixel[0]) - mean0[w]) * scale;
+			dst1[w] = bias - (static_cast<Dtype>(pixel[1]) - mean1[w]) * scale;
+			dst2[w] = bias - (static_cast<Dtype>(pixel[2]) - mean2[w]) * scale;
+		}
+	}
+}
+
+template<typename Dtype>
+void CropNormalizeHWC(const uint8_t* src, const int height, const int width,
+		const int channels, const int h_off, const int w_off, const int crop_h,
+		const int crop_w, const bool mirror, const Dtype* mean,
+		const Dtype scale, Dtype* dst) {
+	CHECK_GE(h_off, 0);
+	CHECK_GE(w_off, 0);
+	CHECK_LE(h_off + crop_h, height);
+	CHECK_LE(w_off + crop_w, width);
+	const Dtype bias = 128 * scale;
+	const size_t plane = static_cast<size_t>(height) * width;
+	const size_t out_plane = static_cast<size_t>(crop_h) * crop_w;
+	for (int h = 0; h < crop_h; ++h) {
+		const size_t row = static_cast<size_t>(h + h_off) * width + w_off;
+		const uint8_t* src_row = src + row * channels;
+		const Dtype* mean_row = mean + row;
+		Dtype* dst_row = dst + static_cast<size_t>(h) * crop_w;
+		switch (channels) {
+		case 1:
+			NormalizeRow<Dtype, 1>(src_row, mean_row, crop_w, mirror, bias,
+					scale, dst_row);
+			break;
+		case 3:
+			NormalizeRow3(src_row, mean_row, mean_row + plane,
+					mean_row + 2 * plane, crop_w, mirror, bias, scale, dst_row,
+					dst_row + out_plane, dst_row + 2 * out_plane);
+			break;
+		default:
+			for (int c = 0; c < channels; ++c) {
+				const uint8_t* s = src_row + c;
+				const Dtype* m = mean_row + c * plane;
+				Dtype* d = dst_row + c * out_plane;
+				if (mirror) {
+					for (int w = 0; w < crop_w; ++w) {
+						d[crop_w - 1 - w] = bias
+								- (static_cast<Dtype>(s[w * channels]) - m[w])
+										* scale;
+					}
+				} else {
+					for (int w = 0; w < crop_w; ++w) {
+						d[w] = bias
+								- (static_cast<Dtype>(s[w * channels]) - m[w])
+										* scale;
+					}
+				}
+			}
+		}
+	}
+}
+
+template void CropNormalizeHWC<float>(const uint8_t* src, const int height,
+		const int width, const int channels, const int h_off, const int w_off,
+		const int crop_h, const int crop_w, const bool mirror, const float* mean,
+		const float scale, float* dst);
+template void CropNormalizeHWC<double>(const uint8_t* src, const int height,
+		const int width, const int channels, const int h_off, const int w_off,
+		const int crop_h, const int crop_w, const bool mirror,
+		const double* mean, const double scale, double* dst);
+
+}  // namespace caffe
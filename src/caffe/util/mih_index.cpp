@@ -0,0 +1,239 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "caffe/util/mih_index.hpp"
+
+using std::make_pair;
+using std::pair;
+using std::vector;
+
+namespace caffe {
+
+const int MultiIndexHash::kMaxSubstringBits;
+
+int MultiIndexHash::DefaultSubstrings(const int nbits, const int num) {
+	int sub_bits = static_cast<int>(
+			std::floor(std::log(std::max(num, 2)) / std::log(2.) + 0.5));
+	sub_bits = std::max(1, std::min(sub_bits, kMaxSubstringBits));
+	return std::min(nbits, (nbits + sub_bits - 1) / sub_bits);
+}
+
+void MultiIndexHash::Build(const HashCodeStore& store,
+		const int num_substrings) {
+	store_ = &store;
+	const int nbits = store.nbits();
+	num_substrings_ =
+			num_substrings > 0 ?
+					num_substrings : DefaultSubstrings(nbits, store.num());
+	CHECK_LE(num_substrings_, nbits)<< "More substrings than code bits.";
+
+	// Split the code as evenly as possible, the first substrings get the
+	// extra bits.
+	sub_begin_.resize(num_substrings_);
+	sub_len_.resize(num_substrings_);
+	for (int j = 0, begin = 0; j < num_substrings_; ++j) {
+		sub_begin_[j] = begin;
+		sub_len_[j] = nbits / num_substrings_
+				+ (j < nbits % num_substrings_ ? 1 : 0);
+		CHECK_LE(sub_len_[j], kMaxSubstringBits)
+				<< "Substrings of " << sub_len_[j] << " bits are too long, "
+				<< "use more substrings.";
+		begin += sub_len_[j];
+	}
+
+	// Counting sort of the items on each substring.
+	table_offsets_.resize(num_substrings_);
+	table_ids_.resize(num_substrings_);
+	const int num = store.num();
+	for (int j = 0; j < num_substrings_; ++j) {
+		vector<int>& offsets = table_offsets_[j];
+		vector<int>& ids = table_ids_[j];
+		offsets.assign((size_t(1) << sub_len_[j]) + 1, 0);
+		for (int i = 0; i < num; ++i) {
+			offsets[Substring(store.code(i), j) + 1]++;
+		}
+		for (size_t v = 1; v < offsets.size(); ++v) {
+			offsets[v] += offsets[v - 1];
+		}
+		ids.resize(num);
+		vector<int> fill(offsets.begin(), offsets.end() - 1);
+		for (int i = 0; i < num; ++i) {
+			ids[fill[Substring(store.code(i), j)]++] = i;
+		}
+	}
+}
+
+uint32_t MultiIndexHash::Substring(const uint64_t* code, const int j) const {
+	const int begin = sub_begin_[j];
+	const int len = sub_len_[j];
+	const int word = begin / 64;
+	const int offset = begin % 64;
+	uint64_t value = code[word] >> offset;
+	if (offset + len > 64) {
+		value |= code[word + 1] << (64 - offset);
+	}
+	return static_cast<uint32_t>(value & ((uint64_t(1) << len) - 1));
+}
+
+void MultiIndexHash::Probe(const uint64_t* query, const int t,
+		vector<int>* ids, vector<int>* distances) const {
+	const int words = store_->words();
+	for (int j = 0; j < num_substrings_; ++j) {
+		const int len = sub_len_[j];
+		if (t > len) {
+			continue;
+		}
+		const uint32_t q = Substring(query, j);
+		const vector<int>& offsets = table_offsets_[j];
+		const vector<int>& table = table_ids_[j];
+		// Enumerate all len-bit masks with exactly t bits set (Gosper's hack).
+		const uint32_t limit = uint32_t(1) << len;
+		uint32_t mask = (t == 0) ? 0 : ((uint32_t(1) << t) - 1);
+		while (mask < limit) {
+			const uint32_t bucket = q ^ mask;
+			for (int p = offsets[bucket]; p < offsets[bucket + 1]; ++p) {
+				const int id = table[p];
+				const uint64_t* code = store_->code(id);
+				// Skip the item if an earlier probe already reached it: some
+				// earlier table is within t, or some table is within t - 1.
+				bool seen = false;
+				for (int jj = 0; jj < num_substrings_ && !seen; ++jj) {
+					if (jj == j) {
+						continue;
+					}
+					const int d = __builtin_popcount(
+							Substring(code, jj) ^ Substring(query, jj));
+					seen = (jj < j) ? (d <= t) : (d < t);
+				}
+				if (!seen) {
+					ids->push_back(id);
+					distances->push_back(HammingDistance(code, query, words));
+				}
+			}
+			if (mask == 0) {
+				break;
+			}
+			const uint32_t c = mask & -mask;
+			const uint32_t r = mask + c;
+			mask = (((r ^ mask) >> 2) / c) | r;
+		}
+	}
+}
+
+static void SortByDistance(const int max_count, vector<int>* ids,
+		vector<int>* distances) {
+	vector<pair<int, int> > order(ids->size());
+	for (size_t i = 0; i < ids->size(); ++i) {
+		order[i] = make_pair((*distances)[i], (*ids)[i]);
+	}
+	std::sort(order.begin(), order.end());
+	if (static_cast<int>(order.size()) > max_count) {
+		order.resize(max_count);
+	}
+	ids->resize(order.size());
+	distances->resize(order.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		(*distances)[i] = order[i].first;
+		(*ids)[i] = order[i].second;
+	}
+}
+
+void MultiIndexHash::KnnSearch(const uint64_t* query, const int k,
+		vector<int>* ids, vector<int>* distances) const {
+	CHECK(store_) << "MultiIndexHash used before Build().";
+	ids->clear();
+	distances->clear();
+	const int wanted = std::min(k, store_->num());
+	const int max_len = sub_len_[0];
+	for (int t = 0; t <= max_len; ++t) {
+		Probe(query, t, ids, distances);
+		// Every item within this radius has been found by now.
+		const int certain = num_substrings_ * (t + 1) - 1;
+		int found = 0;
+		for (size_t i = 0; i < distances->size(); ++i) {
+			found += ((*distances)[i] <= certain);
+		}
+		if (found >= wanted) {
+			break;
+		}
+	}
+	SortByDistance(wanted, ids, distances);
+}
+
+void MultiIndexHash::RadiusSearch(const uint64_t* query, const int radius,
+		vector<int>* ids, vector<int>* distances) const {
+	vector<int> offsets;
+	GroupedRadiusSearch(query, radius, ids, &offsets);
+	distances->resize(ids->size());
+	for (size_t d = 0; d + 1 < offsets.size(); ++d) {
+		std::fill(distances->begin() + offsets[d],
+				distances->begin() + offsets[d + 1], static_cast<int>(d));
+	}
+}
+
+bool MultiIndexHash::PrefersLinearScan(const int radius) const {
+	CHECK(store_) << "MultiIndexHash used before Build().";
+	// Probing table j at substring radius t visits C(len, t) buckets, which
+	// hold num / 2^len items each; every candidate is then checked against
+	// the other substrings. A scan costs one distance per code.
+	const int max_t = radius / num_substrings_;
+	const double num = store_->num();
+	double probe_cost = 0;
+	for (int j = 0; j < num_substrings_; ++j) {
+		const int len = sub_len_[j];
+		double buckets = 0, combinations = 1;
+		for (int t = 0; t <= std::min(max_t, len); ++t) {
+			buckets += combinations;
+			combinations = combinations * (len - t) / (t + 1);
+		}
+		probe_cost += buckets
+				+ buckets * num / (size_t(1) << len) * num_substrings_;
+	}
+	return probe_cost > num * store_->words();
+}
+
+void MultiIndexHash::GroupedRadiusSearch(const uint64_t* query,
+		const int radius, vector<int>* ids, vector<int>* offsets) const {
+	CHECK(store_) << "MultiIndexHash used before Build().";
+	CHECK_GE(radius, 0);
+	vector<int> candidates, distances;
+	if (PrefersLinearScan(radius)) {
+		for (int i = 0; i < store_->num(); ++i) {
+			const int d = store_->Distance(i, query);
+			if (d <= radius) {
+				candidates.push_back(i);
+				distances.push_back(d);
+			}
+		}
+	} else {
+		const int max_t = std::min(radius / num_substrings_, sub_len_[0]);
+		for (int t = 0; t <= max_t; ++t) {
+			Probe(query, t, &candidates, &distances);
+		}
+	}
+	// Counting sort on the distance, then ascending ids within each group.
+	offsets->assign(radius + 2, 0);
+	for (size_t i = 0; i < candidates.size(); ++i) {
+		if (distances[i] <= radius) {
+			(*offsets)[distances[i] + 1]++;
+		}
+	}
+	for (int d = 1; d <= radius + 1; ++d) {
+		(*offsets)[d] += (*offsets)[d - 1];
+	}
+	ids->resize(offsets->back());
+	vector<int> fill(offsets->begin(), offsets->end() - 1);
+	for (size_t i = 0; i < candidates.size(); ++i) {
+		if (distances[i] <= radius) {
+			(*ids)[fill[distances[i]]++] = candidates[i];
+		}
+	}
+	for (int d = 0; d <= radius; ++d) {
+		std::sort(ids->begin() + (*offsets)[d], ids->begin() + (*offsets)[d + 1]);
+	}
+}
+
+}  // namespace caffe
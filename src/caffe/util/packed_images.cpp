@@ -0,0 +1,218 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "caffe/util/dataset_manifest.hpp"
+#include "caffe/util/packed_images.hpp"
+
+using std::string;
+using std::vector;
+
+namespace caffe {
+
+static const char kPackedImageMagic[8] = { 'B', 'S', 'D', 'H', 'P', 'I',
+		'M', 'G' };
+static const uint32_t kPackedImageVersion = 1;
+
+static uint64_t Align8(const uint64_t offset) {
+	return (offset + 7) & ~uint64_t(7);
+}
+
+// Zero-fills the file up to offset, which may be a page away.
+static void PadTo(std::ofstream* file, const uint64_t offset) {
+	static const char zeros[64] = { 0 };
+	uint64_t pos = file->tellp();
+	CHECK_LE(pos, offset);
+	while (pos < offset) {
+		const uint64_t n = std::min<uint64_t>(offset - pos, sizeof(zeros));
+		file->write(zeros, n);
+		pos += n;
+	}
+}
+
+PackedImageWriter::~PackedImageWriter() {
+	if (file_.is_open()) {
+		Close();
+	}
+}
+
+void PackedImageWriter::Open(const string& filename, const int height,
+		const int width, const int channels) {
+	CHECK(!file_.is_open()) << "PackedImageWriter is already open.";
+	CHECK_GT(height, 0);
+	CHECK_GT(width, 0);
+	CHECK_GT(channels, 0);
+	filename_ = filename;
+	file_.open(filename.c_str(),
+			std::ios::out | std::ios::trunc | std::ios::binary);
+	CHECK(file_) << "Failed to open " << filename;
+
+	memset(&header_, 0, sizeof(header_));
+	memcpy(header_.magic, kPackedImageMagic, sizeof(header_.magic));
+	header_.version = kPackedImageVersion;
+	header_.height = height;
+	header_.width = width;
+	header_.channels = channels;
+	image_bytes_ = static_cast<uint64_t>(height) * width * channels;
+	header_.image_stride = Align8(image_bytes_);
+	header_.images_offset = kPackedImageAlignment;
+
+	// The header is rewritten with the index offsets by Close().
+	file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+	PadTo(&file_, header_.images_offset);
+	class2id_.clear();
+	class_names_.clear();
+	class_ids_.clear();
+	image_ids_.clear();
+}
+
+void PackedImageWriter::Append(const string& class_name, const int image_id,
+		const uint8_t* pixels) {
+	CHECK(file_.is_open()) << "PackedImageWriter is not open.";
+	std::map<string, int>::iterator iter = class2id_.find(class_name);
+	if (iter == class2id_.end()) {
+		iter = class2id_.insert(iter,
+				std::make_pair(class_name, static_cast<int>(class_names_.size())));
+		class_names_.push_back(class_name);
+	}
+	PadTo(&file_, header_.images_offset + count() * header_.image_stride);
+	file_.write(reinterpret_cast<const char*>(pixels), image_bytes_);
+	class_ids_.push_back(iter->second);
+	image_ids_.push_back(image_id);
+}
+
+void PackedImageWriter::Close() {
+	CHECK(file_.is_open()) << "PackedImageWriter is not open.";
+	const int count = image_ids_.size();
+	const int num_classes = class_names_.size();
+	header_.count = count;
+	header_.num_classes = num_classes;
+
+	// Sort the images by (class, id) for the index.
+	vector<std::pair<std::pair<int, int>, int> > keys(count);
+	for (int i = 0; i < count; ++i) {
+		keys[i] = std::make_pair(std::make_pair(class_ids_[i], image_ids_[i]),
+				i);
+	}
+	std::sort(keys.begin(), keys.end());
+	vector<int32_t> class_begin(num_classes + 1, 0);
+	vector<int32_t> image_ids(count), records(count);
+	for (int i = 0; i < count; ++i) {
+		CHECK(i == 0 || keys[i].first != keys[i - 1].first)
+				<< class_names_[keys[i].first.first] << "_"
+				<< keys[i].first.second << " was appended twice.";
+		class_begin[keys[i].first.first + 1]++;
+		image_ids[i] = keys[i].first.second;
+		records[i] = keys[i].second;
+	}
+	for (int c = 0; c < num_classes; ++c) {
+		class_begin[c + 1] += class_begin[c];
+	}
+
+	header_.class_names_offset = Align8(header_.images_offset
+			+ count * header_.image_stride);
+	PadTo(&file_, header_.class_names_offset);
+	uint64_t position = 0;
+	file_.write(reinterpret_cast<const char*>(&position), sizeof(position));
+	for (int c = 0; c < num_classes; ++c) {
+		position += class_names_[c].size();
+		file_.write(reinterpret_cast<const char*>(&position), sizeof(position));
+	}
+	for (int c = 0; c < num_classes; ++c) {
+		file_.write(class_names_[c].data(), class_names_[c].size());
+	}
+	header_.class_begin_offset = Align8(file_.tellp());
+	PadTo(&file_, header_.class_begin_offset);
+	file_.write(reinterpret_cast<const char*>(&class_begin[0]),
+			class_begin.size() * sizeof(int32_t));
+	header_.image_ids_offset = Align8(file_.tellp());
+	PadTo(&file_, header_.image_ids_offset);
+	if (count) {
+		file_.write(reinterpret_cast<const char*>(&image_ids[0]),
+				count * sizeof(int32_t));
+	}
+	header_.records_offset = Align8(file_.tellp());
+	PadTo(&file_, header_.records_offset);
+	if (count) {
+		file_.write(reinterpret_cast<const char*>(&records[0]),
+				count * sizeof(int32_t));
+	}
+	header_.file_size = file_.tellp();
+	file_.seekp(0);
+	file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+	CHECK(file_) << "Failed to write " << filename_;
+	file_.close();
+}
+
+void PackedImageFile::Open(const string& filename) {
+	Close();
+	int fd = open(filename.c_str(), O_RDONLY);
+	CHECK_NE(fd, -1) << "File not found: " << filename;
+	struct stat st;
+	CHECK_EQ(fstat(fd, &st), 0) << "Failed to stat " << filename;
+	size_ = st.st_size;
+	CHECK_GE(size_, sizeof(PackedImageHeader)) << filename << " is truncated.";
+	void* data = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	CHECK(data != MAP_FAILED) << "Failed to mmap " << filename;
+	data_ = reinterpret_cast<const char*>(data);
+	header_ = reinterpret_cast<const PackedImageHeader*>(data_);
+	CHECK_EQ(memcmp(header_->magic, kPackedImageMagic,
+			sizeof(kPackedImageMagic)), 0) << filename
+			<< " is not a packed image file.";
+	CHECK_EQ(header_->version, kPackedImageVersion)
+			<< "Unsupported packed image version in " << filename;
+	CHECK_EQ(header_->file_size, size_) << filename << " is truncated.";
+	for (int c = 0; c < num_classes(); ++c) {
+		class2id_[class_name(c)] = c;
+	}
+}
+
+void PackedImageFile::Close() {
+	if (data_) {
+		munmap(const_cast<char*>(data_), size_);
+	}
+	data_ = NULL;
+	size_ = 0;
+	header_ = NULL;
+	class2id_.clear();
+}
+
+string PackedImageFile::class_name(const int c) const {
+	const uint64_t* offsets = Section<uint64_t>(header_->class_names_offset);
+	const char* chars = reinterpret_cast<const char*>(offsets
+			+ header_->num_classes + 1);
+	return string(chars + offsets[c], offsets[c + 1] - offsets[c]);
+}
+
+int PackedImageFile::Find(const string& class_name, const int image_id) const {
+	std::map<string, int>::const_iterator iter = class2id_.find(class_name);
+	if (iter == class2id_.end()) {
+		return -1;
+	}
+	const int32_t* class_begin = Section<int32_t>(header_->class_begin_offset);
+	const int32_t* image_ids = Section<int32_t>(header_->image_ids_offset);
+	const int32_t* begin = image_ids + class_begin[iter->second];
+	const int32_t* end = image_ids + class_begin[iter->second + 1];
+	const int32_t* found = std::lower_bound(begin, end, image_id);
+	if (found == end || *found != image_id) {
+		return -1;
+	}
+	return Section<int32_t>(header_->records_offset)[found - image_ids];
+}
+
+int PackedImageFile::Find(const string& filename) const {
+	string class_name;
+	int image_id;
+	ParseImageName(filename, &class_name, &image_id);
+	return Find(class_name, image_id);
+}
+
+}  // namespace caffe
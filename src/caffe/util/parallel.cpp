@@ -0,0 +1,133 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <unistd.h>
+
+#include "caffe/util/parallel.hpp"
+
+namespace caffe {
+
+struct ParallelForTask {
+	WorkQueue* queue;
+	ParallelWorker worker;
+	void* arg;
+};
+
+static void* ParallelForEntry(void* task_pointer) {
+	ParallelForTask* task = reinterpret_cast<ParallelForTask*>(task_pointer);
+	task->worker(task->queue, task->arg);
+	return (void*) NULL;
+}
+
+void ParallelFor(const int num, const int chunk, const int num_threads,
+		ParallelWorker worker, void* arg) {
+	if (num <= 0) {
+		return;
+	}
+	WorkQueue queue(num, chunk);
+	ParallelForTask task;
+	task.queue = &queue;
+	task.worker = worker;
+	task.arg = arg;
+	// No more threads than chunks.
+	const int threads = std::min(
+			num_threads > 0 ? num_threads : DefaultEvalThreads(),
+			(num + chunk - 1) / chunk);
+	std::vector<pthread_t> workers(threads - 1);
+	for (size_t t = 0; t < workers.size(); ++t) {
+		CHECK(!pthread_create(&workers[t], NULL, ParallelForEntry,
+				reinterpret_cast<void*>(&task)))
+				<< "Pthread execution failed.";
+	}
+	worker(&queue, arg);
+	for (size_t t = 0; t < workers.size(); ++t) {
+		CHECK(!pthread_join(workers[t], NULL)) << "Pthread joining failed.";
+	}
+}
+
+WorkerPool::WorkerPool(const int num_threads) :
+		queue_(NULL), worker_(NULL), arg_(NULL), generation_(0), running_(0),
+		stop_(false) {
+	pthread_mutex_init(&mutex_, NULL);
+	pthread_cond_init(&loop_ready_, NULL);
+	pthread_cond_init(&loop_done_, NULL);
+	threads_.resize((num_threads > 0 ? num_threads : DefaultEvalThreads()) - 1);
+	for (size_t t = 0; t < threads_.size(); ++t) {
+		CHECK(!pthread_create(&threads_[t], NULL, Entry,
+				reinterpret_cast<void*>(this))) << "Pthread execution failed.";
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	pthread_mutex_lock(&mutex_);
+	stop_ = true;
+	pthread_cond_broadcast(&loop_ready_);
+	pthread_mutex_unlock(&mutex_);
+	for (size_t t = 0; t < threads_.size(); ++t) {
+		CHECK(!pthread_join(threads_[t], NULL)) << "Pthread joining failed.";
+	}
+	pthread_cond_destroy(&loop_done_);
+	pthread_cond_destroy(&loop_ready_);
+	pthread_mutex_destroy(&mutex_);
+}
+
+void WorkerPool::Run(const int num, const int chunk, ParallelWorker worker,
+		void* arg) {
+	if (num <= 0) {
+		return;
+	}
+	WorkQueue queue(num, chunk);
+	pthread_mutex_lock(&mutex_);
+	CHECK_EQ(running_, 0) << "WorkerPool::Run is not reentrant.";
+	queue_ = &queue;
+	worker_ = worker;
+	arg_ = arg;
+	running_ = threads_.size();
+	++generation_;
+	pthread_cond_broadcast(&loop_ready_);
+	pthread_mutex_unlock(&mutex_);
+	worker(&queue, arg);
+	// queue lives on this stack, so wait until no pool thread uses it.
+	pthread_mutex_lock(&mutex_);
+	while (running_ > 0) {
+		pthread_cond_wait(&loop_done_, &mutex_);
+	}
+	queue_ = NULL;
+	pthread_mutex_unlock(&mutex_);
+}
+
+void* WorkerPool::Entry(void* pool_pointer) {
+	reinterpret_cast<WorkerPool*>(pool_pointer)->Loop();
+	return (void*) NULL;
+}
+
+void WorkerPool::Loop() {
+	int seen = 0;
+	pthread_mutex_lock(&mutex_);
+	for (;;) {
+		while (!stop_ && generation_ == seen) {
+			pthread_cond_wait(&loop_ready_, &mutex_);
+		}
+		if (stop_) {
+			break;
+		}
+		// Run() waits for every pool thread, so none can miss a loop.
+		seen = generation_;
+		WorkQueue* queue = queue_;
+		ParallelWorker worker = worker_;
+		void* arg = arg_;
+		pthread_mutex_unlock(&mutex_);
+		worker(queue, arg);
+		pthread_mutex_lock(&mutex_);
+		if (--running_ == 0) {
+			pthread_cond_signal(&loop_done_);
+		}
+	}
+	pthread_mutex_unlock(&mutex_);
+}
+
+int DefaultEvalThreads() {
+	const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0 ? static_cast<int>(cores) : 1;
+}
+
+}  // namespace caffe
@@ -0,0 +1,146 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <algorithm>
+#include <sstream>
+
+#include "caffe/util/retrieval_metrics.hpp"
+
+using std::vector;
+
+namespace caffe {
+
+double AveragePrecision(const int* total, const int* relevant,
+		const int buckets, const int num_relevant) {
+	if (num_relevant <= 0) {
+		return 0.;
+	}
+	double sum = 0.;
+	int seen = 0;
+	int seen_relevant = 0;
+	for (int d = 0; d < buckets; ++d) {
+		const int n = total[d];
+		const int r = relevant[d];
+		if (r > 0) {
+			// A position j of the tie group holds a relevant item with
+			// probability r / n, and then (j - 1)(r - 1) / (n - 1) of the
+			// group items ranked before it are relevant as well.
+			const double spread = (n > 1) ? double(r - 1) / (n - 1) : 0.;
+			double group = 0.;
+			for (int j = 1; j <= n; ++j) {
+				group += (seen_relevant + 1 + (j - 1) * spread) / (seen + j);
+			}
+			sum += group * r / n;
+		}
+		seen += n;
+		seen_relevant += r;
+	}
+	return sum / num_relevant;
+}
+
+// Expected number of relevant items among the first k when every tie group
+// is in random order: a group cut by the k-th position contributes
+// proportionally.
+static double RelevantInTop(const int* total, const int* relevant,
+		const int buckets, const int k) {
+	double found = 0.;
+	for (int d = 0, seen = 0; d < buckets && seen < k; ++d) {
+		const int n = total[d];
+		found += (seen + n <= k) ?
+				relevant[d] : double(relevant[d]) * (k - seen) / n;
+		seen += n;
+	}
+	return found;
+}
+
+// Probability that at least one relevant item is among the first k.
+static double HitInTop(const int* total, const int* relevant,
+		const int buckets, const int k) {
+	for (int d = 0, seen = 0; d < buckets && seen < k; ++d) {
+		const int n = total[d];
+		const int r = relevant[d];
+		if (r > 0) {
+			// The first m items of the group are all irrelevant with
+			// probability C(n - r, m) / C(n, m).
+			const int m = std::min(k - seen, n);
+			double miss = 1.;
+			for (int i = 0; i < m && miss > 0; ++i) {
+				miss *= double(n - r - i) / (n - i);
+			}
+			return 1. - miss;
+		}
+		seen += n;
+	}
+	return 0.;
+}
+
+RetrievalMetrics::RetrievalMetrics() :
+		radius_(-1) {
+	Init();
+}
+
+RetrievalMetrics::RetrievalMetrics(const vector<int>& precision_ks,
+		const int radius, const vector<int>& cmc_ranks) :
+		precision_ks_(precision_ks), radius_(radius), cmc_ranks_(cmc_ranks) {
+	Init();
+}
+
+void RetrievalMetrics::Init() {
+	names_.assign(1, "mAP");
+	for (size_t i = 0; i < precision_ks_.size(); ++i) {
+		CHECK_GT(precision_ks_[i], 0);
+		std::ostringstream name;
+		name << "P@" << precision_ks_[i];
+		names_.push_back(name.str());
+	}
+	if (radius_ >= 0) {
+		std::ostringstream precision, recall;
+		precision << "P@r" << radius_;
+		recall << "R@r" << radius_;
+		names_.push_back(precision.str());
+		names_.push_back(recall.str());
+	}
+	for (size_t i = 0; i < cmc_ranks_.size(); ++i) {
+		CHECK_GT(cmc_ranks_[i], 0);
+		std::ostringstream name;
+		name << "CMC@" << cmc_ranks_[i];
+		names_.push_back(name.str());
+	}
+}
+
+void RetrievalMetrics::Compute(const int* total, const int* relevant,
+		const int buckets, const int num_relevant, double* values) const {
+	*values++ = AveragePrecision(total, relevant, buckets, num_relevant);
+	for (size_t i = 0; i < precision_ks_.size(); ++i) {
+		*values++ = RelevantInTop(total, relevant, buckets, precision_ks_[i])
+				/ precision_ks_[i];
+	}
+	if (radius_ >= 0) {
+		int within = 0, within_relevant = 0;
+		for (int d = 0; d <= radius_ && d < buckets; ++d) {
+			within += total[d];
+			within_relevant += relevant[d];
+		}
+		*values++ = within > 0 ? double(within_relevant) / within : 0.;
+		*values++ =
+				num_relevant > 0 ? double(within_relevant) / num_relevant : 0.;
+	}
+	for (size_t i = 0; i < cmc_ranks_.size(); ++i) {
+		*values++ = HitInTop(total, relevant, buckets, cmc_ranks_[i]);
+	}
+}
+
+void RetrievalMetrics::Mean(const vector<double>& values,
+		vector<double>* mean) const {
+	mean->assign(size(), 0.);
+	const int num = values.size() / size();
+	for (int i = 0; i < num; ++i) {
+		for (int m = 0; m < size(); ++m) {
+			(*mean)[m] += values[i * size() + m];
+		}
+	}
+	for (int m = 0; m < size() && num > 0; ++m) {
+		(*mean)[m] /= num;
+	}
+}
+
+}  // namespace caffe
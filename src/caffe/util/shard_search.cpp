@@ -0,0 +1,153 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <unistd.h>
+
+#include <functional>
+#include <queue>
+#include <sstream>
+#include <utility>
+
+#include "caffe/util/hash_code.hpp"
+#include "caffe/util/shard_search.hpp"
+
+using std::string;
+using std::vector;
+
+namespace caffe {
+
+string FormatKnnRequest(const uint64_t* code, const int words, const int k) {
+	std::ostringstream request;
+	request << "knn " << k << std::hex;
+	for (int w = 0; w < words; ++w) {
+		request << ' ' << code[w];
+	}
+	return request.str();
+}
+
+bool ParseKnnRequest(const string& line, int* k, vector<uint64_t>* code) {
+	std::istringstream request(line);
+	string kind;
+	request >> kind >> *k;
+	if (!request || kind != "knn" || *k <= 0) {
+		return false;
+	}
+	size_t words = 0;
+	while (words < code->size() && request >> std::hex >> (*code)[words]) {
+		++words;
+	}
+	return words == code->size();
+}
+
+string FormatKnnResponse(const vector<int>& ids, const vector<int>& distances) {
+	std::ostringstream response;
+	response << "ok " << ids.size();
+	for (size_t i = 0; i < ids.size(); ++i) {
+		response << ' ' << ids[i] << ' ' << distances[i];
+	}
+	return response.str();
+}
+
+bool ParseKnnResponse(const string& line, vector<int>* ids,
+		vector<int>* distances) {
+	std::istringstream response(line);
+	string status;
+	int n = 0;
+	response >> status >> n;
+	if (!response || status != "ok" || n < 0) {
+		return false;
+	}
+	ids->resize(n);
+	distances->resize(n);
+	for (int i = 0; i < n; ++i) {
+		response >> (*ids)[i] >> (*distances)[i];
+	}
+	return !response.fail();
+}
+
+void MergeShardResults(const vector<vector<int> >& ids,
+		const vector<vector<int> >& distances, const int k,
+		vector<int>* merged_ids, vector<int>* merged_distances) {
+	// Heap of ((distance, id), shard) over the head of every list.
+	typedef std::pair<std::pair<int, int>, int> Head;
+	std::priority_queue<Head, vector<Head>, std::greater<Head> > heads;
+	vector<size_t> next(ids.size(), 0);
+	for (size_t s = 0; s < ids.size(); ++s) {
+		if (!ids[s].empty()) {
+			heads.push(std::make_pair(std::make_pair(distances[s][0], ids[s][0]),
+					static_cast<int>(s)));
+		}
+	}
+	merged_ids->clear();
+	merged_distances->clear();
+	while (!heads.empty() && static_cast<int>(merged_ids->size()) < k) {
+		const Head head = heads.top();
+		heads.pop();
+		merged_distances->push_back(head.first.first);
+		merged_ids->push_back(head.first.second);
+		const int s = head.second;
+		if (++next[s] < ids[s].size()) {
+			heads.push(std::make_pair(std::make_pair(distances[s][next[s]],
+					ids[s][next[s]]), s));
+		}
+	}
+}
+
+void ServeShardConnection(const MultiIndexHash& index, const int id_offset,
+		const int fd) {
+	LineReader reader(fd);
+	string line;
+	vector<uint64_t> code(index.store()->words());
+	vector<int> ids, distances;
+	while (reader.ReadLine(&line)) {
+		int k = 0;
+		string response;
+		if (ParseKnnRequest(line, &k, &code)) {
+			index.KnnSearch(&code[0], k, &ids, &distances);
+			for (size_t i = 0; i < ids.size(); ++i) {
+				ids[i] += id_offset;
+			}
+			response = FormatKnnResponse(ids, distances);
+		} else {
+			response = "error expected: knn <k> <word> ...";
+		}
+		if (!WriteAll(fd, response + "\n")) {
+			break;
+		}
+	}
+}
+
+ShardedIndex::ShardedIndex(const vector<string>& socket_paths,
+		const int nbits) :
+		words_(HashCodeWords(nbits)), shard_ids_(socket_paths.size()),
+		shard_distances_(socket_paths.size()) {
+	CHECK(!socket_paths.empty());
+	for (size_t s = 0; s < socket_paths.size(); ++s) {
+		fds_.push_back(ConnectUnixSocket(socket_paths[s]));
+		readers_.push_back(LineReader(fds_.back()));
+	}
+}
+
+ShardedIndex::~ShardedIndex() {
+	for (size_t s = 0; s < fds_.size(); ++s) {
+		close(fds_[s]);
+	}
+}
+
+void ShardedIndex::KnnSearch(const uint64_t* query, const int k,
+		vector<int>* ids, vector<int>* distances) {
+	// Every shard may hold all of the global top k.
+	const string request = FormatKnnRequest(query, words_, k) + "\n";
+	for (size_t s = 0; s < fds_.size(); ++s) {
+		CHECK(WriteAll(fds_[s], request)) << "Shard " << s << " has gone away.";
+	}
+	string line;
+	for (size_t s = 0; s < fds_.size(); ++s) {
+		CHECK(readers_[s].ReadLine(&line)) << "Shard " << s
+				<< " has gone away.";
+		CHECK(ParseKnnResponse(line, &shard_ids_[s], &shard_distances_[s]))
+				<< "Shard " << s << ": " << line;
+	}
+	MergeShardResults(shard_ids_, shard_distances_, k, ids, distances);
+}
+
+}  // namespace caffe
@@ -0,0 +1,143 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <algorithm>
+
+#include "caffe/util/parallel.hpp"
+#include "caffe/util/topk_search.hpp"
+
+using std::vector;
+
+namespace caffe {
+
+template<typename Metric>
+const int TopKSearcher<Metric>::kQueryChunk;
+template<typename Metric>
+const int TopKSearcher<Metric>::kTileBytes;
+
+// The candidates of one query: buckets[d] holds, in ascending order, the ids
+// at distance d seen so far, for d <= limit. stored counts them all, and limit
+// is lowered as soon as the buckets below it hold k items on their own.
+struct TopKCandidates {
+	vector<vector<int> > buckets;
+	int limit;
+	int stored;
+
+	void Reset(const int max_distance) {
+		buckets.resize(max_distance + 1);
+		limit = max_distance;
+		stored = 0;
+	}
+	// Items are offered in ascending id order, so an item at the limit is
+	// only kept while fewer than k are stored.
+	inline bool Accepts(const int d, const int k) const {
+		return d < limit || (d == limit && stored < k);
+	}
+	inline void Insert(const int d, const int id, const int k) {
+		buckets[d].push_back(id);
+		++stored;
+		while (stored - static_cast<int>(buckets[limit].size()) >= k) {
+			stored -= buckets[limit].size();
+			buckets[limit].clear();
+			--limit;
+		}
+	}
+	// No item can enter once k exact matches are stored.
+	inline bool Done(const int k) const {
+		return limit == 0 && stored >= k;
+	}
+	// Writes the first n candidates and empties the buckets.
+	void Collect(const int n, int* ids, int* distances) {
+		int r = 0;
+		for (int d = 0; d <= limit; ++d) {
+			for (size_t j = 0; j < buckets[d].size() && r < n; ++j, ++r) {
+				ids[r] = buckets[d][j];
+				distances[r] = d;
+			}
+			buckets[d].clear();
+		}
+		CHECK_EQ(r, n);
+	}
+};
+
+template<typename Metric>
+struct TopKTask {
+	const Metric* metric;
+	const HashCodeStore* queries;
+	const HashCodeStore* database;
+	int k;
+	int n;
+	int* ids;
+	int* distances;
+};
+
+template<typename Metric>
+static void TopKWorker(WorkQueue* queue, void* task_pointer) {
+	TopKTask<Metric>* task = reinterpret_cast<TopKTask<Metric>*>(task_pointer);
+	const Metric& metric = *task->metric;
+	const HashCodeStore& database = *task->database;
+	const int chunk = TopKSearcher<Metric>::kQueryChunk;
+	const int database_num = database.num();
+	const int k = task->k;
+	const int tile = std::max(TopKSearcher<Metric>::kTileBytes
+			/ static_cast<int>(database.words() * sizeof(uint64_t)), 64);
+	vector<TopKCandidates> candidates(chunk);
+	vector<bool> done(chunk);
+	int begin, end;
+	while (queue->Next(&begin, &end)) {
+		for (int i = begin; i < end; ++i) {
+			candidates[i - begin].Reset(metric.max_distance());
+			done[i - begin] = false;
+		}
+		for (int tile_begin = 0; tile_begin < database_num; tile_begin += tile) {
+			const int tile_end = std::min(tile_begin + tile, database_num);
+			for (int i = begin; i < end; ++i) {
+				if (done[i - begin]) {
+					continue;
+				}
+				TopKCandidates& query = candidates[i - begin];
+				const uint64_t* code = task->queries->code(i);
+				for (int j = tile_begin; j < tile_end; ++j) {
+					const int d = metric(code, database.code(j));
+					if (query.Accepts(d, k)) {
+						query.Insert(d, j, k);
+					}
+				}
+				done[i - begin] = query.Done(k);
+			}
+		}
+		for (int i = begin; i < end; ++i) {
+			candidates[i - begin].Collect(task->n,
+					task->ids + static_cast<size_t>(i) * task->n,
+					task->distances + static_cast<size_t>(i) * task->n);
+		}
+	}
+}
+
+template<typename Metric>
+void TopKSearcher<Metric>::Search(const HashCodeStore& query_codes,
+		const int k, vector<int>* ids, vector<int>* distances,
+		const int num_threads) const {
+	CHECK_GE(k, 0);
+	CHECK_EQ(query_codes.nbits(), database_->nbits());
+	const int n = std::min(k, database_->num());
+	ids->resize(static_cast<size_t>(query_codes.num()) * n);
+	distances->resize(ids->size());
+	if (ids->empty()) {
+		return;
+	}
+	TopKTask<Metric> task;
+	task.metric = metric_;
+	task.queries = &query_codes;
+	task.database = database_;
+	task.k = k;
+	task.n = n;
+	task.ids = &(*ids)[0];
+	task.distances = &(*distances)[0];
+	ParallelFor(query_codes.num(), kQueryChunk, num_threads,
+			TopKWorker<Metric>, &task);
+}
+
+template class TopKSearcher<HammingMetric>;
+template class TopKSearcher<WeightedHammingMetric>;
+
+}  // namespace caffe
@@ -0,0 +1,143 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <sys/time.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "caffe/util/parallel.hpp"
+#include "caffe/util/two_stage_search.hpp"
+
+using std::vector;
+
+namespace caffe {
+
+static double ElapsedUs(const struct timeval& begin, const struct timeval& end) {
+	return (end.tv_sec - begin.tv_sec) * 1e6 + (end.tv_usec - begin.tv_usec);
+}
+
+TwoStageSearcher::TwoStageSearcher(const MultiIndexHash& index,
+		const CodeFile& features, const int shortlist) :
+		index_(&index), features_(&features), shortlist_(shortlist) {
+	CHECK(index.store()) << "The index is not built.";
+	CHECK_EQ(features.type(), CODE_FILE_FLOAT);
+	CHECK_EQ(features.count(), index.store()->num());
+	CHECK_GT(shortlist, 0);
+}
+
+void TwoStageSearcher::Search(const uint64_t* query_code,
+		const float* query_feature, const int k, vector<int>* ids,
+		vector<float>* distances, TwoStageTiming* timing) const {
+	struct timeval begin, shortlisted, end;
+	gettimeofday(&begin, NULL);
+	vector<int> hamming;
+	index_->KnnSearch(query_code, shortlist_, ids, &hamming);
+	gettimeofday(&shortlisted, NULL);
+
+	const int dim = features_->dim();
+	vector<std::pair<float, int> > scored(ids->size());
+	for (size_t i = 0; i < ids->size(); ++i) {
+		const float* feature =
+				static_cast<const float*>(features_->row((*ids)[i]));
+		float dist = 0;
+		for (int d = 0; d < dim; ++d) {
+			const float diff = query_feature[d] - feature[d];
+			dist += diff * diff;
+		}
+		scored[i] = std::make_pair(dist, (*ids)[i]);
+	}
+	const size_t kept = (k < 0) ? scored.size() :
+			std::min(scored.size(), static_cast<size_t>(k));
+	std::partial_sort(scored.begin(), scored.begin() + kept, scored.end());
+	ids->resize(kept);
+	distances->resize(kept);
+	for (size_t i = 0; i < kept; ++i) {
+		(*distances)[i] = scored[i].first;
+		(*ids)[i] = scored[i].second;
+	}
+	gettimeofday(&end, NULL);
+	if (timing) {
+		timing->shortlist_us = ElapsedUs(begin, shortlisted);
+		timing->rerank_us = ElapsedUs(shortlisted, end);
+	}
+}
+
+struct TwoStageEvalTask {
+	const TwoStageSearcher* searcher;
+	const HashCodeStore* queries;
+	const float* query_features;
+	int dim;
+	const int* query_classes;
+	const int* database_classes;
+	const int* relevant_per_class;
+	const RetrievalMetrics* metrics;
+	double* values;
+	TwoStageTiming* timings;
+};
+
+static void TwoStageEvalWorker(WorkQueue* queue, void* task_pointer) {
+	TwoStageEvalTask* task = reinterpret_cast<TwoStageEvalTask*>(task_pointer);
+	const int database_num = task->searcher->index().store()->num();
+	vector<int> ids, total, relevant;
+	vector<float> distances;
+	int begin, end;
+	while (queue->Next(&begin, &end)) {
+		for (int i = begin; i < end; ++i) {
+			const int query_class = task->query_classes[i];
+			task->searcher->Search(task->queries->code(i),
+					task->query_features + i * task->dim, -1, &ids, &distances,
+					task->timings + i);
+			total.clear();
+			relevant.clear();
+			int found = 0;
+			for (size_t j = 0; j < ids.size(); ++j) {
+				if (j == 0 || distances[j] != distances[j - 1]) {
+					total.push_back(0);
+					relevant.push_back(0);
+				}
+				const bool hit = task->database_classes[ids[j]] == query_class;
+				total.back()++;
+				relevant.back() += hit;
+				found += hit;
+			}
+			const int num_relevant = task->relevant_per_class[query_class];
+			if (static_cast<int>(ids.size()) < database_num) {
+				total.push_back(database_num - ids.size());
+				relevant.push_back(num_relevant - found);
+			}
+			task->metrics->Compute(&total[0], &relevant[0], total.size(),
+					num_relevant, task->values + i * task->metrics->size());
+		}
+	}
+}
+
+void EvaluateTwoStage(const TwoStageSearcher& searcher,
+		const HashCodeStore& queries, const float* query_features,
+		const int* query_classes, const int* database_classes,
+		const int* relevant_per_class, const RetrievalMetrics& metrics,
+		const int num_threads, vector<double>* values,
+		vector<TwoStageTiming>* timings) {
+	CHECK_LT(metrics.radius(), 0)
+			<< "Radius metrics need integer distances.";
+	CHECK_EQ(queries.nbits(), searcher.index().store()->nbits());
+	values->assign(queries.num() * metrics.size(), 0.);
+	TwoStageTiming zero = { 0., 0. };
+	timings->assign(queries.num(), zero);
+	if (queries.num() == 0 || searcher.index().store()->num() == 0) {
+		return;
+	}
+	TwoStageEvalTask task;
+	task.searcher = &searcher;
+	task.queries = &queries;
+	task.query_features = query_features;
+	task.dim = searcher.dim();
+	task.query_classes = query_classes;
+	task.database_classes = database_classes;
+	task.relevant_per_class = relevant_per_class;
+	task.metrics = &metrics;
+	task.values = &(*values)[0];
+	task.timings = &(*timings)[0];
+	ParallelFor(queries.num(), 16, num_threads, TwoStageEvalWorker, &task);
+}
+
+}  // namespace caffe
@@ -0,0 +1,86 @@
+// Copyright 2014 Ruimao Zhang
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "caffe/util/unix_socket.hpp"
+
+using std::string;
+
+namespace caffe {
+
+static void FillAddress(const string& path, sockaddr_un* address) {
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	CHECK_LT(path.size(), sizeof(address->sun_path))
+			<< "Socket path too long: " << path;
+	strncpy(address->sun_path, path.c_str(), sizeof(address->sun_path) - 1);
+}
+
+int ListenUnixSocket(const string& path, const int backlog) {
+	sockaddr_un address;
+	FillAddress(path, &address);
+	unlink(path.c_str());
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	CHECK_GE(fd, 0) << "Failed to create socket: " << strerror(errno);
+	CHECK_EQ(bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)),
+			0) << "Failed to bind " << path << ": " << strerror(errno);
+	CHECK_EQ(listen(fd, backlog), 0) << "Failed to listen on " << path;
+	return fd;
+}
+
+int ConnectUnixSocket(const string& path) {
+	sockaddr_un address;
+	FillAddress(path, &address);
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	CHECK_GE(fd, 0) << "Failed to create socket: " << strerror(errno);
+	CHECK_EQ(
+			connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)),
+			0) << "Failed to connect to " << path << ": " << strerror(errno);
+	return fd;
+}
+
+bool WriteAll(const int fd, const string& data) {
+	size_t written = 0;
+	while (written < data.size()) {
+		// MSG_NOSIGNAL: a closed peer is an error return, not a SIGPIPE.
+		const ssize_t n = send(fd, data.data() + written, data.size() - written,
+				MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		written += n;
+	}
+	return true;
+}
+
+bool LineReader::ReadLine(string* line) {
+	while (true) {
+		const size_t end = buffer_.find('\n', begin_);
+		if (end != string::npos) {
+			line->assign(buffer_, begin_, end - begin_);
+			begin_ = end + 1;
+			return true;
+		}
+		buffer_.erase(0, begin_);
+		begin_ = 0;
+		char chunk[4096];
+		const ssize_t n = read(fd_, chunk, sizeof(chunk));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		buffer_.append(chunk, n);
+	}
+}
+
+}  // namespace caffe